@@ -0,0 +1,691 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "raytracer.h"
+#include "scenes.h"
+
+//  Microbenchmarks and reference scene renders.
+//
+//  bench.exe [baseline] [--update] [--tolerance 0.15] [--filter name]
+//
+//  Every benchmark is repeated and reported as the median ns/op with the
+//  relative standard deviation over the repetitions. Medians are compared
+//  against the baseline file, a slowdown beyond the tolerance fails the run.
+//  --update with --filter only replaces the baselines of the benchmarks run.
+//  Besides timings it reports how close a denoised 4 spp render comes to
+//  one of 64 spp, which --filter denoise runs alone.
+
+namespace
+{
+    volatile float sink;
+
+    struct Result
+    {
+        std::string name;
+
+        double median_ns = 0.0;
+        double stddev_ns = 0.0;
+
+        // Only set for scene renders
+        double mrays = 0.0;
+    };
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    double median(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    double stddev(const std::vector<double>& values)
+    {
+        double mean = 0.0;
+        for ( double value : values )
+            mean += value;
+        mean /= values.size();
+
+        double variance = 0.0;
+        for ( double value : values )
+            variance += (value - mean) * (value - mean);
+        variance /= values.size();
+
+        return std::sqrt(variance);
+    }
+
+    // Times ops calls of body per repetition
+    template < typename F >
+    Result run(const std::string& name, int ops, F body, int repetitions = 21)
+    {
+        std::vector<double> samples;
+        samples.reserve(repetitions);
+
+        // Warm up caches and branch predictors
+        body(ops);
+
+        for ( int i = 0 ; i < repetitions ; i++ )
+        {
+            Clock::time_point start_point = Clock::now();
+            body(ops);
+            std::chrono::duration<double, std::nano> delta_time = Clock::now() - start_point;
+
+            samples.push_back(delta_time.count() / ops);
+        }
+
+        Result result;
+        result.name      = name;
+        result.median_ns = median(samples);
+        result.stddev_ns = stddev(samples);
+
+        return result;
+    }
+
+    Result run_scene(const std::string& name, void (*scene)(Raytracer&), int repetitions = 5)
+    {
+        // Single threaded so results compare across machines, see scaling.exe
+        Raytracer rt(320, 240);
+        rt.set_threads(1);
+        scene(rt);
+
+        std::vector<double> samples;
+        std::vector<double> mrays;
+
+        rt.render();
+
+        for ( int i = 0 ; i < repetitions ; i++ )
+        {
+            rt.render();
+
+            samples.push_back(rt.stats.get_frame_seconds() * 1.0e9);
+            mrays.push_back(rt.stats.get_totals().total_rays() / rt.stats.get_frame_seconds() / 1.0e6);
+        }
+
+        Result result;
+        result.name      = name;
+        result.median_ns = median(samples);
+        result.stddev_ns = stddev(samples);
+        result.mrays     = median(mrays);
+
+        return result;
+    }
+
+    // Root mean square difference of the average colors of two framebuffers
+    double rmse(const Framebuffer& a, const Framebuffer& b)
+    {
+        double scale_a = 1.0 / std::max(a.get_samples(), 1);
+        double scale_b = 1.0 / std::max(b.get_samples(), 1);
+
+        double sum = 0.0;
+        for ( size_t i = 0 ; i < a.color.size() ; i++ )
+        {
+            double difference = a.color[i] * scale_a - b.color[i] * scale_b;
+            sum += difference * difference;
+        }
+
+        return std::sqrt(sum / std::max(a.color.size(), (size_t) 1));
+    }
+
+    struct Denoise_Comparison
+    {
+        double raw_error      = 0.0;    // 4 spp against 64 spp
+        double denoised_error = 0.0;    // 4 spp denoised against 64 spp
+
+        double denoised_seconds  = 0.0;
+        double reference_seconds = 0.0;
+    };
+
+    // The default scene through a thin lens, whose defocus blur is what
+    // few samples leave noisy
+    Denoise_Comparison compare_denoiser()
+    {
+        auto render = [](int samples, bool denoise, Framebuffer& result)
+        {
+            Raytracer rt(320, 240);
+            rt.set_threads(1);
+            scene_default(rt);
+
+            Camera camera = rt.get_camera();
+            camera.set_lens(1.0f, 10.0f);
+            rt.set_camera(camera);
+
+            rt.set_samples_per_pixel(samples);
+            rt.enable_denoiser(denoise);
+            rt.render();
+
+            result = denoise ? rt.get_denoised() : rt.get_framebuffer();
+            return rt.stats.get_frame_seconds();
+        };
+
+        Framebuffer reference, raw, denoised;
+
+        Denoise_Comparison comparison;
+        comparison.reference_seconds = render(64, false, reference);
+        comparison.denoised_seconds  = render(4,  true,  denoised);
+        render(4, false, raw);
+
+        comparison.raw_error      = rmse(raw,      reference);
+        comparison.denoised_error = rmse(denoised, reference);
+
+        return comparison;
+    }
+
+    // Rays from around the origin towards the shapes under test
+    std::vector<Ray> random_rays(int count)
+    {
+        std::mt19937 engine(1234);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        std::vector<Ray> rays;
+        rays.reserve(count);
+
+        for ( int i = 0 ; i < count ; i++ )
+        {
+            Vec3 dir(dist(engine) * 0.5f, dist(engine) * 0.5f, 1.0f);
+            dir.normalize();
+
+            rays.push_back( Ray(dir, Vec3(dist(engine), dist(engine), 0.0f)) );
+        }
+
+        return rays;
+    }
+
+    // Closed sphere whose triangles share their vertices bit for bit, the
+    // seam and poles included
+    std::vector<Triangle> closed_sphere(const Vec3& center, float radius, int rings, int segments)
+    {
+        std::vector<Vec3> points;
+
+        for ( int ring = 0 ; ring <= rings ; ring++ )
+        {
+            for ( int segment = 0 ; segment < segments ; segment++ )
+            {
+                float theta = PI * ring / rings;
+                float phi   = 2.0f * PI * segment / segments;
+
+                if ( (ring == 0) || (ring == rings) )
+                    phi = 0.0f;
+
+                points.push_back( center + Vec3( std::sin(theta) * std::cos(phi),
+                                                 std::cos(theta),
+                                                 std::sin(theta) * std::sin(phi) ) * radius );
+            }
+        }
+
+        auto point = [&](int ring, int segment)
+        {
+            if ( (ring == 0) || (ring == rings) )
+                segment = 0;
+
+            return points[ring * segments + segment % segments];
+        };
+
+        std::vector<Triangle> triangles;
+
+        for ( int ring = 0 ; ring < rings ; ring++ )
+        {
+            for ( int segment = 0 ; segment < segments ; segment++ )
+            {
+                if ( ring > 0 )
+                    triangles.push_back( Triangle(point(ring, segment), point(ring + 1, segment), point(ring, segment + 1)) );
+                if ( ring < rings - 1 )
+                    triangles.push_back( Triangle(point(ring, segment + 1), point(ring + 1, segment), point(ring + 1, segment + 1)) );
+            }
+        }
+
+        return triangles;
+    }
+
+    // Rays from inside a closed mesh through points along the edges of its
+    // triangles, vertices included, that pass between them
+    int count_leaks(const Mesh& mesh, const Vec3& inside, bool watertight)
+    {
+        const std::vector<Triangle>& triangles = mesh.get_triangles();
+
+        int leaks = 0;
+
+        for ( const Triangle& triangle : triangles )
+        {
+            const Vec3* vertices[3] = { &triangle.vertex_a, &triangle.vertex_b, &triangle.vertex_c };
+
+            for ( int edge = 0 ; edge < 3 ; edge++ )
+            {
+                const Vec3& from = *vertices[edge];
+                const Vec3& to   = *vertices[(edge + 1) % 3];
+
+                for ( int step = 0 ; step < 4 ; step++ )
+                {
+                    Vec3 dir = from + (to - from) * (step / 4.0f) - inside;
+                    dir.normalize();
+
+                    Ray ray(dir, inside);
+                    bool hit = false;
+
+                    if ( watertight )
+                    {
+                        hit = ( mesh.intersect(ray) > 0.0f );
+                    }
+                    else
+                    {
+                        for ( int t = 0 ; (t < (int) triangles.size()) && !hit ; t++ )
+                            hit = ( triangles[t].intersect(ray) > 0.0001f );
+                    }
+
+                    leaks += hit ? 0 : 1;
+                }
+            }
+        }
+
+        return leaks;
+    }
+
+    // names receives the benchmarks in file order when given
+    std::map<std::string, double> read_baseline( const std::string& filename,
+                                                 std::vector<std::string>* names = nullptr )
+    {
+        std::map<std::string, double> baseline;
+        std::ifstream ifs(filename);
+
+        std::string line;
+        while ( std::getline(ifs, line) )
+        {
+            if ( line.empty() || (line[0] == '#') )
+                continue;
+
+            std::istringstream iss(line);
+
+            std::string name;
+            double      value;
+
+            if ( !(iss >> name >> value) )
+                continue;
+
+            if ( (names != nullptr) && (baseline.count(name) == 0) )
+                names->push_back(name);
+
+            baseline[name] = value;
+        }
+
+        return baseline;
+    }
+
+    // Merges results into the baseline in filename, benchmarks that were
+    // not run keep their entries unless only_results is set
+    bool write_baseline( const std::string& filename,
+                         const std::vector<Result>& results,
+                         bool only_results )
+    {
+        std::vector<std::string>      names;
+        std::map<std::string, double> baseline;
+
+        if ( !only_results )
+            baseline = read_baseline(filename, &names);
+
+        for ( const Result& result : results )
+        {
+            if ( baseline.count(result.name) == 0 )
+                names.push_back(result.name);
+
+            baseline[result.name] = result.median_ns;
+        }
+
+        std::ofstream ofs(filename);
+
+        if ( !ofs.is_open() )
+            return false;
+
+        ofs << "# name median_ns_per_op, regenerate with make bench-baseline\n";
+        for ( const std::string& name : names )
+            ofs << name << " " << std::fixed << std::setprecision(2) 
+                << baseline[name] << "\n";
+
+        return (bool) ofs;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string baseline_file = "bench/baseline.txt";
+    std::string filter;
+
+    bool   update    = false;
+    double tolerance = 0.15;
+
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+        std::string arg(argv[i]);
+
+        if ( arg == "--update" )
+            update = true;
+        else if ( (arg == "--tolerance") && (i + 1 < argc) )
+            tolerance = std::atof(argv[++i]);
+        else if ( (arg == "--filter") && (i + 1 < argc) )
+            filter = argv[++i];
+        else
+            baseline_file = arg;
+    }
+
+    const int ray_count = 4096;
+    std::vector<Ray> rays = random_rays(ray_count);
+
+    Sphere   sphere(Vec3(0.0f, 0.0f, 10.0f), 3.0f);
+    Plane    plane(Vec3(0.0f, -2.0f, 0.0f), Vec3(0.0f, 1.0f, 0.3f));
+    Triangle triangle( Vec3(-3.0f, -3.0f, 10.0f),
+                       Vec3( 0.0f,  3.0f, 10.0f),
+                       Vec3( 3.0f, -3.0f, 10.0f) );
+    Mesh     mesh( tessellate_sphere(Vec3(0.0f, 0.0f, 10.0f), 3.0f, 16, 32) );
+
+    // The uncompressed binary tree the wide one of the mesh is collapsed from
+    const std::vector<Triangle>& mesh_triangles = mesh.get_triangles();
+    Bvh mesh_binary_bvh;
+    {
+        std::vector<Aabb> bounds;
+        for ( const Triangle& mesh_triangle : mesh_triangles )
+        {
+            Vec3 min, max;
+            mesh_triangle.get_bounds(min, max);
+            bounds.emplace_back(min, max);
+        }
+        mesh_binary_bvh.build(bounds);
+    }
+
+    // Four triangles around the one above, tested at once by the packed
+    // kernel and one after another by the scalar one
+    std::vector<Triangle> quad = { Triangle( Vec3(-3.0f, -3.0f, 10.0f), Vec3(0.0f, 0.0f, 10.0f), Vec3( 3.0f, -3.0f, 10.0f) ),
+                                   Triangle( Vec3( 3.0f, -3.0f, 10.0f), Vec3(0.0f, 0.0f, 10.0f), Vec3( 3.0f,  3.0f, 10.0f) ),
+                                   Triangle( Vec3( 3.0f,  3.0f, 10.0f), Vec3(0.0f, 0.0f, 10.0f), Vec3(-3.0f,  3.0f, 10.0f) ),
+                                   Triangle( Vec3(-3.0f,  3.0f, 10.0f), Vec3(0.0f, 0.0f, 10.0f), Vec3(-3.0f, -3.0f, 10.0f) ) };
+    Triangle_Packs quad_packs;
+    quad_packs.build(quad, { 0, 1, 2, 3 });
+
+    Vec3 closed_center(0.3f, -0.2f, 10.0f);
+    Mesh closed_mesh( closed_sphere(closed_center, 3.0f, 24, 48) );
+
+    Camera camera(800, 600, 80.0f);
+
+    auto intersect = [&rays](const Shape& shape)
+    {
+        return [&rays, &shape](int ops)
+        {
+            float sum = 0.0f;
+            for ( int i = 0 ; i < ops ; i++ )
+                sum += shape.intersect(rays[i % ray_count]);
+            sink = sum;
+        };
+    };
+
+    std::vector<Result> results;
+
+    auto bench = [&](const std::string& name, int ops, auto body)
+    {
+        if ( filter.empty() || (name.find(filter) != std::string::npos) )
+            results.push_back( run(name, ops, body) );
+    };
+
+    bench("sphere_intersect",   1 << 16, intersect(sphere));
+    bench("plane_intersect",    1 << 16, intersect(plane));
+    bench("triangle_intersect", 1 << 16, intersect(triangle));
+    bench("mesh_intersect",     1 << 10, intersect(mesh));
+    bench("mesh_intersect_binary", 1 << 10, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            const Ray& ray = rays[i % ray_count];
+            float closest  = std::numeric_limits<float>::max();
+
+            mesh_binary_bvh.traverse( ray.ori, ray.dir, closest, [&](int t)
+            {
+                float depth = mesh_triangles[t].intersect(ray);
+                if ( (depth > 0.0001f) && (depth < closest) )
+                    closest = depth;
+            });
+
+            sum += closest;
+        }
+        sink = sum;
+    });
+
+    bench("mesh_intersect_moller", 1 << 10, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            const Ray& ray = rays[i % ray_count];
+            float closest  = std::numeric_limits<float>::max();
+
+            mesh.get_bvh().traverse( ray.ori, ray.dir, closest, [&](int t)
+            {
+                float depth = mesh_triangles[t].intersect(ray);
+                if ( (depth > 0.0001f) && (depth < closest) )
+                    closest = depth;
+            });
+
+            sum += closest;
+        }
+        sink = sum;
+    });
+    bench("triangle_intersect_x4", 1 << 14, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            const Ray& ray = rays[i % ray_count];
+            for ( const Triangle& quad_triangle : quad )
+                sum += quad_triangle.intersect(ray);
+        }
+        sink = sum;
+    });
+    bench("triangle_watertight_x4", 1 << 14, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            const Ray& ray = rays[i % ray_count];
+            float closest  = std::numeric_limits<float>::max();
+            int   hit      = -1;
+
+            quad_packs.intersect(Watertight_Ray(ray.ori, ray.dir), 0, 4, closest, hit);
+            sum += closest;
+        }
+        sink = sum;
+    });
+
+    bench("vec3_add", 1 << 16, [&rays](int ops)
+    {
+        Vec3 sum;
+        for ( int i = 0 ; i < ops ; i++ )
+            sum = rays[i % ray_count].dir + rays[i % ray_count].ori;
+        sink = sum.x;
+    });
+    bench("vec3_dot", 1 << 16, [&rays](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+            sum += rays[i % ray_count].dir * rays[i % ray_count].ori;
+        sink = sum;
+    });
+    bench("vec3_cross", 1 << 16, [&rays](int ops)
+    {
+        Vec3 sum;
+        for ( int i = 0 ; i < ops ; i++ )
+            sum += rays[i % ray_count].dir.cross_product(rays[i % ray_count].ori);
+        sink = sum.x;
+    });
+    bench("vec3_normalize", 1 << 16, [&rays](int ops)
+    {
+        Vec3 sum;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            Vec3 v = rays[i % ray_count].ori + rays[i % ray_count].dir;
+            sum += v.normalize();
+        }
+        sink = sum.x;
+    });
+    bench("color_mul", 1 << 16, [&rays](int ops)
+    {
+        Color sum;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            Color color(rays[i % ray_count].dir.x, rays[i % ray_count].dir.y, 0.5f);
+            sum += color * Color(Color::ORANGE) * 0.5f;
+        }
+        sink = sum.red;
+    });
+    bench("color_add", 1 << 16, [&rays](int ops)
+    {
+        Color sum;
+        for ( int i = 0 ; i < ops ; i++ )
+        {
+            Color color(rays[i % ray_count].dir.x, rays[i % ray_count].dir.y, 0.5f);
+            sum = sum + color;
+        }
+        sink = sum.red;
+    });
+    bench("camera_primary_ray", 1 << 16, [&camera](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i++ )
+            sum += camera.get_primary_ray(i % 800, (i / 800) % 600).dir.x;
+        sink = sum;
+    });
+
+    // Per ray, a 32 x 32 tile at a time
+    Ray_Buffer tile_rays;
+
+    bench("camera_primary_rays", 1 << 16, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i += 1024 )
+        {
+            int tile = i / 1024;
+            int x0   = (tile % 25) * 32;
+            int y0   = (tile / 25 % 18) * 32;
+
+            camera.get_primary_rays(x0, y0, x0 + 32, y0 + 32, 1, 1, tile_rays);
+            sum += tile_rays.dir_x[0];
+        }
+        sink = sum;
+    });
+
+    // 16 x 16 pixels, four jittered samples each through a thin lens
+    Camera lens_camera = camera;
+    lens_camera.set_lens(1.0f, 10.0f);
+
+    bench("camera_lens_rays", 1 << 16, [&](int ops)
+    {
+        float sum = 0.0f;
+        for ( int i = 0 ; i < ops ; i += 1024 )
+        {
+            int tile = i / 1024;
+            int x0   = (tile % 50) * 16;
+            int y0   = (tile / 50 % 37) * 16;
+
+            lens_camera.get_primary_rays(x0, y0, x0 + 16, y0 + 16, 1, 4, tile_rays);
+            sum += tile_rays.dir_x[0];
+        }
+        sink = sum;
+    });
+
+    if ( filter.empty() || (std::string("scene_default").find(filter) != std::string::npos) )
+        results.push_back( run_scene("scene_default", scene_default) );
+    if ( filter.empty() || (std::string("scene_mesh").find(filter) != std::string::npos) )
+        results.push_back( run_scene("scene_mesh", scene_mesh) );
+
+    std::map<std::string, double> baseline = read_baseline(baseline_file);
+
+    int regressions = 0;
+
+    std::cout << std::left  << std::setw(22) << "benchmark"
+              << std::right << std::setw(14) << "median ns/op"
+              << std::setw(10) << "+-%"
+              << std::setw(10) << "Mrays/s"
+              << std::setw(14) << "baseline"
+              << std::setw(10) << "change" << "\n";
+
+    std::cout << std::fixed;
+
+    for ( const Result& result : results )
+    {
+        std::cout << std::left  << std::setw(22) << result.name
+                  << std::right << std::setw(14) << std::setprecision(2) << result.median_ns
+                  << std::setw(10) << std::setprecision(1) 
+                  << 100.0 * result.stddev_ns / result.median_ns;
+
+        if ( result.mrays > 0.0 )
+            std::cout << std::setw(10) << std::setprecision(2) << result.mrays;
+        else
+            std::cout << std::setw(10) << "-";
+
+        std::map<std::string, double>::const_iterator it = baseline.find(result.name);
+
+        if ( it != baseline.end() )
+        {
+            double change = (result.median_ns - it->second) / it->second;
+
+            std::cout << std::setw(14) << std::setprecision(2) << it->second
+                      << std::setw(9)  << std::setprecision(1) << std::showpos 
+                      << 100.0 * change << "%" << std::noshowpos;
+
+            if ( change > tolerance )
+            {
+                std::cout << "  REGRESSION";
+                regressions++;
+            }
+        }
+
+        std::cout << "\n";
+    }
+
+    std::cout << "mesh hierarchy bytes/triangle: "
+              << std::setprecision(1) << (double) mesh.get_bvh().get_memory() / mesh_triangles.size()
+              << " wide, "
+              << (double) mesh_binary_bvh.get_memory() / mesh_triangles.size() << " binary\n";
+
+    std::cout << "rays through mesh edges passing between triangles: "
+              << count_leaks(closed_mesh, closed_center, true) << " watertight, "
+              << count_leaks(closed_mesh, closed_center, false) << " moller-trumbore\n";
+
+    if ( filter.empty() || (std::string("denoise").find(filter) != std::string::npos) )
+    {
+        Denoise_Comparison comparison = compare_denoiser();
+
+        std::cout << "4 spp against 64 spp, rms color error: "
+                  << std::setprecision(4) << comparison.raw_error << " raw, "
+                  << comparison.denoised_error << " denoised in "
+                  << std::setprecision(3) << comparison.denoised_seconds << "s, 64 spp in "
+                  << comparison.reference_seconds << "s\n";
+    }
+
+    if ( update )
+    {
+        // Without a filter every benchmark ran, entries of removed ones go
+        if ( !write_baseline(baseline_file, results, filter.empty()) )
+        {
+            std::cout << "Unable to write \"" << baseline_file << "\"." << std::endl;
+            return 1;
+        }
+
+        std::cout << "Baseline written to \"" << baseline_file << "\"." << std::endl;
+        return 0;
+    }
+
+    if ( regressions > 0 )
+    {
+        std::cout << regressions << " benchmark(s) slower than baseline by more than "
+                  << 100.0 * tolerance << "%." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
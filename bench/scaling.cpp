@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raytracer.h"
+#include "scenes.h"
+
+//  Scaling study over generated scenes.
+//
+//  scaling.exe [output.csv] [--seed n] [--quick]
+//
+//  Starting from a base configuration, sweeps one parameter at a time
+//  (sphere count, mesh triangles, light count, resolution, threads) and
+//  writes one CSV row per render.
+
+namespace
+{
+    struct Config
+    {
+        Scene_Params scene;
+
+        int width   = 320;
+        int height  = 240;
+        int threads = 1;
+    };
+
+    void run( std::ostream& os,
+              const std::string& sweep,
+              const Config& config,
+              int repetitions )
+    {
+        Raytracer rt(config.width, config.height);
+        rt.set_threads(config.threads);
+
+        scene_generate(rt, config.scene);
+
+        // Best of the repetitions, the first render also warms the caches
+        double seconds = 0.0;
+        uint64_t rays  = 0;
+
+        for ( int i = 0 ; i < repetitions ; i++ )
+        {
+            rt.render();
+
+            if ( (i == 0) || (rt.stats.get_frame_seconds() < seconds) )
+            {
+                seconds = rt.stats.get_frame_seconds();
+                rays    = rt.stats.get_totals().total_rays();
+            }
+        }
+
+        os << sweep                             << ","
+           << config.scene.seed                 << ","
+           << config.scene.spheres              << ","
+           << config.scene.mesh_triangles       << ","
+           << config.scene.lights               << ","
+           << config.scene.reflective_fraction  << ","
+           << config.width                      << ","
+           << config.height                     << ","
+           << config.threads                    << ","
+           << seconds                           << ","
+           << rays                              << ","
+           << (rays / seconds) / 1.0e6          << std::endl;
+
+        std::cout << sweep << " done in " << seconds << "s" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string output = "scaling.csv";
+
+    bool quick = false;
+
+    Config base;
+    base.scene.reflective_fraction = 0.25f;
+    base.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+        std::string arg(argv[i]);
+
+        if ( (arg == "--seed") && (i + 1 < argc) )
+            base.scene.seed = std::atoi(argv[++i]);
+        else if ( arg == "--quick" )
+            quick = true;
+        else
+            output = arg;
+    }
+
+    std::ofstream ofs(output);
+
+    if ( !ofs.is_open() )
+    {
+        std::cout << "Unable to open \"" << output << "\"." << std::endl;
+        return 1;
+    }
+
+    ofs << "sweep,seed,spheres,mesh_triangles,lights,reflective_fraction,"
+        << "width,height,threads,seconds,rays,mrays_per_second" << std::endl;
+
+    int repetitions = quick ? 1 : 3;
+
+    std::vector<int> sphere_counts   = { 1, 4, 16, 64, 256 };
+    std::vector<int> triangle_counts = { 64, 256, 1024, 4096 };
+    std::vector<int> light_counts    = { 1, 2, 4, 8 };
+    std::vector<int> scales          = { 1, 2, 4 };
+
+    if ( quick )
+    {
+        sphere_counts   = { 1, 16 };
+        triangle_counts = { 64 };
+        light_counts    = { 1, 4 };
+        scales          = { 1 };
+    }
+
+    for ( int spheres : sphere_counts )
+    {
+        Config config = base;
+        config.scene.spheres = spheres;
+        run(ofs, "spheres", config, repetitions);
+    }
+
+    for ( int triangles : triangle_counts )
+    {
+        Config config = base;
+        config.scene.mesh_triangles = triangles;
+        run(ofs, "mesh_triangles", config, repetitions);
+    }
+
+    for ( int lights : light_counts )
+    {
+        Config config = base;
+        config.scene.lights = lights;
+        run(ofs, "lights", config, repetitions);
+    }
+
+    for ( int scale : scales )
+    {
+        Config config = base;
+        config.width  = 160 * scale;
+        config.height = 120 * scale;
+        run(ofs, "resolution", config, repetitions);
+    }
+
+    for ( int threads = 1 ; threads <= base.threads ; threads *= 2 )
+    {
+        Config config = base;
+        config.threads = threads;
+        run(ofs, "threads", config, repetitions);
+
+        // Always include the full thread count
+        if ( (threads < base.threads) && (threads * 2 > base.threads) )
+            threads = base.threads / 2;
+    }
+
+    return 0;
+}
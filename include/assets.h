@@ -0,0 +1,120 @@
+#ifndef _ASSETS_H_
+#define _ASSETS_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raytracer.h"
+#include "scene_io.h"
+
+//  Asynchronous asset loading
+//
+//  Mesh files are read, parsed and built into meshes with their hierarchy
+//  on a pool of threads while the caller goes on, e.g. rendering a preview
+//  of the shapes that are already there. Meshes wait in the scene as empty
+//  placeholders until apply() fills them in between two frames. Every file
+//  is loaded once however many meshes refer to it.
+
+class Asset_Loader
+{
+    public:
+
+        // Load of one file, seconds are per stage
+        struct Asset
+        {
+            std::string filename;
+
+            double read_seconds  = 0.0;
+            double parse_seconds = 0.0;
+            double build_seconds = 0.0;
+
+            int  triangles = 0;
+            bool loaded    = false;
+            bool failed    = false;
+
+            // Taken from the mesh cache, nothing was loaded
+            bool cached = false;
+        };
+
+    private:
+
+        struct Instance
+        {
+            Mesh* mesh;
+            int   asset;
+            Vec3  position;
+        };
+
+        Mesh_Cache* cache;
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+        std::condition_variable idle;
+
+        std::vector<Asset>                       assets;
+        std::vector<std::shared_ptr<const Mesh>> meshes;
+        std::map<std::string, int>               asset_index;
+
+        std::deque<int> queue;
+        int             loading = 0;
+
+        // Placeholders not filled in yet
+        std::vector<Instance> instances;
+
+        std::function<void()> ready_callback;
+
+        bool                     stopping = false;
+        std::vector<std::thread> workers;
+
+    public:
+
+        // Constructors
+
+        // Files found in cache are not loaded again, loaded ones are added
+        Asset_Loader(int threads = 0, Mesh_Cache* _cache = nullptr);
+        // Destructor, waits for the files being loaded and drops queued ones
+        ~Asset_Loader();
+
+        // Member functions
+
+        // Called on a loader thread whenever a file is done, e.g. to wake a
+        // render loop. Set before loading.
+        void set_ready_callback(std::function<void()> callback) { ready_callback = callback; }
+
+        // Queues the file of mesh, an empty placeholder already in a scene,
+        // which is filled with its triangles moved by position. A file that
+        // failed before is read again.
+        void load_mesh(Mesh* mesh, const std::string& filename, const Vec3& position);
+
+        // Fills the placeholders of rt whose files are loaded, placeholders
+        // of files that failed stay empty and their files are added to
+        // failed. Placeholders of other scenes are left alone, so one loader
+        // may serve several. Not while rendering. Returns the number of
+        // meshes filled in.
+        int apply(Raytracer& rt, std::vector<std::string>* failed = nullptr);
+
+        // Blocks until every queued file is loaded or failed
+        void wait();
+
+        // Blocks until the files of the placeholders of rt are loaded or failed
+        void wait(const Raytracer& rt);
+
+        // Every placeholder filled in or failed
+        bool is_complete();
+
+        // Copy of the state of each file, in the order they were queued
+        std::vector<Asset> get_assets();
+
+    private:
+
+        void work_loop();
+};
+
+#endif // _ASSETS_H_
@@ -0,0 +1,490 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vmath.h"
+
+class Worker_Pool;
+
+// SAH cost growth since a subtree was built at which update() rebuilds it
+const float BVH_REBUILD_THRESHOLD = 0.3f;
+
+// Axis aligned box, empty until extended
+struct Aabb
+{
+    public:
+
+        float min[3] = {  std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::max() };
+        float max[3] = { -std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max() };
+
+        // Constructors
+        Aabb() = default;
+
+        // Slightly enlarged so hits on the surface of the bounded primitive
+        // never fall outside of it through rounding
+        Aabb(const Vec3& _min, const Vec3& _max);
+
+        // Member functions
+        void  extend(const Aabb& box);
+        float surface_area() const;
+        float center(int axis) const { return 0.5f * (min[axis] + max[axis]); }
+        bool  empty()          const { return min[0] > max[0]; }
+
+        Vec3 get_min() const { return Vec3(min[0], min[1], min[2]); }
+        Vec3 get_max() const { return Vec3(max[0], max[1], max[2]); }
+
+        // Distance at which the ray enters the box, a negative value when
+        // it starts inside. False when it misses or enters beyond max_depth.
+        bool intersect( const float origin[3],
+                        const float inverse_direction[3],
+                        float max_depth,
+                        float& depth ) const;
+};
+
+struct Bvh_Node
+{
+    Aabb bounds;
+
+    // Children of interior nodes, the first index and count of leaves
+    int left_or_first = 0;
+    int right         = 0;
+    int count         = 0;      // 0 for interior nodes
+
+    // Index into the refit tasks when the node is the root of one
+    int subtree = -1;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+//  Bounding volume hierarchy
+//
+//  Binned surface area heuristic build over primitive bounds, primitives
+//  are referred to by their index. Moved primitives are handled by refitting
+//  node bounds bottom-up, a few subtrees near the root are refit in parallel.
+//  Refitting keeps the topology, so a subtree is rebuilt once its SAH cost
+//  has grown by the rebuild threshold, and the whole tree once the total has.
+
+class Bvh
+{
+    private:
+
+        struct Subtree
+        {
+            int   node;
+            int   parent;           // -1 for the root
+            int   first;            // Range of indices the subtree owns
+            int   count;
+            int   depth;
+            float built_cost;
+        };
+
+        std::vector<Bvh_Node> nodes;
+        std::vector<int>      indices;
+        std::vector<Subtree>  subtrees;
+
+        int   root       = -1;
+        float built_cost = 0.0f;
+
+        // Nodes reachable from root, rebuilt subtrees leave their old
+        // nodes behind until the next full build
+        int live_nodes = 0;
+
+    public:
+
+        // Member functions
+
+        // Builds over primitives [0, bounds.size())
+        void build(const std::vector<Aabb>& bounds);
+
+        // Refits to moved primitives on up to threads threads of workers
+        // and rebuilds where the SAH cost drifted. Returns the number of
+        // subtrees rebuilt, a full build counts as one.
+        int update( const std::vector<Aabb>& bounds,
+                    Worker_Pool& workers,
+                    int threads,
+                    float rebuild_threshold = BVH_REBUILD_THRESHOLD );
+
+        // Expected cost of a ray through the tree relative to testing one primitive
+        float sah_cost() const;
+
+        bool        empty()      const { return root < 0; }
+        const Aabb& get_bounds() const { return nodes[root].bounds; }
+        int         get_size()   const { return (int) indices.size(); }
+
+        // Bytes of the nodes and indices
+        size_t get_memory() const;
+
+        // Calls intersect(primitive) for every primitive in a leaf the ray
+        // enters no further than closest, which intersect may lower. Ties
+        // at closest are visited too, so callers can break them by index.
+        // Returns the number of nodes visited.
+        template <typename Intersect>
+        int traverse( const Vec3& origin,
+                      const Vec3& direction,
+                      const float& closest,
+                      Intersect intersect ) const;
+
+    private:
+
+        friend class Wide_Bvh;
+
+        int   build_recursive(const std::vector<Aabb>& bounds, int first, int count, int depth);
+        float cost(int node) const;
+        int   count_nodes(int node) const;
+
+        void  refit(int node, const std::vector<Aabb>& bounds, bool stop_at_subtrees);
+        void  rebuild_subtree(Subtree& subtree, const std::vector<Aabb>& bounds);
+        void  find_subtrees(int max_subtrees);
+};
+
+// Template functions
+template <typename Intersect>
+int Bvh::traverse( const Vec3& origin,
+                   const Vec3& direction,
+                   const float& closest,
+                   Intersect intersect ) const
+{
+    if ( root < 0 )
+        return 0;
+
+    const float ray_origin[3]        = { origin.x, origin.y, origin.z };
+    const float inverse_direction[3] = { 1.0f / direction.x,
+                                         1.0f / direction.y,
+                                         1.0f / direction.z };
+
+    int stack[64];
+    int stack_size = 0;
+    int visited    = 0;
+
+    float depth;
+    if ( !nodes[root].bounds.intersect(ray_origin, inverse_direction, closest, depth) )
+        return 1;
+
+    stack[stack_size++] = root;
+
+    while ( stack_size > 0 )
+    {
+        const Bvh_Node& node = nodes[stack[--stack_size]];
+        visited++;
+
+        if ( node.is_leaf() )
+        {
+            for ( int i = node.left_or_first ; i < node.left_or_first + node.count ; i++ )
+                intersect(indices[i]);
+
+            continue;
+        }
+
+        float left_depth, right_depth;
+        bool  left_hit  = nodes[node.left_or_first].bounds.intersect( ray_origin, inverse_direction,
+                                                                      closest, left_depth );
+        bool  right_hit = nodes[node.right].bounds.intersect( ray_origin, inverse_direction,
+                                                              closest, right_depth );
+
+        // Nearer child on top, its hits cull the other one
+        if ( left_hit && right_hit )
+        {
+            bool left_first = ( left_depth <= right_depth );
+
+            stack[stack_size++] = left_first ? node.right : node.left_or_first;
+            stack[stack_size++] = left_first ? node.left_or_first : node.right;
+        }
+        else if ( left_hit )
+        {
+            stack[stack_size++] = node.left_or_first;
+        }
+        else if ( right_hit )
+        {
+            stack[stack_size++] = node.right;
+        }
+    }
+
+    return visited;
+}
+
+// Node of a Wide_Bvh in one cache line. Child bounds are 8 bit steps of
+// 2^exponent from origin per axis, rounded outwards.
+struct alignas(64) Wide_Bvh_Node
+{
+    float   origin[3];
+    int8_t  exponent[3];
+    uint8_t child_count = 0;
+
+    uint8_t lo[3][4] = {};
+    uint8_t hi[3][4] = {};
+
+    // Node index of interior children, first index of leaf children
+    int32_t child[4] = {};
+
+    // Primitives of leaf children, 0 for interior ones
+    uint16_t count[4] = {};
+};
+
+static_assert(sizeof(Wide_Bvh_Node) == 64, "Wide_Bvh_Node should fill one cache line");
+
+//  Quantized 4-wide hierarchy
+//
+//  Collapsed from a Bvh, each node takes the place of up to three binary
+//  nodes and stores its four children in 64 bytes instead of 40 bytes per
+//  binary node, which keeps traversal of large meshes in cache. The four
+//  children are tested at once with SSE2 where available. Quantized bounds
+//  only grow, so hits are the same as with the Bvh it was collapsed from.
+//  Moved primitives are handled by refitting that Bvh and collapsing it
+//  again.
+
+class Wide_Bvh
+{
+    private:
+
+        // Child of a node being built, a node of the Bvh or a range of
+        // primitives of one of its leaves
+        struct Slot
+        {
+            Aabb bounds;
+            int  node;              // -1 for a range
+            int  first;
+            int  count;
+        };
+
+        std::vector<Wide_Bvh_Node> nodes;
+        std::vector<int>           indices;
+
+        // Of the root in full precision
+        Aabb bounds;
+
+    public:
+
+        // Member functions
+
+        // Collapses bvh, which may be dropped afterwards
+        void build(const Bvh& bvh);
+
+        // Builds over primitives [0, bounds.size())
+        void build(const std::vector<Aabb>& primitive_bounds);
+
+        bool        empty()      const { return nodes.empty(); }
+        const Aabb& get_bounds() const { return bounds; }
+
+        // Bytes of the nodes and indices
+        size_t get_memory() const;
+
+        // Same as Bvh::traverse()
+        template <typename Intersect>
+        int traverse( const Vec3& origin,
+                      const Vec3& direction,
+                      const float& closest,
+                      Intersect intersect ) const;
+
+        // Same, called with the leaves as ranges [first, first + count) of
+        // the primitive order instead of one primitive at a time
+        template <typename Intersect>
+        int traverse_leaves( const Vec3& origin,
+                             const Vec3& direction,
+                             const float& closest,
+                             Intersect intersect ) const;
+
+        // Primitives in the order of the leaves
+        const std::vector<int>& get_indices() const { return indices; }
+
+    private:
+
+        int collapse(const Bvh& bvh, int node);
+        int build_node(const Bvh& bvh, const Slot* slots, int slot_count);
+
+        // Mask of the children the ray enters no further than closest, and
+        // the distances at which it enters them
+        static int intersect_children( const Wide_Bvh_Node& node,
+                                       const float origin[3],
+                                       const float inverse_direction[3],
+                                       float closest,
+                                       float depths[4] );
+};
+
+// Size of a step of a quantized bound
+inline float wide_bvh_scale(int8_t exponent)
+{
+    uint32_t bits = (uint32_t) (exponent + 127) << 23;
+
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+
+    return scale;
+}
+
+// Inline functions
+inline int Wide_Bvh::intersect_children( const Wide_Bvh_Node& node,
+                                         const float origin[3],
+                                         const float inverse_direction[3],
+                                         float closest,
+                                         float depths[4] )
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128 entry = _mm_set1_ps(-std::numeric_limits<float>::max());
+    __m128 leave  = _mm_set1_ps( std::numeric_limits<float>::max());
+
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+    {
+        __m128 base  = _mm_set1_ps(node.origin[axis]);
+        __m128 scale = _mm_set1_ps(wide_bvh_scale(node.exponent[axis]));
+
+        int32_t lo_bytes, hi_bytes;
+        std::memcpy(&lo_bytes, node.lo[axis], sizeof(lo_bytes));
+        std::memcpy(&hi_bytes, node.hi[axis], sizeof(hi_bytes));
+
+        __m128i lo_steps = _mm_unpacklo_epi16( _mm_unpacklo_epi8(_mm_cvtsi32_si128(lo_bytes), zero), zero );
+        __m128i hi_steps = _mm_unpacklo_epi16( _mm_unpacklo_epi8(_mm_cvtsi32_si128(hi_bytes), zero), zero );
+
+        __m128 lo = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(lo_steps), scale));
+        __m128 hi = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(hi_steps), scale));
+
+        __m128 ray_origin  = _mm_set1_ps(origin[axis]);
+        __m128 ray_inverse = _mm_set1_ps(inverse_direction[axis]);
+
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, ray_origin), ray_inverse);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, ray_origin), ray_inverse);
+
+        // Operand order as in Aabb::intersect(), so NaN leaves the bounds
+        // unchanged the same way
+        entry = _mm_max_ps(_mm_min_ps(t1, t0), entry);
+        leave  = _mm_min_ps(_mm_max_ps(t1, t0), leave);
+    }
+
+    __m128 hit = _mm_and_ps( _mm_and_ps( _mm_cmple_ps(entry, leave),
+                                         _mm_cmpge_ps(leave, _mm_setzero_ps()) ),
+                             _mm_cmple_ps(entry, _mm_set1_ps(closest)) );
+
+    _mm_storeu_ps(depths, entry);
+
+    return _mm_movemask_ps(hit) & ((1 << node.child_count) - 1);
+#else
+    int mask = 0;
+
+    for ( int child = 0 ; child < node.child_count ; child++ )
+    {
+        float entry = -std::numeric_limits<float>::max();
+        float leave  =  std::numeric_limits<float>::max();
+
+        for ( int axis = 0 ; axis < 3 ; axis++ )
+        {
+            float scale = wide_bvh_scale(node.exponent[axis]);
+            float lo    = node.origin[axis] + (float) node.lo[axis][child] * scale;
+            float hi    = node.origin[axis] + (float) node.hi[axis][child] * scale;
+
+            float t0 = (lo - origin[axis]) * inverse_direction[axis];
+            float t1 = (hi - origin[axis]) * inverse_direction[axis];
+
+            entry = std::max(entry, std::min(t0, t1));
+            leave  = std::min(leave,  std::max(t0, t1));
+        }
+
+        depths[child] = entry;
+
+        if ( (entry <= leave) && (leave >= 0.0f) && (entry <= closest) )
+            mask |= 1 << child;
+    }
+
+    return mask;
+#endif
+}
+
+// Template functions
+template <typename Intersect>
+int Wide_Bvh::traverse( const Vec3& origin,
+                        const Vec3& direction,
+                        const float& closest,
+                        Intersect intersect ) const
+{
+    return traverse_leaves( origin, direction, closest, [&](int first, int count)
+    {
+        for ( int i = first ; i < first + count ; i++ )
+            intersect(indices[i]);
+    });
+}
+
+template <typename Intersect>
+int Wide_Bvh::traverse_leaves( const Vec3& origin,
+                               const Vec3& direction,
+                               const float& closest,
+                               Intersect intersect ) const
+{
+    if ( nodes.empty() )
+        return 0;
+
+    const float ray_origin[3]        = { origin.x, origin.y, origin.z };
+    const float inverse_direction[3] = { 1.0f / direction.x,
+                                         1.0f / direction.y,
+                                         1.0f / direction.z };
+
+    // Interior nodes by index, leaf children as ~(4 * node + child). Three
+    // more entries per level, trees are at most about 70 levels deep.
+    int stack[256];
+    int stack_size = 0;
+    int visited    = 0;
+
+    float depth;
+    if ( !bounds.intersect(ray_origin, inverse_direction, closest, depth) )
+        return 1;
+
+    stack[stack_size++] = 0;
+
+    while ( stack_size > 0 )
+    {
+        int entry = stack[--stack_size];
+        visited++;
+
+        if ( entry < 0 )
+        {
+            const Wide_Bvh_Node& node = nodes[~entry >> 2];
+            int child = ~entry & 3;
+
+            intersect(node.child[child], (int) node.count[child]);
+
+            continue;
+        }
+
+        const Wide_Bvh_Node& node = nodes[entry];
+
+        float depths[4];
+        int   hits = intersect_children(node, ray_origin, inverse_direction, closest, depths);
+
+        // Farthest pushed first, so the nearest child is visited next
+        int order[4];
+        int order_size = 0;
+
+        for ( int child = 0 ; child < 4 ; child++ )
+        {
+            if ( (hits & (1 << child)) == 0 )
+                continue;
+
+            int i = order_size++;
+            for ( ; (i > 0) && (depths[order[i - 1]] < depths[child]) ; i-- )
+                order[i] = order[i - 1];
+            order[i] = child;
+        }
+
+        for ( int i = 0 ; i < order_size ; i++ )
+        {
+            int child = order[i];
+            stack[stack_size++] = ( node.count[child] > 0 ) ? ~(entry * 4 + child) : node.child[child];
+        }
+    }
+
+    return visited;
+}
+
+#endif // _BVH_H_
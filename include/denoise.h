@@ -0,0 +1,33 @@
+#ifndef _DENOISE_H_
+#define _DENOISE_H_
+
+#include "framebuffer.h"
+
+class Worker_Pool;
+
+//  Edge-avoiding a-trous wavelet filter
+//
+//  Repeated 5x5 B3 spline passes with doubling step size. Each tap is
+//  weighted by how similar its color, normal, depth and albedo are to the
+//  center pixel, so edges between surfaces survive while noise within a
+//  surface is smoothed away. Needs the depth, normal and albedo AOVs.
+
+struct Denoise_Settings
+{
+    int iterations = 3;
+
+    float sigma_color  = 0.25f;     // Color distance, halved every iteration
+    float sigma_normal = 64.0f;    // Exponent on the normals' cosine
+    float sigma_depth  = 0.5f;     // Depth difference per pixel of step
+    float sigma_albedo = 0.1f;
+};
+
+// Writes the filtered average color of input to output with one sample.
+// Rows are split over threads threads of workers.
+bool denoise( const Framebuffer& input,
+              Framebuffer& output,
+              const Denoise_Settings& settings,
+              Worker_Pool& workers,
+              int threads );
+
+#endif // _DENOISE_H_
@@ -0,0 +1,60 @@
+#ifndef _DEPENDENCIES_H_
+#define _DEPENDENCIES_H_
+
+#include <vector>
+
+#include "vmath.h"
+
+//  Tile dependencies
+//
+//  What the rays of one tile depended on when it was last traced: shapes
+//  whose material was shaded by primary or reflection rays, shapes that
+//  blocked shadow rays and lights that lit a point. Raytracer uses them to
+//  invalidate only the tiles an edit of the scene can change. Tiles that
+//  were not traced completely while recording depend on everything.
+
+struct Tile_Dependencies
+{
+    public:
+
+        // Sorted shape ids and light indices once finish() was called
+        std::vector<int> shaded;
+        std::vector<int> occluders;
+        std::vector<int> lights;
+
+        // A reflection ray was cast, the tile may see any shape
+        bool reflections = false;
+
+        // Every pixel was traced while recording
+        bool complete = false;
+
+        // Box around all points that were shaded
+        bool has_hits = false;
+        Vec3 hits_min;
+        Vec3 hits_max;
+
+        // Dependencies recorded by the calling thread, nullptr when not recording
+        static Tile_Dependencies*& recording();
+
+        // Member functions
+        void reset();
+
+        void add_shaded  (int shape, const Vec3& point);
+        void add_occluder(int shape) { occluders.push_back(shape); }
+        void add_light   (int light) { lights.push_back(light); }
+
+        // Sorts and removes duplicates
+        void finish();
+
+        bool shades     (int shape) const;
+        bool occluded_by(int shape) const;
+        bool lit_by     (int light) const;
+
+        // Whether a shape within radius of center can block shadow rays of
+        // the tile towards a light whose light travels along light_direction
+        bool in_shadow_of( const Vec3& center,
+                           float radius,
+                           const Vec3& light_direction ) const;
+};
+
+#endif // _DEPENDENCIES_H_
@@ -0,0 +1,51 @@
+#ifndef _DISTRIBUTED_H_
+#define _DISTRIBUTED_H_
+
+#include <string>
+
+#include "raytracer.h"
+
+//  Coordinator / worker rendering over TCP
+//
+//  The coordinator sends each connecting worker the serialized scene once,
+//  then hands out ranges of tiles. Workers render a range with all their
+//  threads and send the pixels back. Ranges of workers that disconnect are
+//  queued again, ranges outstanding for longer than reissue_seconds are
+//  also given to idle workers and the first result wins. When no worker
+//  connects or returns a range for worker_timeout seconds the coordinator
+//  renders the remaining ranges itself.
+
+class Render_Coordinator
+{
+    private:
+
+        Raytracer& rt;
+
+        unsigned short port;
+
+        int   tiles_per_job;
+        float reissue_seconds;
+        float worker_timeout;
+
+    public:
+
+        // Constructors
+        Render_Coordinator( Raytracer& _rt,
+                            unsigned short _port,
+                            int   _tiles_per_job   = 8,
+                            float _reissue_seconds = 30.0f,
+                            float _worker_timeout  = 30.0f );
+
+        // Member functions
+
+        // Blocks until every tile of the frame has been assembled in rt.frame.
+        // Returns false when tiles had to be rendered locally after the
+        // worker timeout, or the frame could not be completed at all.
+        bool render();
+};
+
+// Renders tile ranges for the coordinator at host:port until it is done.
+// Retries the connection for a few seconds so workers may start first.
+bool run_render_worker(const std::string& host, unsigned short port, int threads = 0);
+
+#endif // _DISTRIBUTED_H_
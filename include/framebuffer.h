@@ -0,0 +1,111 @@
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vmath.h"
+#include "material.h"
+
+// Optional channels besides color, combined as flags
+enum Aov : unsigned int
+{
+    AOV_NONE      = 0,
+    AOV_DEPTH     = 1 << 0,     // Primary hit distance, 0 for background
+    AOV_NORMAL    = 1 << 1,     // Primary hit normal
+    AOV_ALBEDO    = 1 << 2,     // Material color of the primary hit
+    AOV_SHAPE_ID  = 1 << 3,     // Index of the hit shape in the scene, -1 for background
+    AOV_DIRECT    = 1 << 4,     // Diffuse, specular and ambient light
+    AOV_REFLECTED = 1 << 5,     // Light from reflection rays
+    AOV_ALL       = (1 << 6) - 1
+};
+
+// Everything traced for one primary sample
+struct Pixel_Sample
+{
+    Color color;
+
+    float depth    = 0.0f;
+    Vec3  normal;
+    Color albedo;
+    int   shape_id = -1;
+    Color direct;
+    Color reflected;
+};
+
+class Framebuffer
+{
+    private:
+
+        int width;
+        int height;
+
+        unsigned int aovs;
+
+        // Samples accumulated per pixel
+        int samples = 0;
+
+    public:
+
+        // Linear HDR channels, row major. Color, direct and reflected hold
+        // sums over the accumulated samples, the other AOVs the last sample.
+        std::vector<float>   color;
+        std::vector<float>   depth;
+        std::vector<float>   normal;
+        std::vector<float>   albedo;
+        std::vector<int32_t> shape_id;
+        std::vector<float>   direct;
+        std::vector<float>   reflected;
+
+        // Constructors
+        Framebuffer(int _width = 0, int _height = 0, unsigned int _aovs = AOV_NONE);
+
+        // Member functions
+        int          get_width()   const { return width; }
+        int          get_height()  const { return height; }
+        unsigned int get_aovs()    const { return aovs; }
+        int          get_samples() const { return samples; }
+        bool         has(Aov aov)  const { return (aovs & aov) != 0; }
+
+        void resize(int _width, int _height, unsigned int _aovs);
+        void clear();
+
+        // Clears rows [y0, y1) and columns [x0, x1), keeps the sample count
+        void clear(int x0, int y0, int x1, int y1);
+
+        // Marks one more sample as accumulated in every pixel
+        void add_sample_pass() { samples++; }
+
+        // Adds a sample to pixel (x, y)
+        void accumulate(int x, int y, const Pixel_Sample& sample);
+
+        // Replaces pixel (x, y) with an averaged sample, as if every
+        // accumulated pass had traced it
+        void store(int x, int y, const Pixel_Sample& average);
+
+        // Average color of pixel (x, y)
+        Color get_color(int x, int y) const;
+
+        // Average color and the enabled AOVs of pixel (x, y)
+        Pixel_Sample get_sample(int x, int y) const;
+
+        // Converts the average color of rows [y0, y1) and columns [x0, x1) to 
+        // RGBA8 through a lookup table from make_gamma_lut(). rgba holds full
+        // rows starting at row y0. Vectorized with SSE2 where available.
+        void quantize( int x0, int y0, int x1, int y1,
+                       uint8_t* rgba,
+                       const std::vector<uint8_t>& lut,
+                       float exposure = 1.0f ) const;
+
+        // Writes an enabled float channel as PFM, "color" is always available
+        bool write_pfm(const std::string& filename, Aov aov) const;
+        bool write_color_pfm(const std::string& filename) const;
+};
+
+// Lookup table from [0, 1] in QUANTIZE_LUT_SIZE steps to 8 bit gamma encoded values
+const int QUANTIZE_LUT_SIZE = 4096;
+
+std::vector<uint8_t> make_gamma_lut(float gamma = 1.0f);
+
+#endif // _FRAMEBUFFER_H_
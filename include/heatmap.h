@@ -0,0 +1,46 @@
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+class Heatmap
+{
+    private:
+
+        int width;
+        int height;
+
+        std::vector<uint32_t> tests;
+        std::vector<uint32_t> steps;
+        std::vector<uint32_t> rays;
+        std::vector<uint32_t> nanoseconds;
+
+    public:
+
+        // Constructors
+        Heatmap(int _width, int _height);
+
+        // Member functions
+
+        // Stores the counter difference of one pixel's traced rays
+        void record( int x, int y,
+                     const Render_Counters& before,
+                     const Render_Counters& after,
+                     uint32_t elapsed_ns );
+
+        // Writes <prefix>_tests.ppm, _steps.ppm, _rays.ppm and _time.ppm
+        bool write(const std::string& prefix) const;
+
+    private:
+
+        static bool write_channel( const std::string& filename,
+                                   const std::vector<uint32_t>& values,
+                                   int width,
+                                   int height );
+};
+
+#endif // _HEATMAP_H_
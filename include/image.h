@@ -0,0 +1,121 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+
+// Writes a RGBA8 buffer as a binary PPM (P6), the alpha channel is dropped
+bool write_ppm( const std::string& filename,
+                const uint8_t* rgba,
+                int width,
+                int height );
+
+// Maps value in [0, 1] to a blue - cyan - green - yellow - red ramp
+void false_color(float value, uint8_t* rgba);
+
+// Writes a PPM in bands of rows on a background thread. Band buffers are
+// recycled, so memory use is buffers * width * band_rows * 4 bytes.
+class Ppm_Stream
+{
+    private:
+
+        std::ofstream ofs;
+
+        int width;
+        int height;
+        int band_rows;
+
+        std::vector<std::vector<uint8_t>> buffers;
+
+        std::deque<uint8_t*>                free_bands;
+        std::deque<std::pair<uint8_t*,int>> queued_bands;
+
+        bool closing = false;
+        bool failed  = false;
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+
+        std::thread writer;
+
+    public:
+
+        // Constructors
+        Ppm_Stream( const std::string& filename,
+                    int _width,
+                    int _height,
+                    int _band_rows,
+                    int _buffers = 2 );
+        // Destructor
+        ~Ppm_Stream();
+
+        // Member functions
+        bool is_open() const { return writer.joinable(); }
+
+        // Blocks until a band buffer of width * band_rows RGBA pixels is free
+        uint8_t* acquire();
+
+        // Queues the first rows of an acquired band, bands are written in order
+        void submit(uint8_t* band, int rows);
+
+        // Waits for all queued bands, returns false if any write failed
+        bool close();
+
+    private:
+
+        void write_loop();
+};
+
+// Writes whole frames as PPM files on a background thread, in the order
+// they were submitted, so the next frame can be traced meanwhile. Frame
+// buffers are recycled like the bands of Ppm_Stream.
+class Ppm_Writer
+{
+    private:
+
+        int width;
+        int height;
+
+        std::vector<std::vector<uint8_t>> buffers;
+
+        std::deque<uint8_t*>                        free_frames;
+        std::deque<std::pair<uint8_t*,std::string>> queued_frames;
+
+        bool closing = false;
+        bool failed  = false;
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+
+        std::thread writer;
+
+    public:
+
+        // Constructors
+        Ppm_Writer(int _width, int _height, int _buffers = 2);
+        // Destructor
+        ~Ppm_Writer();
+
+        // Member functions
+
+        // Blocks until a buffer of width * height RGBA pixels is free
+        uint8_t* acquire();
+
+        // Queues an acquired frame to be written to filename
+        void submit(uint8_t* frame, const std::string& filename);
+
+        // Waits for all queued frames, returns false if any write failed
+        bool close();
+
+    private:
+
+        void write_loop();
+};
+
+#endif // _IMAGE_H_
@@ -0,0 +1,44 @@
+#ifndef _JOB_H_
+#define _JOB_H_
+
+#include <istream>
+#include <memory>
+#include <string>
+
+#include "raytracer.h"
+#include "scene_io.h"
+#include "scheduler.h"
+
+//  Render job descriptions
+//
+//  Text, one statement per line, # starts a comment. Besides the statements
+//  below a job holds the statements of text scenes, see scene_io.h, applied
+//  in order. The size holds for the whole job wherever it is given.
+//
+//      size     <width> <height>
+//      priority <share of the render threads, 1 to Render_Scheduler::MAX_PRIORITY>
+//      spp      <samples per pixel, 1 to MAX_JOB_SAMPLES>
+//      scene    default | mesh
+
+// Samples per pixel a job may ask for, the rays of a tile are allocated for
+// all of its samples at once
+const int MAX_JOB_SAMPLES = 256;
+
+struct Render_Job
+{
+    std::unique_ptr<Raytracer> rt;
+
+    int priority = 1;
+};
+
+// Builds the scene of a job description. Returns false and describes the
+// first malformed line in error. Mesh files are read by assets when given,
+// e.g. a loader shared by all jobs, else by a loader of the job's own. Either
+// way they are filled in before returning.
+bool load_job( std::istream& is,
+               Mesh_Cache& meshes,
+               Render_Job& job,
+               std::string& error,
+               Asset_Loader* assets = nullptr );
+
+#endif // _JOB_H_
@@ -12,6 +12,8 @@ class Light
 
         Light(const Color& _color, float _intensity)
             : color{_color} , intensity{_intensity} {}
+        // Destructor
+        virtual ~Light() {}
 
         virtual Vec3  get_direction(const Vec3& point) const = 0;
         virtual float get_distance (const Vec3& point) const = 0;
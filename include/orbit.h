@@ -0,0 +1,54 @@
+#ifndef _ORBIT_H_
+#define _ORBIT_H_
+
+#include "vmath.h"
+#include "raytracer.h"
+
+//  Orbit camera controls
+//
+//  The view is described by a target point, a distance and yaw / pitch angles
+//  around the target. Yaw 0 and pitch 0 look along +z.
+
+class Orbit_Camera
+{
+    private:
+
+        Vec3  target;
+        float distance;
+        float yaw;
+        float pitch;
+
+    public:
+
+        // Constructors
+        Orbit_Camera(const Vec3& _target = Vec3(0.0f, 0.0f, 0.0f),
+                     float _distance = 10.0f,
+                     float _yaw      = 0.0f,
+                     float _pitch    = 0.0f );
+
+        // Orbits around the target looking along camera's current direction
+        static Orbit_Camera from_camera(const Camera& camera, float distance);
+
+        // Member functions
+
+        // Angles in radians, pitch stops short of straight up and down
+        void orbit(float delta_yaw, float delta_pitch);
+
+        // Moves the target along the view plane, in units of the distance
+        void pan(float delta_right, float delta_up);
+
+        // Distance is multiplied by factor, < 1 moves closer
+        void zoom(float factor);
+
+        Vec3 get_position() const;
+        Vec3 get_target()   const { return target; }
+
+        // Sets position and orientation, keeps size and field of view
+        void apply(Camera& camera) const;
+
+    private:
+
+        Vec3 get_forward() const;
+};
+
+#endif // _ORBIT_H_
@@ -0,0 +1,248 @@
+#ifndef _PAGED_MESH_H_
+#define _PAGED_MESH_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "shapes.h"
+
+//  Out of core meshes
+//
+//  A cluster file holds the triangles of a mesh sorted along a Morton curve
+//  and cut into clusters of neighbouring triangles. A Paged_Mesh keeps only
+//  the bounds of its clusters in memory. Clusters are read when rays reach
+//  them, built into meshes of their own and evicted least recently used
+//  first once the resident ones take more than the budget of their cache,
+//  so meshes larger than memory render in bounded memory. Datasets too
+//  large to convert at once are converted in pieces, a file each.
+//
+//  While tiles are traced for the first time, rays reaching a cluster that
+//  is not resident queue it for the loader thread and pass it by. Tiles that
+//  missed clusters are traced again after all others, when their clusters
+//  had time to arrive, see Raytracer::trace_tiles().
+//
+//  File: "RTCLUST" magic and format version, cluster and triangle counts,
+//  per cluster its bounds, first triangle and triangle count, then the three
+//  vertices of every triangle. Numbers are in the host's byte order.
+
+const uint32_t CLUSTER_FILE_VERSION = 1;
+
+// Triangles per cluster written by write_clusters()
+const int CLUSTER_TRIANGLES = 4096;
+
+// Resident clusters of Cluster_Cache::shared() unless set otherwise
+const size_t CLUSTER_CACHE_CAPACITY = (size_t) 512 << 20;
+
+// Paging state of the tile traced by the calling thread
+struct Page_Faults
+{
+    // Clusters that are not resident are queued and passed by
+    bool defer = false;
+
+    // Clusters passed by since the caller last reset it
+    int missed = 0;
+
+    // Clusters holding surfaces reported by Paged_Mesh::intersect(), kept
+    // resident until the next Raytracer::intersection_closest()
+    std::vector<std::shared_ptr<const Mesh>> pins;
+
+    static Page_Faults& local();
+};
+
+class Cluster_Cache;
+
+// Clusters of one file and which of them are resident, opened through
+// Cluster_Cache::open()
+class Cluster_File
+{
+    public:
+
+        struct Cluster
+        {
+            Aabb     bounds;
+            uint64_t first = 0;
+            uint32_t count = 0;
+        };
+
+    private:
+
+        friend class Cluster_Cache;
+
+        enum Residency { ABSENT, QUEUED, LOADING, RESIDENT };
+
+        struct Slot
+        {
+            // Read without the lock of the cache, written under it
+            std::shared_ptr<const Mesh> mesh;
+            std::atomic<uint64_t>       last_use{0};
+            std::atomic<int>            state{ABSENT};
+            size_t                      bytes = 0;
+        };
+
+        Cluster_Cache* cache;
+
+        std::string          filename;
+        std::vector<Cluster> clusters;
+        uint64_t             triangle_count = 0;
+        uint64_t             data_offset    = 0;
+
+        std::unique_ptr<Slot[]> slots;
+
+        std::mutex    stream_mutex;
+        std::ifstream stream;
+
+    public:
+
+        // Constructors
+        Cluster_File(Cluster_Cache* _cache, const std::string& _filename);
+        // Destructor, drops its resident clusters from the cache
+        ~Cluster_File();
+
+        // Member functions
+        bool is_open() const { return !clusters.empty(); }
+
+        const std::string&          get_filename()       const { return filename; }
+        const std::vector<Cluster>& get_clusters()       const { return clusters; }
+        uint64_t                    get_triangle_count() const { return triangle_count; }
+
+        // Reads the triangles of cluster, may be called from several threads
+        bool read(int cluster, std::vector<Triangle>& triangles);
+};
+
+// Resident clusters of any number of files within a budget of bytes. One
+// thread loads queued clusters in the background.
+class Cluster_Cache
+{
+    private:
+
+        struct Request
+        {
+            std::shared_ptr<Cluster_File> file;
+            int                           cluster;
+        };
+
+        struct Resident
+        {
+            Cluster_File* file;
+            int           cluster;
+        };
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+        std::condition_variable loaded;
+
+        size_t capacity;
+        size_t size = 0;
+
+        // Advanced by every load, clusters are stamped with it when used
+        std::atomic<uint64_t> clock{1};
+
+        std::vector<Resident> resident;
+        std::deque<Request>   queue;
+
+        uint64_t loads     = 0;
+        uint64_t evictions = 0;
+
+        bool        stopping = false;
+        std::thread loader;
+
+    public:
+
+        // Constructors
+        Cluster_Cache(size_t _capacity = CLUSTER_CACHE_CAPACITY);
+        // Destructor, drops queued clusters
+        ~Cluster_Cache();
+
+        // Member functions
+
+        // Cache of meshes loaded from scene files
+        static Cluster_Cache& shared();
+
+        // nullptr when filename is not a readable cluster file
+        std::shared_ptr<Cluster_File> open(const std::string& filename);
+
+        // The resident mesh of cluster. Otherwise queues it and returns
+        // nullptr, or with wait loads it on the calling thread, or waits for
+        // the thread already loading it.
+        std::shared_ptr<const Mesh> acquire( const std::shared_ptr<Cluster_File>& file,
+                                             int cluster,
+                                             bool wait );
+
+        void   set_capacity(size_t bytes);
+        size_t get_capacity();
+
+        // Bytes of the resident clusters, which are kept alive beyond the
+        // budget for as long as rays use them
+        size_t   get_size();
+        uint64_t get_loads();
+        uint64_t get_evictions();
+
+    private:
+
+        friend class Cluster_File;
+
+        std::shared_ptr<const Mesh> load(Cluster_File& file, int cluster);
+
+        // Evicts down to 7/8 of the capacity once it is exceeded, so sorting
+        // by last use is not done for every load. Locked by the caller.
+        void evict();
+
+        // Removes the clusters of a file that is closing
+        void release(Cluster_File& file);
+
+        void work_loop();
+};
+
+// Mesh in a cluster file, only the clusters rays reach are in memory
+class Paged_Mesh : public Shape
+{
+    private:
+
+        std::shared_ptr<Cluster_File> file;
+        Cluster_Cache*                cache;
+
+        // Over the bounds of the clusters in the file
+        Wide_Bvh bvh;
+
+        // Moved by translate(), the clusters stay as in the file
+        Vec3 offset;
+
+    public:
+
+        // Constructors
+        Paged_Mesh(const Paged_Mesh& _mesh) = default;
+        Paged_Mesh( const std::string& filename,
+                    const Vec3& position = Vec3(0.0f, 0.0f, 0.0f),
+                    Cluster_Cache* _cache = nullptr );
+
+        // Member functions
+        bool is_open() const { return file != nullptr; }
+
+        const std::string& get_filename() const;
+        Vec3               get_offset()   const { return offset; }
+        uint64_t           get_triangle_count() const;
+
+        // Override functions
+        float intersect (const Ray& ray)                        const override;
+        float intersect (const Ray& ray, const Shape*& surface) const override;
+        Vec3  get_normal(const Vec3& point)                     const override;
+        bool  get_bounds(Vec3& min, Vec3& max)                  const override;
+        Vec3  get_position()                                    const override;
+        void  translate (const Vec3& _offset)                         override;
+};
+
+// Writes triangles as a cluster file of clusters of up to cluster_triangles
+bool write_clusters( const std::vector<Triangle>& triangles,
+                     const std::string& filename,
+                     int cluster_triangles = CLUSTER_TRIANGLES );
+
+#endif // _PAGED_MESH_H_
@@ -0,0 +1,63 @@
+#ifndef _QUALITY_H_
+#define _QUALITY_H_
+
+#include <vector>
+
+// Render settings traded against frame time
+struct Quality_Level
+{
+    float scale;        // Internal resolution relative to the window
+    int   max_depth;    // Recursion depth of cast_ray
+    int   samples;      // Samples per pixel
+};
+
+//  Picks a quality level for the next frame from the time of the last ones
+//
+//  Levels are ordered from cheapest to most expensive. The relative cost of a
+//  level is estimated from its pixel count, samples and depth, so a slow frame
+//  drops straight to the best level predicted to fit the budget. Raising the
+//  quality goes one level at a time and only after several frames with
+//  headroom, which keeps the viewer from oscillating.
+
+class Quality_Controller
+{
+    private:
+
+        double budget_seconds;
+
+        std::vector<Quality_Level> levels;
+        int level;
+
+        // Smoothed frame time at the current level
+        double average_seconds = 0.0;
+        int    fast_frames     = 0;
+
+    public:
+
+        // Fraction of the budget a level must be predicted to fit into
+        static constexpr double HEADROOM = 0.8;
+
+        // Frames under the headroom before raising the quality
+        static constexpr int RAISE_FRAMES = 3;
+
+        // Constructors
+        Quality_Controller(double _budget_seconds);
+
+        // Member functions
+        const Quality_Level& get_level() const { return levels[level]; }
+        int                  get_level_index() const { return level; }
+        double               get_budget() const { return budget_seconds; }
+
+        // Feeds the measured time of the frame rendered at the current level,
+        // returns true when the level changed
+        bool update(double frame_seconds);
+
+        // Internal frame size for a window of width x height
+        void get_size(int width, int height, int& scaled_width, int& scaled_height) const;
+
+    private:
+
+        static double cost(const Quality_Level& quality_level);
+};
+
+#endif // _QUALITY_H_
@@ -7,10 +7,45 @@
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <memory>
+#include <atomic>
 
 #include "vmath.h"
 #include "shapes.h"
 #include "lights.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "framebuffer.h"
+#include "denoise.h"
+#include "dependencies.h"
+
+class Temporal_Cache;
+struct Temporal_Settings;
+class Render_Cache;
+class Worker_Pool;
+
+// Primary rays of a block of pixels by component, filled by
+// Camera::get_primary_rays(). Arrays are padded to a multiple of four.
+struct Ray_Buffer
+{
+    int count = 0;
+
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> dir_x,    dir_y,    dir_z;
+
+    // Pixel width per unit of distance, see Ray::spread
+    std::vector<float> spread;
+
+    // Where each ray was sampled, on the image plane in pixels with integers
+    // at pixel centers and on the lens as a point of the unit disk
+    std::vector<float> film_x, film_y;
+    std::vector<float> lens_x, lens_y;
+
+    // Member functions
+    void resize(int _count);
+
+    Ray get(int i) const;
+};
 
 class Camera
 {
@@ -29,6 +64,15 @@ class Camera
 
         Vec3 position;
 
+        // Orthonormal basis, the camera looks along forward
+        Vec3 forward;
+        Vec3 right;
+        Vec3 up;
+
+        // Thin lens, a pinhole while the aperture is 0
+        float aperture       = 0.0f;
+        float focus_distance = 1.0f;
+
     public:
 
         // Constructors
@@ -36,6 +80,56 @@ class Camera
 
         // Member functions
         Ray get_primary_ray(int x, int y) const;
+
+        // Ray through (x + 0.5 + dx, y + 0.5 + dy), offsets within [-0.5, 0.5)
+        Ray get_primary_ray(int x, int y, float dx, float dy) const;
+
+        // Rays of every step-th pixel of [x0, x1) x [y0, y1), samples per
+        // pixel in a row, pixels in scanline order. Several samples are
+        // jittered within the pixel and every sample through a lens of
+        // non zero aperture starts at its own point of the lens. A single
+        // sample through a pinhole is the same as get_primary_ray(x, y).
+        void get_primary_rays( int x0, int y0, int x1, int y1,
+                               int step,
+                               int samples,
+                               Ray_Buffer& rays ) const;
+
+        // Inverse of get_primary_ray(), pixel coordinates of point with 
+        // integers at pixel centers. False for points behind the camera.
+        bool project(const Vec3& point, float& x, float& y) const;
+
+        void set_position(const Vec3& _position) { position = _position; }
+
+        // Turns the camera towards target. Looking along world_up, e.g.
+        // straight down, another world axis is taken as up. A target at the
+        // position leaves the orientation as it is.
+        void look_at(const Vec3& target, const Vec3& world_up = Vec3(0.0f, 1.0f, 0.0f));
+        void set_orientation(const Vec3& _forward, const Vec3& _up);
+
+        // Takes an orthonormal basis as is, e.g. one saved from the getters,
+        // so a copied camera traces exactly the same rays
+        void set_basis(const Vec3& _forward, const Vec3& _right, const Vec3& _up);
+
+        // Changes the image size, keeps the field of view and orientation
+        void set_resolution(int _width, int _height);
+
+        // Radius of the lens and distance along forward of the plane in
+        // focus, only used by get_primary_rays()
+        void  set_lens(float _aperture, float _focus_distance);
+        float get_aperture()       const { return aperture; }
+        float get_focus_distance() const { return focus_distance; }
+
+        int   get_width()    const { return width; }
+        int   get_height()   const { return height; }
+        float get_fov()      const;
+        Vec3  get_position() const { return position; }
+        Vec3  get_forward()  const { return forward; }
+        Vec3  get_right()    const { return right; }
+        Vec3  get_up()       const { return up; }
+
+    private:
+
+        void update_image_plane();
 };
 
 class Raytracer
@@ -52,18 +146,77 @@ class Raytracer
         std::vector<Shape*> shapes;
         std::vector<Light*> lights;
 
+        // Bounded shapes are found through the hierarchy, planes are tested
+        // one by one. Built or refit before rendering, see update_scene(),
+        // and collapsed into the wide tree that is traversed.
+        mutable Bvh                 scene_bvh;
+        mutable Wide_Bvh            scene_wide_bvh;
+        mutable std::vector<Shape*> bounded_shapes;
+        mutable std::vector<Shape*> unbounded_shapes;
+        mutable bool                scene_bvh_built = false;
+        mutable bool                shapes_moved    = false;
+        float                       bvh_rebuild_threshold = BVH_REBUILD_THRESHOLD;
+
         Color ambient;
         Color background;
 
+        int   threads             = 1;
+        int   tile_size           = 32;
         int   max_recursion_depth = 4;
         float min_influence       = 0.01;
+        int   samples_per_pixel   = 1;
+        int   pixel_step          = 1;
+
+        // Coarser levels of meshes for secondary rays, see Mesh
+        bool  level_of_detail     = true;
+
+        // Threads tiles are traced on besides the calling one, kept from
+        // frame to frame
+        std::unique_ptr<Worker_Pool> workers;
+
+        // Polled between tiles, see set_cancel_token()
+        const std::atomic<bool>* cancel_token = nullptr;
+
+        // Per pixel cost, only recorded when enabled
+        std::unique_ptr<Heatmap> heatmap;
+
+        // Linear HDR color and AOVs, quantized into frame after tracing
+        mutable Framebuffer framebuffer;
+
+        float gamma    = 1.0f;
+        float exposure = 1.0f;
+        std::vector<uint8_t> gamma_lut;
+
+        // Filtered copy of framebuffer, resolved instead of it when enabled
+        bool denoiser = false;
+        Denoise_Settings denoise_settings;
+        mutable Framebuffer denoised;
+
+        // Previous frame reused after camera motion, when enabled
+        std::unique_ptr<Temporal_Cache> temporal_cache;
+        mutable std::vector<uint8_t>    trace_mask;
+
+        // Per tile, what the last trace depended on and whether the
+        // framebuffer still holds it, see render_invalidated()
+        bool dependency_tracking = false;
+        mutable std::vector<Tile_Dependencies> tile_dependencies;
+        mutable std::vector<uint8_t>           tile_valid;
+
+        // Tiles of render() looked up before tracing, owned by the caller
+        Render_Cache* render_cache = nullptr;
 
     public:
 
         uint8_t* frame;
 
+        // Counters of the last rendered frame
+        mutable Render_Stats stats;
+
         // Constructors
-        Raytracer(int _width = 800, int _height = 600);
+
+        // Without allocate_frame only render_to_file() may be used, for
+        // images too large to be held in memory
+        Raytracer(int _width = 800, int _height = 600, bool allocate_frame = true);
         // Destructor
         ~Raytracer();
 
@@ -71,7 +224,169 @@ class Raytracer
         void add(Shape* p_shape);
         void add(Light* p_light);
 
+        // Room for shapes and lights about to be added, e.g. by a loader
+        void reserve(int shape_count, int light_count);
+
+        // Number of threads render() traces tiles on
+        void set_threads(int _threads);
+        int  get_threads() const { return threads; }
+
+        // Scene access
+        const std::vector<Shape*>& get_shapes() const { return shapes; }
+        const std::vector<Light*>& get_lights() const { return lights; }
+
+        const Camera& get_camera() const { return camera; }
+        void          set_camera(const Camera& _camera);
+
+        Color get_ambient()    const { return ambient; }
+        Color get_background() const { return background; }
+        void  set_ambient   (const Color& _ambient)    { ambient    = _ambient;    invalidate_tiles(); }
+        void  set_background(const Color& _background) { background = _background; invalidate_tiles(); }
+
+        int   get_max_recursion_depth() const { return max_recursion_depth; }
+        float get_min_influence()       const { return min_influence; }
+        void  set_max_recursion_depth(int _depth)       { max_recursion_depth = _depth;     invalidate_tiles(); }
+        void  set_min_influence      (float _influence) { min_influence       = _influence; invalidate_tiles(); }
+
+        int get_width()  const { return width; }
+        int get_height() const { return height; }
+
+        // Reallocates frame and the framebuffers for a new image size, the
+        // camera keeps its field of view, position and orientation. Not while
+        // rendering.
+        void resize(int _width, int _height);
+
+        // Tiles are numbered in scanline order
+        void set_tile_size(int _tile_size);
+        int  get_tile_size()  const { return tile_size; }
+        int  get_tile_count() const;
+        void get_tile_rect(int tile, int& x0, int& y0, int& x1, int& y1) const;
+
+        // Float framebuffer, AOVs are combined Aov flags
+        void enable_aovs(unsigned int aovs);
+        const Framebuffer& get_framebuffer() const { return framebuffer; }
+
+        // Conversion from the framebuffer to frame, applied by resolve()
+        void set_gamma(float _gamma, float _exposure = 1.0f);
+
+        // Quantizes the whole framebuffer into frame again without tracing
+        void resolve() const;
+
+        // Jittered primary rays per pixel, 1 traces through pixel centers
+        void set_samples_per_pixel(int _samples);
+        int  get_samples_per_pixel() const { return samples_per_pixel; }
+
+        // Shadow and reflection rays of wide footprint or little influence
+        // intersect coarser levels of large meshes, see Mesh
+        void enable_level_of_detail(bool enable = true) { level_of_detail = enable; invalidate_tiles(); }
+        bool get_level_of_detail() const { return level_of_detail; }
+
+        // Traces one pixel per step x step block and copies it to the whole
+        // block, for quick previews
+        void set_pixel_step(int _pixel_step);
+        int  get_pixel_step() const { return pixel_step; }
+
+        // Once the token is set, rendering stops before the next tile and
+        // leaves the frame partly updated. The token is owned by the caller.
+        void set_cancel_token(const std::atomic<bool>* _cancel_token);
+        bool cancel_requested() const;
+
+        // Filters frames rendered with render() before quantizing them,
+        // turns on the depth, normal and albedo AOVs
+        void enable_denoiser( bool enable = true,
+                              const Denoise_Settings& settings = Denoise_Settings() );
+        bool denoiser_enabled() const { return denoiser; }
+        const Framebuffer& get_denoised() const { return denoised; }
+
+        // Reuses the previous frame's pixels after small camera moves in
+        // render(), turns on the depth, normal and shape id AOVs
+        void enable_temporal_cache(bool enable = true);
+        void enable_temporal_cache(const Temporal_Settings& settings);
+        bool temporal_cache_enabled() const { return (bool) temporal_cache; }
+
+        // Next render() traces every pixel, needed after editing the scene
+        void invalidate_temporal_cache();
+
+        // Records which shapes and lights the rays of each tile hit, so the
+        // edits below only invalidate the tiles they can change. Without it
+        // every edit invalidates the whole frame.
+        void enable_dependency_tracking(bool enable = true);
+        bool dependency_tracking_enabled() const { return dependency_tracking; }
+
+        // Scene edits, invalidate the affected tiles and the temporal cache.
+        // Out of range indices are ignored.
+        void set_material(int shape, const Material& material);
+        void translate   (int shape, const Vec3& offset);
+        void set_position(int shape, const Vec3& position);
+        void set_light   (int light, const Color& color, float intensity);
+
+        // Only for Light_Direction
+        void set_light_direction(int light, const Vec3& direction);
+
+        // For shapes changed in place, e.g. meshes filled in by an
+        // Asset_Loader. Rebuilds the scene hierarchy and invalidates every
+        // tile and the temporal cache.
+        void invalidate_shape(int shape);
+
+        // Marks every tile for render_invalidated(), needed after changing
+        // shapes or lights other than through the edits above
+        void invalidate_tiles();
+        int  get_invalid_tile_count() const;
+
+        // Traces only the invalidated tiles into frame, all of them before
+        // the first render(). Returns the number of tiles traced, tiles
+        // skipped by a cancel stay invalid.
+        int render_invalidated() const;
+
+        // Refits the scene hierarchy to shapes moved since the last frame and
+        // rebuilds the parts whose SAH cost grew by more than threshold. Done
+        // by the render functions, explicit calls move the work out of the frame.
+        void update_scene() const;
+        void set_bvh_rebuild_threshold(float threshold) { bvh_rebuild_threshold = threshold; }
+        float get_scene_sah_cost() const { return scene_bvh.sah_cost(); }
+
+        // Serves tiles of render() and render_tiles() from cache when their
+        // render key matches and stores the ones traced. Not used with the
+        // temporal cache or the heatmap. With the denoiser only whole frames
+        // are reused. The framebuffer and AOVs of cached tiles stay cleared.
+        void set_render_cache(Render_Cache* cache) { render_cache = cache; }
+
+        // Hash of the scene, camera and every setting that changes frame,
+        // 0 when the scene cannot be hashed and is never cached
+        uint64_t get_render_key() const;
+
+        // Instrumentation render mode, records per pixel cost in render()
+        void enable_heatmap(bool enable = true);
+        const Heatmap* get_heatmap() const { return heatmap.get(); }
+
         unsigned char* render() const;
+
+        // Renders tiles [first, last) into frame, render() renders all of them.
+        // The denoiser only runs when the whole frame is rendered. Returns
+        // false when cancelled.
+        bool render_tiles(int first, int last) const;
+
+        // Frames traced one tile at a time by an outside scheduler, e.g. one
+        // shared with other scenes. begin_tiles() clears the frame, then
+        // trace_tile() is called once per tile from any thread and
+        // end_tiles() runs the denoiser and closes the stats of the frame.
+        void begin_tiles() const;
+        void trace_tile(int tile) const;
+        void end_tiles(double seconds, int _threads) const;
+
+        // Renders the scene as seen by each of cameras into images, resized
+        // to RGBA8 at the camera's size. Tiles of all views go through one
+        // scheduler. Without the denoiser each thread traces into one band
+        // of tile rows, so memory does not grow with the number of views.
+        // Returns false when cancelled.
+        bool render_views( const std::vector<Camera>& cameras,
+                           std::vector<std::vector<uint8_t>>& images ) const;
+
+        // Streams the image to a PPM file one row of tiles at a time,
+        // memory use does not depend on the image height. Every band is
+        // traced on the same worker threads, the ones render() uses.
+        bool render_to_file(const std::string& filename) const;
+
         Color cast_ray(const Ray& ray,
                        int recursion_depth = 0,
                        float influence = 1.0f ) const;
@@ -79,19 +394,84 @@ class Raytracer
     private: 
 
         // Private Member functions
+        // Traces tiles on all threads into fb and quantizes them into rgba,
+        // both hold full rows starting at row target_y. Returns false when
+        // cancelled before all tiles were traced.
+        // Only pixels with a non zero mask entry are traced when a mask is given
+        bool trace_tiles( int first, int last,
+                          Framebuffer& fb,
+                          uint8_t* rgba,
+                          int target_y,
+                          const uint8_t* mask = nullptr ) const;
+
+        // Same for a list of tiles of the whole frame, returns the number traced
+        int  trace_tiles( const std::vector<int>& tiles,
+                          Framebuffer& fb,
+                          uint8_t* rgba,
+                          int target_y,
+                          const uint8_t* mask ) const;
+
+        // Copies the cached tiles of [first, last) into frame and returns
+        // the others
+        std::vector<int> load_cached_tiles(uint64_t key, int first, int last) const;
+        void             store_cached_tiles(uint64_t key, const std::vector<int>& tiles) const;
+
+        // Traces and quantizes one tile of fb, recording its dependencies
+        // when fb is the framebuffer
+        void trace_tile( int tile,
+                         Framebuffer& fb,
+                         uint8_t* rgba,
+                         int target_y,
+                         const uint8_t* mask ) const;
+
+        // Traces through view, the camera of the frame unless rendering views
+        void render_tile( const Camera& view,
+                          int x0, int y0, int x1, int y1,
+                          Framebuffer& fb,
+                          int target_y,
+                          const uint8_t* mask ) const;
+
+        // Invalidates the tiles whose recorded dependencies match, and all
+        // tiles recorded incompletely
+        template <typename Predicate>
+        void invalidate_tiles_if(Predicate depends);
+
+        // Filters framebuffer into denoised and quantizes it into frame
+        void denoise_frame() const;
+
+        // Fills the AOVs of sample for primary rays
+        Color cast_ray( const Ray& ray,
+                        int recursion_depth,
+                        float influence,
+                        Pixel_Sample* sample ) const;
+
+        // closest_surface receives the primitive that was hit, e.g. a mesh triangle
         Shape* intersection_closest( const Ray& ray, 
                                      float& closest_depth, 
-                                     Shape* ignore_shape = nullptr ) const;
+                                     Shape* ignore_shape = nullptr,
+                                     const Shape** closest_surface = nullptr ) const;
+
+        // Ray leaving point at distance along ray, carrying weight of its
+        // color. Without level of detail it sees meshes at full detail.
+        Ray secondary_ray( const Ray&  ray,
+                           const Vec3& dir,
+                           const Vec3& point,
+                           float distance,
+                           float weight ) const;
 
+        // shadow_ray leaves the shaded point towards light
         bool point_in_shadow( const Light* light,
-                              const Vec3&  light_direction,
-                              const Vec3&  point ) const;
+                              const Ray&   shadow_ray ) const;
 
+        // distance is the depth of point along ray, reflected receives the
+        // part of the color from reflection rays
         Color shade_point( const Ray& ray,
                            const Vec3& point,
                            const Vec3& normal,
                            const Material& material,
-                           int recursion_depth ) const;
+                           int recursion_depth,
+                           float distance,
+                           Color* reflected = nullptr ) const;
 
         Color shade_diffuse( float incident,
                              const Light* light,
@@ -108,7 +488,8 @@ class Raytracer
                                 const Vec3& normal,
                                 const Vec3& point,
                                 const Material& material,
-                                int recursion_depth ) const;
+                                int recursion_depth,
+                                float distance ) const;
 };
 
 
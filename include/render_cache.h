@@ -0,0 +1,98 @@
+#ifndef _RENDER_CACHE_H_
+#define _RENDER_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Raytracer;
+
+//  Content addressed render cache
+//
+//  Quantized tiles stored on disk under a 64 bit FNV-1a hash of everything
+//  that went into them, see Raytracer::get_render_key(). One file per tile,
+//  least recently used tiles are deleted once the directory grows past its
+//  capacity. Use order survives restarts through the file times.
+
+// Part of every render key, raised when a change to the renderer alters
+// its output so tiles of older builds are no longer found
+const uint32_t RENDER_CACHE_VERSION = 3;
+
+const uint64_t FNV_OFFSET = 14695981039346656037ull;
+const uint64_t FNV_PRIME  = 1099511628211ull;
+
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+
+    for ( size_t i = 0 ; i < size ; i++ )
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+template < typename T >
+uint64_t fnv1a_value(const T& value, uint64_t hash)
+{
+    return fnv1a(&value, sizeof(T), hash);
+}
+
+// Hash of the binary scene of rt, see scene_io.h, without a copy of it.
+// 0 when the scene holds shapes the format cannot store.
+uint64_t hash_scene(const Raytracer& rt);
+
+class Render_Cache
+{
+    private:
+
+        struct Entry
+        {
+            uint64_t size;
+            std::list<uint64_t>::iterator use;
+        };
+
+        std::string directory;
+        uint64_t    capacity;
+
+        std::mutex mutex;
+
+        // Most recently used first
+        std::list<uint64_t>                 uses;
+        std::unordered_map<uint64_t, Entry> entries;
+        uint64_t                            size = 0;
+
+        uint64_t hits   = 0;
+        uint64_t misses = 0;
+
+    public:
+
+        // Constructors
+
+        // Creates directory when missing and indexes the tiles already in it
+        Render_Cache(const std::string& _directory, uint64_t _capacity = 256ull << 20);
+
+        // Member functions
+
+        // False when key is not cached or its file is unreadable
+        bool load(uint64_t key, std::vector<uint8_t>& data);
+        bool store(uint64_t key, const uint8_t* data, size_t data_size);
+
+        uint64_t get_size();
+        uint64_t get_hits();
+        uint64_t get_misses();
+
+    private:
+
+        std::string filename(uint64_t key) const;
+
+        // Deletes least recently used files until size fits, with the lock held
+        void evict();
+};
+
+#endif // _RENDER_CACHE_H_
@@ -0,0 +1,119 @@
+#ifndef _SCENE_IO_H_
+#define _SCENE_IO_H_
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "raytracer.h"
+
+class Asset_Loader;
+
+//  Scene files
+//
+//  Binary: "RTSCENE" magic and format version, camera, render settings,
+//  lights and shapes with their materials. Meshes are stored by value or
+//  as a reference to their file. Numbers are written in the host's byte
+//  order.
+//
+//  Text: one statement per line, # starts a comment, an optional first
+//  statement "rtscene <version>". Vectors are x y z, colors r g b and
+//  materials a color with optional specular and reflection. The camera
+//  takes the size of the frame it is loaded into.
+//
+//      camera     <position> <target> [fov]
+//      lens       <aperture> <focus distance>
+//      recursion  <max depth> <min influence>
+//      ambient    <color>
+//      background <color>
+//      light      <direction> <color> [intensity]
+//      sphere     <center> <radius> <material>
+//      plane      <position> <normal> <material>
+//      triangle   <a> <b> <c> <material>
+//      mesh       <obj file> <position> <material>
+//      paged      <cluster file> <position> <material>
+//
+//  Both loaders add shapes straight to the scene in file order. Referenced
+//  mesh files are read in parallel by an Asset_Loader, see assets.h. Given
+//  one, the loaders return as soon as the file is parsed and the meshes
+//  stay empty until it fills them in. Relative mesh paths are taken from
+//  the directory given to them. Paged meshes, see paged_mesh.h, open their
+//  cluster file right away and read clusters while rendering.
+
+// Version 2 added the camera orientation, version 3 meshes referenced by
+// file, version 4 paged meshes, version 5 the camera lens. Text version 2
+// added the lens statement. Older files are still read.
+const uint32_t SCENE_BINARY_VERSION = 5;
+const int      SCENE_TEXT_VERSION   = 2;
+
+// Loaded meshes with their hierarchies, shared by several loads. Scenes get
+// instances that share the geometry, so files are read and trees are built
+// only once and kept in memory once however many scenes use them.
+class Mesh_Cache
+{
+    private:
+
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<const Mesh>> meshes;
+
+    public:
+
+        // Member functions
+
+        // Mesh of filename at the origin, nullptr when the file holds no
+        // triangles. May be called from several threads.
+        std::shared_ptr<const Mesh> get(const std::string& filename);
+
+        // Without loading, nullptr when filename is not cached
+        std::shared_ptr<const Mesh> find(const std::string& filename);
+
+        // Adds a mesh loaded elsewhere, returns the one kept when filename
+        // was added in the meantime
+        std::shared_ptr<const Mesh> insert(const std::string& filename,
+                                           std::shared_ptr<const Mesh> mesh);
+
+        // Instance of the mesh moved to position, nullptr as above
+        Mesh* instance(const std::string& filename, const Vec3& position);
+
+        int get_size();
+};
+
+// Writes the shapes, lights, camera and settings of rt. With mesh_references
+// meshes read from a file are stored as its name and their offset, readers
+// need the same file.
+bool write_scene_binary(std::ostream& os, const Raytracer& rt, bool mesh_references = false);
+
+// Adds the scene to rt, a camera of another size is resized to the frame.
+// Returns false on malformed input, shapes read so far are kept.
+bool read_scene_binary( std::istream& is,
+                        Raytracer& rt,
+                        Mesh_Cache* meshes = nullptr,
+                        const std::string& directory = "",
+                        Asset_Loader* assets = nullptr );
+
+// Reads only the stored camera size
+bool read_scene_binary_size(std::istream& is, int& width, int& height);
+
+// Writes rt as text, false when it holds meshes that were not read from a file
+bool write_scene_text(std::ostream& os, const Raytracer& rt);
+
+// Adds the scene to rt. Returns false and describes the first malformed
+// line in error, shapes read so far are kept.
+bool read_scene_text( std::istream& is,
+                      Raytracer& rt,
+                      std::string& error,
+                      Mesh_Cache* meshes = nullptr,
+                      const std::string& directory = "",
+                      Asset_Loader* assets = nullptr );
+
+// Reads a binary or text scene file, mesh paths are relative to its directory
+bool load_scene( const std::string& filename,
+                 Raytracer& rt,
+                 std::string& error,
+                 Mesh_Cache* meshes = nullptr,
+                 Asset_Loader* assets = nullptr );
+
+#endif // _SCENE_IO_H_
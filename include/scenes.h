@@ -0,0 +1,40 @@
+#ifndef _SCENES_H_
+#define _SCENES_H_
+
+#include <vector>
+
+#include "raytracer.h"
+
+// -- Reference scenes -- //
+
+// Three spheres on a plane lit by two directional lights
+void scene_default(Raytracer& rt);
+
+// The default scene with the middle sphere replaced by a triangle mesh
+void scene_mesh(Raytracer& rt);
+
+// -- Procedural scenes -- //
+
+struct Scene_Params
+{
+    int   spheres             = 16;
+    int   mesh_triangles      = 0;      // Approximate, rounded to a tessellated sphere
+    int   lights              = 2;
+    float reflective_fraction = 0.0f;   // Share of spheres with a reflective material
+
+    unsigned int seed = 1;
+};
+
+// Deterministic for a given seed, spheres and the mesh are scattered in
+// front of the camera above a ground plane
+void scene_generate(Raytracer& rt, const Scene_Params& params);
+
+// -- Helper functions -- //
+
+// Triangulated UV sphere, 2 * (rings - 1) * segments triangles
+std::vector<Triangle> tessellate_sphere( const Vec3& center,
+                                         float radius,
+                                         int rings,
+                                         int segments );
+
+#endif // _SCENES_H_
@@ -0,0 +1,88 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "raytracer.h"
+
+//  Tile scheduler shared by several frames
+//
+//  One pool of threads traces the tiles of every submitted frame. Frames
+//  share the threads in proportion to their priority by stride scheduling:
+//  each frame advances a pass by STRIDE / priority per tile handed out and
+//  the frame with the lowest pass goes next. Frames submitted later start
+//  at the pass of the frames already running, so they neither starve nor
+//  get to catch up.
+
+class Render_Scheduler
+{
+    public:
+
+        // Called on a render thread after each traced tile with the number
+        // of tiles done, calls for one frame may overlap. The frame is
+        // complete in the call where done equals total. Returning false
+        // abandons the rest of the frame.
+        typedef std::function<bool(int done, int total)> Progress;
+
+        // Priorities are clamped to [1, MAX_PRIORITY], so every frame's
+        // pass advances by at least STRIDE / MAX_PRIORITY per tile
+        static constexpr int MAX_PRIORITY = 1000;
+
+    private:
+
+        struct Frame
+        {
+            std::shared_ptr<const Raytracer> rt;
+
+            int priority;
+            Progress progress;
+
+            uint64_t pass       = 0;
+            int      next_tile  = 0;
+            int      tile_count = 0;
+            int      done       = 0;
+            bool     cancelled  = false;
+
+            std::chrono::steady_clock::time_point start_point;
+        };
+
+        static const uint64_t STRIDE = 1 << 20;
+
+        std::vector<std::shared_ptr<Frame>> frames;
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+        bool                    stopping = false;
+
+        std::vector<std::thread> workers;
+
+    public:
+
+        // Constructors
+        Render_Scheduler(int threads = 0);
+        // Destructor
+        ~Render_Scheduler();
+
+        // Member functions
+
+        // Queues a whole frame of rt, which has to stay unchanged until the
+        // frame is complete or abandoned. See MAX_PRIORITY.
+        void submit( std::shared_ptr<const Raytracer> rt,
+                     int priority,
+                     Progress progress );
+
+        int get_threads() const { return (int) workers.size(); }
+
+    private:
+
+        void work_loop();
+};
+
+#endif // _SCHEDULER_H_
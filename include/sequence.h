@@ -0,0 +1,70 @@
+#ifndef _SEQUENCE_H_
+#define _SEQUENCE_H_
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "raytracer.h"
+
+//  Animation sequences
+//
+//  Keyframes for the camera and for shape positions, interpolated linearly
+//  and held before the first and after the last key. Times are in frames.
+//  The text format has one key per line, # starts a comment:
+//
+//      camera <frame> <position x y z> <target x y z>
+//      object <shape index> <frame> <position x y z>
+
+struct Camera_Key
+{
+    float frame;
+    Vec3  position;
+    Vec3  target;
+};
+
+struct Object_Key
+{
+    float frame;
+    Vec3  position;
+};
+
+class Sequence
+{
+    private:
+
+        // Sorted by frame
+        std::vector<Camera_Key>                camera_keys;
+        std::map<int, std::vector<Object_Key>> object_keys;
+
+    public:
+
+        // Member functions
+        void add_camera_key(const Camera_Key& key);
+        void add_object_key(int shape, const Object_Key& key);
+
+        // Adds the keys of a text description, false on a malformed line
+        bool load(std::istream& is);
+
+        // Moves the camera and the keyed shapes to where they are at frame.
+        // Shapes are moved through Raytracer::set_position(), so the scene
+        // hierarchy is refit rather than rebuilt.
+        void apply(Raytracer& rt, float frame) const;
+
+        bool empty() const { return camera_keys.empty() && object_keys.empty(); }
+};
+
+// Replaces the last run of '#' in pattern with the zero padded frame number,
+// or appends the number before the extension when there is none
+std::string sequence_filename(const std::string& pattern, int frame);
+
+// Renders frames [0, frame_count) of sequence in one process. Frame k is
+// written on a background thread while frame k + 1 is traced. Prints one
+// line per frame, returns false when a frame could not be written.
+bool render_sequence( Raytracer& rt,
+                      const Sequence& sequence,
+                      int frame_count,
+                      const std::string& pattern );
+
+#endif // _SEQUENCE_H_
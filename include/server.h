@@ -0,0 +1,80 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "assets.h"
+#include "job.h"
+#include "scheduler.h"
+
+namespace sf
+{
+    class TcpSocket;
+}
+
+//  Local render job server
+//
+//  Listens on localhost for HTTP requests, POST /render with a job
+//  description (see job.h) as the body. Every job is traced by one shared
+//  Render_Scheduler, so concurrent jobs split the threads by priority, and
+//  meshes stay loaded between jobs. The response is chunked text:
+//
+//      queued <tiles>
+//      progress <tiles done> <tiles>       (as often as it changes)
+//      done <seconds> <Mrays/s>
+//
+//  followed by the image as a binary PPM. A client that disconnects
+//  cancels the rest of its job. Connections are served by a fixed number
+//  of threads, further ones wait for a free thread and beyond
+//  MAX_PENDING_CONNECTIONS are turned away.
+
+class Render_Server
+{
+    public:
+
+        static const int DEFAULT_CONNECTIONS     = 8;
+        static const int MAX_PENDING_CONNECTIONS = 64;
+
+    private:
+
+        unsigned short port;
+
+        Render_Scheduler scheduler;
+        Mesh_Cache       meshes;
+
+        // Reads the mesh files of every job, so a file is loaded once
+        Asset_Loader assets;
+
+        // Accepted connections waiting for a connection thread
+        std::mutex                                  mutex;
+        std::condition_variable                     condition;
+        std::deque<std::unique_ptr<sf::TcpSocket>>  pending;
+        bool                                        stopping = false;
+
+        std::vector<std::thread> workers;
+
+    public:
+
+        // Constructors
+        Render_Server( unsigned short _port,
+                       int threads     = 0,
+                       int connections = DEFAULT_CONNECTIONS );
+        // Destructor
+        ~Render_Server();
+
+        // Member functions
+
+        // Serves requests until listening fails
+        bool run();
+
+    private:
+
+        void work_loop();
+};
+
+#endif // _SERVER_H_
@@ -1,10 +1,15 @@
 #ifndef _Shape_H_
 #define _Shape_H_
 
+#include <istream>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "vmath.h"
 #include "material.h"
+#include "bvh.h"
+#include "triangle_packs.h"
 
 class Ray
 {
@@ -13,9 +18,26 @@ class Ray
         Vec3 dir = Vec3(1.0f, 0.0f, 0.0f);
         Vec3 ori = Vec3(0.0f, 0.0f, 0.0f);
 
+        // Bounces since the camera, 0 for primary rays
+        int   depth     = 0;
+
+        // Share of the pixel color the ray carries
+        float influence = 1.0f;
+
+        // Width the ray covers at its origin and its growth per unit of
+        // distance, 0 for rays that see meshes at full detail
+        float footprint = 0.0f;
+        float spread    = 0.0f;
+
         // Constructors
         Ray(const Vec3& _dir = Vec3(1.0f, 0.0f, 0.0f), 
             const Vec3& _ori = Vec3{0.0f, 0.0f, 0.0f});
+
+        // Member functions
+
+        // Shadow or reflection ray leaving the point at distance along this
+        // one, weight is the share of this ray's color it carries
+        Ray secondary(const Vec3& _dir, const Vec3& _ori, float distance, float weight) const;
 };
 
 struct Vertex
@@ -33,6 +55,9 @@ class Shape
 
         Material material;
 
+        // Index in the scene, assigned by Raytracer::add
+        int id = -1;
+
         // Constructors
         Shape(const Shape& _shape) = default;
         Shape(const Material& _material = Material(Color(Color::LIGHT_GRAY)))
@@ -43,6 +68,22 @@ class Shape
         // Pure Virutal functions
         virtual float intersect (const Ray& ray)    const = 0;
         virtual Vec3  get_normal(const Vec3& point) const = 0;
+
+        // Virtual functions
+
+        // Also reports the primitive that was hit, get_normal() of 
+        // surface is valid for the hit point. Defaults to this shape.
+        virtual float intersect (const Ray& ray, const Shape*& surface) const;
+
+        // Axis aligned box around the shape, false for unbounded shapes
+        virtual bool get_bounds(Vec3& min, Vec3& max) const;
+
+        // Reference point moved by translate(), e.g. the center of a sphere
+        virtual Vec3 get_position() const = 0;
+
+        // Moves the shape, only done through Raytracer::translate() once
+        // the shape is in a scene
+        virtual void translate(const Vec3& offset) = 0;
 };
 
 class Sphere : public Shape
@@ -60,6 +101,9 @@ class Sphere : public Shape
         // Override functions
         float intersect (const Ray& ray)    const override;
         Vec3  get_normal(const Vec3& point) const override;
+        bool  get_bounds(Vec3& min, Vec3& max) const override;
+        Vec3  get_position()                   const override { return center; }
+        void  translate (const Vec3& offset)  override;
 };
 
 class Plane : public Shape
@@ -77,6 +121,8 @@ class Plane : public Shape
         // Override functions
         float intersect (const Ray& ray)        const override;
         Vec3  get_normal(const Vec3& /*point*/) const override;
+        Vec3  get_position()                    const override { return position; }
+        void  translate (const Vec3& offset)      override;
 };
 
 class Triangle : public Shape
@@ -103,24 +149,116 @@ class Triangle : public Shape
         // Override functions
         float intersect (const Ray& ray)        const override;
         Vec3  get_normal(const Vec3& /*point*/) const override;
+        bool  get_bounds(Vec3& min, Vec3& max)  const override;
+        Vec3  get_position()                    const override;
+        void  translate (const Vec3& offset)      override;
 };
 
+// Meshes with fewer triangles have no levels of detail, their hierarchy
+// stays in cache and coarser levels barely shorten traversal
+const int MESH_LOD_MIN_TRIANGLES = 65536;
+const int MESH_LOD_MAX_LEVELS    = 3;
+
+// Error of a level of detail a ray accepts, in footprints of the ray
+const float MESH_LOD_TOLERANCE = 0.5f;
+
 class Mesh : public Shape
 {
     private:
 
-        mutable Triangle* tri;
-        mutable std::vector<Triangle> triangles;
+        // Simplified by vertex clustering, error is the farthest a vertex
+        // moved
+        struct Detail_Level
+        {
+            std::vector<Triangle> triangles;
+            Wide_Bvh              bvh;
+            Triangle_Packs        packs;
+            float                 error;
+        };
+
+        // Triangles with their hierarchy, packs and levels of detail. Never
+        // changed once built, so copies of a mesh share them.
+        struct Geometry
+        {
+            std::vector<Triangle> triangles;
+
+            // Over the triangles
+            Wide_Bvh bvh;
+
+            // The triangles in the order of the leaves of bvh, intersected
+            // instead of them
+            Triangle_Packs packs;
+
+            // Coarser with each level, built with the hierarchy. Secondary
+            // rays take the coarsest level whose error is within
+            // MESH_LOD_TOLERANCE of their footprint at the mesh, scaled up as
+            // their influence drops. Primary rays and rays leaving the mesh's
+            // own bounds see the full mesh, so it never shadows or reflects a
+            // copy of itself.
+            std::vector<Detail_Level> levels;
+        };
+
+        std::shared_ptr<const Geometry> geometry;
+
+        // Where the geometry is moved to by translate(), rays are moved the
+        // other way as with Paged_Mesh
+        Vec3 offset;
+
+        // File the triangles were read from and how far they were moved
+        // since, empty for meshes built in code
+        std::string source;
+        Vec3        source_offset;
 
     public:
 
         // Constructors
         Mesh(const Mesh& _mesh) = default;
         Mesh(const char* filename, const Vec3& position = Vec3(0.0f, 0.0f, 0.0f));
+        Mesh(const std::vector<Triangle>& _triangles);
+        Mesh(std::vector<Triangle>&& _triangles, const std::string& _source = "");
+
+        // Member functions
+
+        // Triangles and hierarchy before the offset, scene coordinates are
+        // theirs plus get_offset()
+        const std::vector<Triangle>& get_triangles() const { return geometry->triangles; }
+        const Wide_Bvh&              get_bvh()       const { return geometry->bvh; }
+        Vec3                         get_offset()    const { return offset; }
+
+        // Triangles of each level of detail, coarsest last
+        std::vector<int> get_level_sizes() const;
+
+        // Bytes of the triangles, hierarchies, packs and levels of detail,
+        // shared with copies of the mesh
+        size_t get_memory() const;
+
+        const std::string& get_source()        const { return source; }
+        Vec3               get_source_offset() const { return source_offset; }
+
+        // Shares the geometry of mesh with its offset and source, keeps the
+        // material and id
+        void copy_geometry(const Mesh& mesh);
 
         // Override functions
-        float intersect (const Ray& ray)        const override;
-        Vec3  get_normal(const Vec3& /*point*/) const override;
+        float intersect (const Ray& ray)                        const override;
+        float intersect (const Ray& ray, const Shape*& surface) const override;
+        Vec3  get_normal(const Vec3& point)                     const override;
+        bool  get_bounds(Vec3& min, Vec3& max)                  const override;
+        Vec3  get_position()                                    const override;
+        void  translate (const Vec3& offset)                          override;
+
+    private:
+
+        static std::shared_ptr<const Geometry> build(std::vector<Triangle>&& triangles);
+        static void build_levels(Geometry& geometry);
+
+        // Level a ray in the coordinates of the geometry sees, nullptr for
+        // the full mesh
+        const Detail_Level* select_level(const Ray& ray) const;
 };
 
+// Appends the triangles of the v and f lines of an obj file moved by
+// position, faces with vertices out of range are skipped
+void read_obj(std::istream& is, const Vec3& position, std::vector<Triangle>& triangles);
+
 #endif // _Shape_H_
\ No newline at end of file
@@ -0,0 +1,141 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+
+enum class Stage
+{
+    Load = 0,   // Scene and mesh loading
+    Build,      // Building and refitting the scene hierarchy
+    Reproject,  // Reusing the previous frame after camera motion
+    Trace,      // Tracing, shading and writing pixels
+    Denoise,    // Filtering the traced frame
+    COUNT
+};
+
+const char* stage_name(Stage stage);
+
+struct Render_Counters
+{
+    public:
+
+        // Rays
+        uint64_t primary_rays    = 0;
+        uint64_t shadow_rays     = 0;
+        uint64_t reflection_rays = 0;
+
+        // Intersections
+        uint64_t shape_tests    = 0;
+        uint64_t triangle_tests = 0;
+        uint64_t hits           = 0;
+
+        // Shapes and acceleration nodes visited while searching for hits
+        uint64_t traversal_steps = 0;
+
+        // Early termination of cast_ray
+        uint64_t depth_cutoffs     = 0;
+        uint64_t influence_cutoffs = 0;
+
+        // Pixels taken from the previous frame instead of traced
+        uint64_t reprojected_pixels = 0;
+
+        // Tiles traced, fewer than the tile count after incremental edits
+        uint64_t traced_tiles = 0;
+
+        // Tiles copied from the render cache instead of traced
+        uint64_t cached_tiles = 0;
+
+        // Tiles traced again after missing clusters of paged meshes
+        uint64_t deferred_tiles = 0;
+
+        // Scene hierarchy updates, full builds and rebuilt subtrees count
+        // as rebuilds
+        uint64_t bvh_refits   = 0;
+        uint64_t bvh_rebuilds = 0;
+
+        double stage_seconds[(int) Stage::COUNT] = {};
+
+        // Assignment operators
+        Render_Counters& operator += (const Render_Counters& rhs);
+
+        // Member functions
+        uint64_t total_rays() const;
+        void     reset();
+};
+
+class Render_Stats
+{
+    private:
+
+        Render_Counters totals;
+        int threads = 0;
+
+        double frame_seconds = 0.0;
+
+        std::mutex mutex;
+
+    public:
+
+        // Constructors
+        Render_Stats() = default;
+        Render_Stats(const Render_Stats& _stats);
+
+        // Assignment operators
+        Render_Stats& operator = (const Render_Stats& rhs);
+
+        // Counters of the calling thread, incremented without synchronization
+        static Render_Counters& local();
+
+        // Stage times recorded outside of a frame (mesh loading etc.)
+        static void record_scene_stage(Stage stage, double seconds);
+
+        // Member functions
+        void begin_frame();
+        void end_frame(double seconds, int _threads);
+
+        // Adds the calling thread's counters to the frame and clears them
+        void merge_local();
+
+        const Render_Counters& get_totals() const { return totals; }
+        double get_frame_seconds()          const { return frame_seconds; }
+
+        double mrays_per_second() const;
+
+        void write_json(std::ostream& os) const;
+};
+
+class Stage_Timer
+{
+    private:
+
+        Stage stage;
+        std::chrono::high_resolution_clock::time_point start_point;
+
+        bool scene;
+
+    public:
+
+        // Adds the elapsed time to the calling thread's counters, or to the
+        // scene wide stage times when _scene is true
+        Stage_Timer(Stage _stage, bool _scene = false)
+            : stage{_stage} , scene{_scene}
+        {
+            start_point = std::chrono::high_resolution_clock::now();
+        }
+
+        ~Stage_Timer()
+        {
+            std::chrono::duration<double> delta_time =
+                std::chrono::high_resolution_clock::now() - start_point;
+
+            if ( scene )
+                Render_Stats::record_scene_stage(stage, delta_time.count());
+            else
+                Render_Stats::local().stage_seconds[(int) stage] += delta_time.count();
+        }
+};
+
+#endif // _STATS_H_
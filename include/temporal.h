@@ -0,0 +1,101 @@
+#ifndef _TEMPORAL_H_
+#define _TEMPORAL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "framebuffer.h"
+#include "raytracer.h"
+
+struct Temporal_Settings
+{
+    // Share of the pixels traced again every frame even when reusable, so
+    // view dependent shading cannot go stale for long
+    float refresh_fraction = 0.05f;
+
+    // Relative depth difference at which neighbours belong to different surfaces
+    float depth_tolerance = 0.05f;
+
+    // Minimum cosine between normals of the same surface
+    float normal_tolerance = 0.9f;
+
+    // Minimum cosine between the direction a specular pixel was traced from
+    // and the current one
+    float view_tolerance = 0.9995f;
+};
+
+//  Temporal reprojection cache
+//
+//  Keeps the last completed frame with its camera. For a new camera every
+//  surface point of that frame is splatted to the pixel it lands on, nearest
+//  one wins, background pixels land by direction alone. Pixels are traced
+//  again when nothing landed on them, next to such holes or a depth / normal
+//  discontinuity, on reflective shapes, on specular shapes seen from too
+//  different a direction since they were traced, or when picked for refresh.
+//  Single pixel gaps between two neighbours on one surface are filled from
+//  them instead. Needs the depth, normal and shape id AOVs.
+
+class Temporal_Cache
+{
+    private:
+
+        Temporal_Settings settings;
+
+        Framebuffer history;
+        bool        valid = false;
+
+        // Per pixel point that was shaded and the primary ray direction it
+        // was shaded for. Carried along with reprojected pixels so rounding
+        // to pixel centers does not accumulate over frames. Background
+        // pixels store their direction as point.
+        std::vector<Vec3> history_point;
+        std::vector<Vec3> history_view;
+        std::vector<Vec3> reprojected_point;
+        std::vector<Vec3> reprojected_view;
+
+        uint32_t frame_index = 0;
+
+        // Scratch buffers of reproject(). Splats pack the distance bits above
+        // the source pixel so the nearest one wins with an atomic minimum.
+        std::unique_ptr<std::atomic<uint64_t>[]> splats;
+        size_t                                   splat_count = 0;
+
+        std::vector<Pixel_Sample> samples;
+        std::vector<uint8_t>      state;
+        std::vector<uint8_t>      filled;
+
+    public:
+
+        // Constructors
+        Temporal_Cache(const Temporal_Settings& _settings = Temporal_Settings());
+
+        // Member functions
+
+        // Fills fb with the reusable pixels for camera and sets trace_mask to
+        // 1 for pixels that have to be traced. Everything is traced without a
+        // matching previous frame. Rows are split over threads threads of
+        // workers.
+        void reproject( const Camera& camera,
+                        const std::vector<Shape*>& shapes,
+                        Framebuffer& fb,
+                        std::vector<uint8_t>& trace_mask,
+                        Worker_Pool& workers,
+                        int threads );
+
+        // Remembers a completed frame, trace_mask as left by reproject()
+        void store( const Camera& camera,
+                    const Framebuffer& fb,
+                    const std::vector<uint8_t>& trace_mask,
+                    Worker_Pool& workers,
+                    int threads );
+
+        // Forgets the previous frame, e.g. after the scene changed
+        void invalidate() { valid = false; }
+        bool is_valid() const { return valid; }
+
+        const Temporal_Settings& get_settings() const { return settings; }
+};
+
+#endif // _TEMPORAL_H_
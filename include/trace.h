@@ -0,0 +1,76 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <cstdint>
+#include <string>
+
+struct Trace_Event
+{
+    const char* name = nullptr;
+
+    uint64_t begin_ns = 0;
+    uint64_t end_ns   = 0;
+
+    // Optional arguments, e.g. tile coordinates, -1 when unused
+    int32_t arg_x = -1;
+    int32_t arg_y = -1;
+};
+
+class Trace
+{
+    public:
+
+        // Events kept per recording thread, older events are overwritten.
+        // Buffers of threads that exited are reused by new ones.
+        static const size_t BUFFER_SIZE = 1 << 16;
+
+        static void enable(bool enable = true);
+        static bool enabled();
+
+        // Nanoseconds since the first call in the process
+        static uint64_t now_ns();
+
+        // Appends to the calling thread's ring buffer, name must outlive the trace
+        static void record( const char* name,
+                            uint64_t begin_ns,
+                            uint64_t end_ns,
+                            int32_t arg_x = -1,
+                            int32_t arg_y = -1 );
+
+        // Allocates nothing, a buffer is only taken by the first record()
+        static void set_thread_name(const std::string& name);
+
+        // Exports all threads' events as Chrome trace JSON (chrome://tracing,
+        // Perfetto). Call when no thread is recording.
+        static bool write_json(const std::string& filename);
+        static void clear();
+};
+
+class Trace_Scope
+{
+    private:
+
+        const char* name;
+        uint64_t    begin_ns;
+
+        int32_t arg_x;
+        int32_t arg_y;
+
+    public:
+
+        Trace_Scope(const char* _name, int32_t _arg_x = -1, int32_t _arg_y = -1)
+            : name{ Trace::enabled() ? _name : nullptr } , begin_ns{0} ,
+              arg_x{_arg_x} , arg_y{_arg_y}
+        {
+            if ( name != nullptr )
+                begin_ns = Trace::now_ns();
+        }
+
+        ~Trace_Scope()
+        {
+            if ( name != nullptr )
+                Trace::record(name, begin_ns, Trace::now_ns(), arg_x, arg_y);
+        }
+};
+
+#endif // _TRACE_H_
@@ -0,0 +1,242 @@
+#ifndef _TRIANGLE_PACKS_H_
+#define _TRIANGLE_PACKS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vmath.h"
+
+class Triangle;
+
+//  Watertight triangle packs
+//
+//  The triangles of a mesh four to a pack in the order of the leaves of its
+//  hierarchy, vertices stored by component, so the triangles of a leaf are
+//  tested against a ray together with SSE2 where available. The test is
+//  the watertight one of Woop, Benthin and Wald: vertices are moved into a
+//  space where the ray runs along +z from the origin and the signs of three
+//  edge functions decide the hit. An edge shared by two triangles gives the
+//  same function with its sign flipped, bit for bit, so rays through shared
+//  edges and vertices hit at least one of the triangles instead of passing
+//  between them as with Triangle::intersect().
+//
+//  This relies on products and differences being rounded separately, the
+//  kernel must not be built with contraction into fused multiply adds. The
+//  Makefile passes -ffp-contract=off to everything, since the kernel is
+//  inlined into its callers.
+
+// Ray sheared and scaled so it runs along +z, computed once per mesh test
+struct Watertight_Ray
+{
+    float origin[3];
+
+    // Axes permuted so the ray is longest along kz, kx and ky swapped for
+    // negative directions to keep the winding
+    int kx, ky, kz;
+
+    float shear_x, shear_y, shear_z;
+
+    // Constructors
+    Watertight_Ray(const Vec3& _origin, const Vec3& direction);
+};
+
+// Four triangles, vertex components of triangle i at [axis][i]
+struct alignas(16) Triangle_Pack
+{
+    float a[3][4];
+    float b[3][4];
+    float c[3][4];
+};
+
+class Triangle_Packs
+{
+    private:
+
+        std::vector<Triangle_Pack> packs;
+
+        // Triangle at each position
+        std::vector<int> triangles;
+
+    public:
+
+        // Member functions
+
+        // Packs triangles[order[0]], triangles[order[1]] and so on, padded
+        // with empty triangles to a multiple of four
+        void build(const std::vector<Triangle>& _triangles, const std::vector<int>& order);
+
+        // Bytes of the packs and triangle indices
+        size_t get_memory() const;
+
+        // Tests the triangles at positions [first, first + count). Hits
+        // beyond 0.0001 nearer than closest, or as near and of a lower
+        // triangle index, replace closest and triangle.
+        void intersect( const Watertight_Ray& ray,
+                        int first, int count,
+                        float& closest,
+                        int& triangle ) const;
+
+    private:
+
+        // Mask of the triangles of pack hit beyond 0.0001 and no farther
+        // than closest, and their distances
+        static int intersect_pack( const Triangle_Pack& pack,
+                                   const Watertight_Ray& ray,
+                                   float closest,
+                                   float depths[4] );
+};
+
+// Inline functions
+inline Watertight_Ray::Watertight_Ray(const Vec3& _origin, const Vec3& direction)
+    : origin{_origin.x, _origin.y, _origin.z}
+{
+    const float dir[3] = { direction.x, direction.y, direction.z };
+
+    kz = 0;
+    if ( std::abs(dir[1]) > std::abs(dir[kz]) ) kz = 1;
+    if ( std::abs(dir[2]) > std::abs(dir[kz]) ) kz = 2;
+
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+
+    if ( dir[kz] < 0.0f )
+        std::swap(kx, ky);
+
+    shear_x = dir[kx] / dir[kz];
+    shear_y = dir[ky] / dir[kz];
+    shear_z = 1.0f    / dir[kz];
+}
+
+inline int Triangle_Packs::intersect_pack( const Triangle_Pack& pack,
+                                           const Watertight_Ray& ray,
+                                           float closest,
+                                           float depths[4] )
+{
+#ifdef __SSE2__
+    const __m128 origin_x = _mm_set1_ps(ray.origin[ray.kx]);
+    const __m128 origin_y = _mm_set1_ps(ray.origin[ray.ky]);
+    const __m128 origin_z = _mm_set1_ps(ray.origin[ray.kz]);
+    const __m128 shear_x  = _mm_set1_ps(ray.shear_x);
+    const __m128 shear_y  = _mm_set1_ps(ray.shear_y);
+    const __m128 zero     = _mm_setzero_ps();
+
+    // Relative to the origin, then sheared, the same operations for every
+    // vertex so shared vertices stay equal
+    __m128 az = _mm_sub_ps(_mm_load_ps(pack.a[ray.kz]), origin_z);
+    __m128 bz = _mm_sub_ps(_mm_load_ps(pack.b[ray.kz]), origin_z);
+    __m128 cz = _mm_sub_ps(_mm_load_ps(pack.c[ray.kz]), origin_z);
+
+    __m128 ax = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.a[ray.kx]), origin_x), _mm_mul_ps(shear_x, az));
+    __m128 ay = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.a[ray.ky]), origin_y), _mm_mul_ps(shear_y, az));
+    __m128 bx = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.b[ray.kx]), origin_x), _mm_mul_ps(shear_x, bz));
+    __m128 by = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.b[ray.ky]), origin_y), _mm_mul_ps(shear_y, bz));
+    __m128 cx = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.c[ray.kx]), origin_x), _mm_mul_ps(shear_x, cz));
+    __m128 cy = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(pack.c[ray.ky]), origin_y), _mm_mul_ps(shear_y, cz));
+
+    // Edge functions, each of the form q.x * p.y - q.y * p.x for edge p q
+    __m128 u = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+    __m128 v = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+
+    __m128 negative = _mm_or_ps( _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmplt_ps(v, zero)),
+                                 _mm_cmplt_ps(w, zero) );
+    __m128 positive = _mm_or_ps( _mm_or_ps(_mm_cmpgt_ps(u, zero), _mm_cmpgt_ps(v, zero)),
+                                 _mm_cmpgt_ps(w, zero) );
+
+    __m128 determinant = _mm_add_ps(_mm_add_ps(u, v), w);
+
+    const __m128 shear_z = _mm_set1_ps(ray.shear_z);
+
+    __m128 scaled = _mm_add_ps( _mm_add_ps( _mm_mul_ps(u, _mm_mul_ps(shear_z, az)),
+                                            _mm_mul_ps(v, _mm_mul_ps(shear_z, bz)) ),
+                                _mm_mul_ps(w, _mm_mul_ps(shear_z, cz)) );
+
+    __m128 depth = _mm_div_ps(scaled, determinant);
+
+    // Edges of both signs miss, NaN of zero determinants compares false
+    __m128 hit = _mm_andnot_ps( _mm_and_ps(negative, positive),
+                                _mm_and_ps( _mm_cmpgt_ps(depth, _mm_set1_ps(0.0001f)),
+                                            _mm_cmple_ps(depth, _mm_set1_ps(closest)) ) );
+
+    _mm_storeu_ps(depths, depth);
+
+    return _mm_movemask_ps(hit);
+#else
+    int mask = 0;
+
+    for ( int i = 0 ; i < 4 ; i++ )
+    {
+        float az = pack.a[ray.kz][i] - ray.origin[ray.kz];
+        float bz = pack.b[ray.kz][i] - ray.origin[ray.kz];
+        float cz = pack.c[ray.kz][i] - ray.origin[ray.kz];
+
+        float ax = (pack.a[ray.kx][i] - ray.origin[ray.kx]) - ray.shear_x * az;
+        float ay = (pack.a[ray.ky][i] - ray.origin[ray.ky]) - ray.shear_y * az;
+        float bx = (pack.b[ray.kx][i] - ray.origin[ray.kx]) - ray.shear_x * bz;
+        float by = (pack.b[ray.ky][i] - ray.origin[ray.ky]) - ray.shear_y * bz;
+        float cx = (pack.c[ray.kx][i] - ray.origin[ray.kx]) - ray.shear_x * cz;
+        float cy = (pack.c[ray.ky][i] - ray.origin[ray.ky]) - ray.shear_y * cz;
+
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+
+        if ( ((u < 0.0f) || (v < 0.0f) || (w < 0.0f)) &&
+             ((u > 0.0f) || (v > 0.0f) || (w > 0.0f)) )
+        {
+            continue;
+        }
+
+        float determinant = u + v + w;
+        float scaled      = u * (ray.shear_z * az) + v * (ray.shear_z * bz) + w * (ray.shear_z * cz);
+
+        depths[i] = scaled / determinant;
+
+        if ( (depths[i] > 0.0001f) && (depths[i] <= closest) )
+            mask |= 1 << i;
+    }
+
+    return mask;
+#endif
+}
+
+inline void Triangle_Packs::intersect( const Watertight_Ray& ray,
+                                       int first, int count,
+                                       float& closest,
+                                       int& triangle ) const
+{
+    int last = first + count;
+
+    for ( int pack = first / 4 ; pack * 4 < last ; pack++ )
+    {
+        float depths[4];
+        int   hits = intersect_pack(packs[pack], ray, closest, depths);
+
+        // Only the lanes within the range
+        int begin = std::max(first - pack * 4, 0);
+        int end   = std::min(last  - pack * 4, 4);
+        hits &= ((1 << end) - 1) & ~((1 << begin) - 1);
+
+        for ( int lane = 0 ; hits != 0 ; lane++, hits >>= 1 )
+        {
+            if ( (hits & 1) == 0 )
+                continue;
+
+            int index = triangles[pack * 4 + lane];
+
+            if ( ( depths[lane] < closest ) ||
+                 ( ( depths[lane] == closest ) && ( index < triangle ) ) )
+            {
+                closest  = depths[lane];
+                triangle = index;
+            }
+        }
+    }
+}
+
+#endif // _TRIANGLE_PACKS_H_
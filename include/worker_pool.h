@@ -0,0 +1,69 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//  Persistent worker threads
+//
+//  Runs one task on several threads at once and waits for all of them,
+//  like starting and joining threads, but the threads are started on first
+//  use and kept for later calls. Frame after frame the same threads trace,
+//  so per thread state such as trace buffers is not created again.
+
+class Worker_Pool
+{
+    private:
+
+        std::string name;
+
+        // One run() at a time
+        std::mutex run_mutex;
+
+        std::mutex              mutex;
+        std::condition_variable condition;
+        std::condition_variable finished;
+
+        const std::function<void()>* task = nullptr;
+
+        // Each run() is a new generation, a thread joins it at most once
+        uint64_t generation = 0;
+        int      wanted     = 0;
+        int      running    = 0;
+
+        bool stopping = false;
+
+        std::vector<std::thread> workers;
+
+    public:
+
+        // Constructors
+
+        // Threads are named name 1, name 2 and so on, the caller is the 0th
+        Worker_Pool(const std::string& _name = "worker");
+        // Destructor
+        ~Worker_Pool();
+
+        // Member functions
+
+        // Calls task on the calling thread and on threads - 1 pool threads,
+        // returns once every call has returned
+        void run(int threads, const std::function<void()>& task);
+
+        // Splits rows [0, rows) into one band per thread and calls
+        // function(first, last) for each band as run() does
+        void run_rows(int rows, int threads, const std::function<void(int, int)>& function);
+
+        int get_threads();
+
+    private:
+
+        void work_loop(int index);
+};
+
+#endif // _WORKER_POOL_H_
@@ -1,54 +1,707 @@
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 #define SFML_STATIC
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 
 #include "raytracer.h"
+#include "scenes.h"
+#include "image.h"
+#include "trace.h"
+#include "distributed.h"
+#include "quality.h"
+#include "orbit.h"
+#include "sequence.h"
+#include "server.h"
+#include "render_cache.h"
+#include "scene_io.h"
+#include "assets.h"
+#include "paged_mesh.h"
 
-int main()
+// Camera edits made in the window, picked up by the render thread
+struct View_State
+{
+    std::mutex              mutex;
+    std::condition_variable changed;
+
+    Orbit_Camera orbit;
+    uint64_t     version = 0;
+    bool         running = true;
+
+    // Set with every edit so the frame in flight is abandoned
+    std::atomic<bool> cancel{false};
+};
+
+// Distance of the orbit target in front of the initial camera
+const float ORBIT_DISTANCE = 11.0f;
+
+// Pixel block size of the preview pass after the camera moved
+const int PREVIEW_STEP = 8;
+
+void request_view(View_State& view, const Orbit_Camera& orbit)
+{
+    std::lock_guard<std::mutex> lock(view.mutex);
+
+    view.orbit = orbit;
+    view.version++;
+    view.cancel = true;
+
+    view.changed.notify_one();
+}
+
+void stop_rendering(View_State& view)
+{
+    std::lock_guard<std::mutex> lock(view.mutex);
+
+    view.running = false;
+    view.cancel  = true;
+
+    view.changed.notify_one();
+}
+
+// Wakes the render loop without cancelling the frame in flight
+void refresh_view(View_State& view)
+{
+    std::lock_guard<std::mutex> lock(view.mutex);
+
+    view.version++;
+    view.changed.notify_one();
+}
+
+void print_assets(const std::vector<Asset_Loader::Asset>& assets)
+{
+    for ( const Asset_Loader::Asset& asset : assets )
+    {
+        std::cout << "Asset " << asset.filename << " : ";
+
+        if ( asset.failed )
+            std::cout << "failed";
+        else if ( asset.cached )
+            std::cout << "cached";
+        else
+            std::cout << "read " << asset.read_seconds << "s, parse " << asset.parse_seconds
+                      << "s, build " << asset.build_seconds << "s";
+
+        std::cout << " (" << asset.triangles << " triangles)" << std::endl;
+    }
+}
+
+void print_paging()
+{
+    Cluster_Cache& clusters = Cluster_Cache::shared();
+
+    if ( clusters.get_loads() == 0 )
+        return;
+
+    std::cout << "Clusters : " << clusters.get_loads() << " loaded, "
+              << clusters.get_evictions() << " evicted, "
+              << (clusters.get_size() >> 20) << " of "
+              << (clusters.get_capacity() >> 20) << " MB resident" << std::endl;
+}
+
+// Orbits with the left mouse button or the arrow keys, pans with the right 
+// button or A / D and zooms with the wheel or W / S. Returns true when the
+// camera moved.
+bool handle_camera_input(const sf::Event& event, Orbit_Camera& orbit, sf::Vector2i& last_mouse)
+{
+    const float ORBIT_SPEED = 0.005f;   // Radians per pixel
+    const float PAN_SPEED   = 0.002f;   // Distances per pixel
+    const float KEY_ANGLE   = 0.1f;
+    const float KEY_PAN     = 0.05f;
+
+    switch ( event.type )
+    {
+        case sf::Event::MouseButtonPressed :
+            last_mouse = sf::Vector2i{event.mouseButton.x, event.mouseButton.y};
+            return false;
+
+        case sf::Event::MouseMoved :
+        {
+            int dx = event.mouseMove.x - last_mouse.x;
+            int dy = event.mouseMove.y - last_mouse.y;
+            last_mouse = sf::Vector2i{event.mouseMove.x, event.mouseMove.y};
+
+            if ( sf::Mouse::isButtonPressed(sf::Mouse::Left) )
+                orbit.orbit(dx * ORBIT_SPEED, dy * ORBIT_SPEED);
+            else if ( sf::Mouse::isButtonPressed(sf::Mouse::Right) ||
+                      sf::Mouse::isButtonPressed(sf::Mouse::Middle) )
+                orbit.pan(-dx * PAN_SPEED, dy * PAN_SPEED);
+            else
+                return false;
+
+            return (dx != 0) || (dy != 0);
+        }
+
+        case sf::Event::MouseWheelScrolled :
+            orbit.zoom(std::pow(0.9f, event.mouseWheelScroll.delta));
+            return true;
+
+        case sf::Event::KeyPressed :
+            switch ( event.key.code )
+            {
+                case sf::Keyboard::Left  : orbit.orbit(-KEY_ANGLE, 0.0f); return true;
+                case sf::Keyboard::Right : orbit.orbit( KEY_ANGLE, 0.0f); return true;
+                case sf::Keyboard::Up    : orbit.orbit(0.0f, -KEY_ANGLE); return true;
+                case sf::Keyboard::Down  : orbit.orbit(0.0f,  KEY_ANGLE); return true;
+                case sf::Keyboard::A     : orbit.pan(-KEY_PAN, 0.0f);     return true;
+                case sf::Keyboard::D     : orbit.pan( KEY_PAN, 0.0f);     return true;
+                case sf::Keyboard::W     : orbit.zoom(0.9f);              return true;
+                case sf::Keyboard::S     : orbit.zoom(1.1f);              return true;
+                default                  : return false;
+            }
+
+        default :
+            return false;
+    }
+}
+
+// Interactive viewer that re-renders continuously, trading internal
+// resolution, recursion depth and samples against a frame time budget.
+// Frames are upscaled to the window.
+int run_adaptive_viewer(Raytracer& rt, View_State& view, int width, int height, double budget_seconds)
+{
+    Quality_Controller quality(budget_seconds);
+
+    // Last finished frame, handed from the render thread to the window
+    std::mutex           display_mutex;
+    std::vector<uint8_t> display_frame;
+    int                  display_width  = 0;
+    int                  display_height = 0;
+    int                  display_level  = 0;
+    Quality_Level        display_quality = {};
+    uint64_t             display_count  = 0;
+
+    sf::Thread t1([&]() {
+        Trace::set_thread_name("render");
+
+        uint64_t rendered_version = 0;
+
+        while ( true )
+        {
+            {
+                std::lock_guard<std::mutex> lock(view.mutex);
+
+                if ( !view.running )
+                    break;
+
+                if ( view.version != rendered_version )
+                {
+                    rendered_version = view.version;
+
+                    Camera camera = rt.get_camera();
+                    view.orbit.apply(camera);
+                    rt.set_camera(camera);
+                }
+
+                view.cancel = false;
+            }
+
+            Quality_Level level = quality.get_level();
+
+            int scaled_width, scaled_height;
+            quality.get_size(width, height, scaled_width, scaled_height);
+
+            rt.resize(scaled_width, scaled_height);
+            rt.set_max_recursion_depth(level.max_depth);
+            rt.set_samples_per_pixel(level.samples);
+
+            // Frames abandoned for a camera move say nothing about the cost
+            if ( !rt.render_tiles(0, rt.get_tile_count()) )
+                continue;
+
+            {
+                Trace_Scope trace_publish("frame publish");
+                std::lock_guard<std::mutex> lock(display_mutex);
+
+                display_frame.assign(rt.frame, rt.frame + (size_t) scaled_width * scaled_height * 4);
+                display_width  = scaled_width;
+                display_height = scaled_height;
+                display_level   = quality.get_level_index();
+                display_quality = level;
+                display_count++;
+            }
+
+            quality.update(rt.stats.get_frame_seconds());
+        }
+    });
+    t1.launch();
+
+
+    sf::RenderWindow window(sf::VideoMode(width, height), "Raytracer");
+
+    sf::Texture texture;
+    texture.setSmooth(true);
+
+    sf::Sprite sprite;
+
+    Orbit_Camera orbit = view.orbit;
+    sf::Vector2i last_mouse{0, 0};
+
+    int      texture_width  = 0;
+    int      texture_height = 0;
+    uint64_t shown_count    = 0;
+    int      shown_level    = -1;
+
+    while (window.isOpen())
+    {
+        sf::Event event;
+        while (window.pollEvent(event))
+        {
+            if (event.type == sf::Event::Closed)
+                window.close();
+            else if ( handle_camera_input(event, orbit, last_mouse) )
+                request_view(view, orbit);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(display_mutex);
+
+            if ( display_count != shown_count )
+            {
+                Trace_Scope trace_upload("texture upload");
+
+                if ( (display_width != texture_width) || (display_height != texture_height) )
+                {
+                    texture_width  = display_width;
+                    texture_height = display_height;
+
+                    texture.create(texture_width, texture_height);
+                    sprite.setTexture(texture, true);
+                    sprite.setScale( (float) width  / texture_width,
+                                     (float) height / texture_height );
+                }
+
+                texture.update(display_frame.data());
+                shown_count = display_count;
+
+                if ( display_level != shown_level )
+                {
+                    shown_level = display_level;
+
+                    std::cout << "Quality " << shown_level << " : "
+                              << texture_width << "x" << texture_height
+                              << ", depth " << display_quality.max_depth
+                              << ", " << display_quality.samples << " spp" << std::endl;
+                }
+            }
+        }
+
+        window.clear(sf::Color(Color::LIGHT_GRAY));
+        window.draw(sprite);
+        window.display();
+
+        sf::sleep(sf::milliseconds(1));
+    }
+
+    stop_rendering(view);
+    t1.wait();
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
 {
     int width  = 800;
     int height = 600;
 
+    bool write_heatmap = false;
+    bool write_trace   = false;
+    bool write_aovs    = false;
+    bool use_denoiser  = false;
+    bool use_temporal  = false;
+    bool use_lod       = true;
+
+    float gamma   = 1.0f;
+    int   samples = 1;
+
+    // Frame time target of the adaptive viewer, 0 renders a single frame
+    float budget_ms = 0.0f;
+
+    int         coordinator_port = 0;
+    std::string output;
+    std::string stream_output;
+
+    // Keyframe file and frame count of a headless animation render
+    std::string sequence_file;
+    int         sequence_frames = 0;
+
+    // Number of views around the scene rendered in one job
+    int views = 0;
+
+    // Directory of previously rendered tiles, see render_cache.h
+    std::string cache_directory;
+
+    // Scene file loaded instead of the built in scene, see scene_io.h
+    std::string scene_file;
+    std::string save_scene_file;
+
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+        std::string arg(argv[i]);
+
+        if ( arg == "--heatmap" )
+            write_heatmap = true;
+        if ( arg == "--trace" )
+            write_trace = true;
+        if ( arg == "--aovs" )
+            write_aovs = true;
+        if ( (arg == "--gamma") && (i + 1 < argc) )
+            gamma = std::atof(argv[++i]);
+        if ( (arg == "--spp") && (i + 1 < argc) )
+            samples = std::atoi(argv[++i]);
+        if ( arg == "--denoise" )
+            use_denoiser = true;
+        if ( arg == "--temporal" )
+            use_temporal = true;
+        if ( arg == "--no-lod" )
+            use_lod = false;
+        if ( (arg == "--budget") && (i + 1 < argc) )
+            budget_ms = std::atof(argv[++i]);
+        if ( (arg == "--size") && (i + 2 < argc) )
+        {
+            width  = std::atoi(argv[++i]);
+            height = std::atoi(argv[++i]);
+        }
+        if ( (arg == "--output") && (i + 1 < argc) )
+            output = argv[++i];
+        if ( (arg == "--stream") && (i + 1 < argc) )
+            stream_output = argv[++i];
+        if ( (arg == "--scene") && (i + 1 < argc) )
+            scene_file = argv[++i];
+        if ( (arg == "--save-scene") && (i + 1 < argc) )
+            save_scene_file = argv[++i];
+        if ( (arg == "--cache") && (i + 1 < argc) )
+            cache_directory = argv[++i];
+        if ( (arg == "--page-budget") && (i + 1 < argc) )
+            Cluster_Cache::shared().set_capacity( (size_t) std::atoi(argv[++i]) << 20 );
+        if ( (arg == "--views") && (i + 1 < argc) )
+            views = std::atoi(argv[++i]);
+        if ( (arg == "--sequence") && (i + 2 < argc) )
+        {
+            sequence_file   = argv[++i];
+            sequence_frames = std::atoi(argv[++i]);
+        }
+
+        // Distributed rendering, see distributed.h
+        if ( (arg == "--coordinator") && (i + 1 < argc) )
+            coordinator_port = std::atoi(argv[++i]);
+        if ( (arg == "--worker") && (i + 2 < argc) )
+        {
+            std::string host(argv[i + 1]);
+            int port = std::atoi(argv[i + 2]);
+
+            return run_render_worker(host, port) ? 0 : 1;
+        }
+
+        // Cluster file of an obj mesh for paged meshes, see paged_mesh.h
+        if ( (arg == "--cluster") && (i + 2 < argc) )
+        {
+            std::ifstream obj_file(argv[i + 1]);
+            std::vector<Triangle> triangles;
+
+            if ( obj_file.is_open() )
+                read_obj(obj_file, Vec3(0.0f, 0.0f, 0.0f), triangles);
+
+            if ( !write_clusters(triangles, argv[i + 2]) )
+            {
+                std::cout << "Unable to write clusters of \"" << argv[i + 1] << "\"." << std::endl;
+                return 1;
+            }
+
+            return 0;
+        }
+
+        // Local job server, see server.h
+        if ( (arg == "--serve") && (i + 1 < argc) )
+        {
+            int port = std::atoi(argv[++i]);
+
+            return Render_Server(port).run() ? 0 : 1;
+        }
+    }
+
+    Trace::enable(write_trace);
+    Trace::set_thread_name("ui");
+
+    auto load_scene_into = [&](Raytracer& rt, Asset_Loader* assets = nullptr)
+    {
+        if ( scene_file.empty() )
+        {
+            scene_default(rt);
+            return true;
+        }
+
+        std::string error;
+        if ( load_scene(scene_file, rt, error, nullptr, assets) )
+            return true;
+
+        std::cout << "Unable to load \"" << scene_file << "\": " << error << std::endl;
+        return false;
+    };
+
+    // Text copy of the scene, a starting point for scene files
+    if ( !save_scene_file.empty() )
+    {
+        Raytracer rt(width, height, false);
+
+        if ( !load_scene_into(rt) )
+            return 1;
+
+        std::ofstream scene_out(save_scene_file);
+        return write_scene_text(scene_out, rt) ? 0 : 1;
+    }
+
+    // Headless out of core render straight to a file, no frame in memory
+    if ( !stream_output.empty() )
+    {
+        Raytracer rt(width, height, false);
+        rt.set_gamma(gamma);
+        rt.set_samples_per_pixel(samples);
+        rt.enable_level_of_detail(use_lod);
+        if ( !load_scene_into(rt) )
+            return 1;
+
+        bool ok = rt.render_to_file(stream_output);
+
+        std::ofstream stats_file("stats.json");
+        rt.stats.write_json(stats_file);
+
+        std::cout << "Render time : " << rt.stats.get_frame_seconds() << "s ("
+                  << rt.stats.mrays_per_second() << " Mrays/s)" << std::endl;
+        print_paging();
+
+        if ( write_trace )
+            Trace::write_json("trace.json");
+
+        return ok ? 0 : 1;
+    }
+
+    // Headless animation, the scene is loaded once for all frames
+    if ( !sequence_file.empty() )
+    {
+        std::ifstream keys_file(sequence_file);
+        Sequence sequence;
+
+        if ( !keys_file.is_open() || !sequence.load(keys_file) )
+        {
+            std::cout << "Unable to read keyframes from \"" << sequence_file << "\"." << std::endl;
+            return 1;
+        }
+
+        Raytracer rt(width, height);
+        rt.set_gamma(gamma);
+        rt.set_samples_per_pixel(samples);
+        rt.enable_level_of_detail(use_lod);
+        rt.enable_denoiser(use_denoiser);
+        rt.enable_temporal_cache(use_temporal);
+        if ( !load_scene_into(rt) )
+            return 1;
+
+        bool ok = render_sequence( rt, sequence, sequence_frames,
+                                   output.empty() ? "frame_####.ppm" : output );
+
+        if ( write_trace )
+            Trace::write_json("trace.json");
+
+        return ok ? 0 : 1;
+    }
+
+    // Headless product shots, cameras evenly spaced around the orbit target
+    if ( views > 0 )
+    {
+        Raytracer rt(width, height);
+        rt.set_gamma(gamma);
+        rt.set_samples_per_pixel(samples);
+        rt.enable_level_of_detail(use_lod);
+        rt.enable_denoiser(use_denoiser);
+        if ( !load_scene_into(rt) )
+            return 1;
+
+        Orbit_Camera orbit = Orbit_Camera::from_camera(rt.get_camera(), ORBIT_DISTANCE);
+
+        std::vector<Camera> cameras(views, rt.get_camera());
+        for ( int v = 0 ; v < views ; v++ )
+        {
+            Orbit_Camera view_orbit = orbit;
+            view_orbit.orbit(2.0f * PI * v / views, 0.0f);
+            view_orbit.apply(cameras[v]);
+        }
+
+        std::vector<std::vector<uint8_t>> images;
+        bool ok = rt.render_views(cameras, images);
+
+        std::string pattern = output.empty() ? "view_##.ppm" : output;
+        for ( int v = 0 ; ok && (v < views) ; v++ )
+            ok = write_ppm(sequence_filename(pattern, v), images[v].data(), width, height);
+
+        std::cout << "Render time : " << rt.stats.get_frame_seconds() << "s for " << views
+                  << " views (" << rt.stats.mrays_per_second() << " Mrays/s)" << std::endl;
+
+        if ( write_trace )
+            Trace::write_json("trace.json");
+
+        return ok ? 0 : 1;
+    }
+
     Raytracer rt(width, height);
+    rt.enable_heatmap(write_heatmap);
+    rt.enable_aovs(write_aovs ? AOV_ALL : AOV_NONE);
+    rt.set_gamma(gamma);
+    rt.set_samples_per_pixel(samples);
+    rt.enable_level_of_detail(use_lod);
+    rt.enable_denoiser(use_denoiser);
+    rt.enable_temporal_cache(use_temporal);
+
+    std::unique_ptr<Render_Cache> render_cache;
+    if ( !cache_directory.empty() )
+    {
+        render_cache.reset(new Render_Cache(cache_directory));
+        rt.set_render_cache(render_cache.get());
+    }
 
     //Mesh* box = new Mesh("res/box.obj", Vec3(-1.0f, 0.0f, 14.0f));
     //box->material = Material(Color(Color::LIGHT_GRAY), 20.0f, 0.0f);
     //rt.add(box);
 
-    Light_Direction* light1 = new Light_Direction( Vec3(1.0f, -1.0f, 1.0f),
-                                                   Color(0.9f, 0.88f, 0.83f),
-                                                   1.0f );
+    View_State view;
 
-    Light_Direction* light2 = new Light_Direction( Vec3( -1.0f, -0.5f,  1.0f),
-                                                   Color( 0.45f, 0.45f, 0.5f),
-                                                   1.0f );
+    // Meshes of the scene file load while the first frames render
+    Asset_Loader assets;
+    assets.set_ready_callback( [&view]() { refresh_view(view); } );
 
-    rt.add(light1);
-    rt.add(light2);
+    if ( !load_scene_into(rt, &assets) )
+        return 1;
 
-    Sphere* sphere_left   = new Sphere( Vec3(-3.5f, -0.5f, 10.0f),  1.5f);
-    sphere_left->material = Material(Color(Color::ORANGE), 40.0f, 0.0f);
+    view.orbit = Orbit_Camera::from_camera(rt.get_camera(), ORBIT_DISTANCE);
+    rt.set_cancel_token(&view.cancel);
 
-    Sphere* sphere_middle   = new Sphere( Vec3( 0.0f, 1.0f, 12.0f), 3.0f);
-    sphere_middle->material = Material(Color(Color::GREEN), 200.0f, 0.0f);
+    if ( budget_ms > 0.0f )
+    {
+        assets.wait();
+        assets.apply(rt);
+        print_assets(assets.get_assets());
 
-    Sphere* sphere_right   = new Sphere( Vec3( 2.5f, -0.5f, 9.0f), 1.5f);
-    sphere_right->material = Material(Color(Color::PURPLE), 40.0f, 0.0f);
+        int result = run_adaptive_viewer(rt, view, width, height, budget_ms / 1000.0);
 
-    rt.add(sphere_left);
-    rt.add(sphere_middle);
-    rt.add(sphere_right);
+        if ( write_trace )
+            Trace::write_json("trace.json");
 
-    Plane* plane = new Plane(Vec3(0.0f, -2.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
-    plane->material = Material(Color(Color::LIGHT_GRAY), 0.0, 0.0f);
-    rt.add(plane);
+        return result;
+    }
 
     //uint8_t* img_data = rt.render();
     uint8_t* img_data = rt.frame;
-    sf::Thread t1([&rt]() {
-        rt.render();
+    sf::Thread t1([&rt, &view, &assets, width, height, coordinator_port, output, write_aovs]() {
+        Trace::set_thread_name("render");
+
+        // Writes the requested outputs of a finished frame
+        auto publish = [&]()
+        {
+            Trace_Scope trace_publish("frame publish");
+
+            if ( !output.empty() )
+                write_ppm(output, rt.frame, width, height);
+
+            if ( rt.get_heatmap() != nullptr )
+            {
+                write_ppm("render_beauty.ppm", rt.frame, width, height);
+                rt.get_heatmap()->write("render");
+            }
+
+            if ( write_aovs )
+            {
+                const Framebuffer& fb = rt.get_framebuffer();
+
+                fb.write_color_pfm("render_color.pfm");
+                fb.write_pfm("render_depth.pfm",     AOV_DEPTH);
+                fb.write_pfm("render_normal.pfm",    AOV_NORMAL);
+                fb.write_pfm("render_albedo.pfm",    AOV_ALBEDO);
+                fb.write_pfm("render_shape_id.pfm",  AOV_SHAPE_ID);
+                fb.write_pfm("render_direct.pfm",    AOV_DIRECT);
+                fb.write_pfm("render_reflected.pfm", AOV_REFLECTED);
+
+                if ( rt.denoiser_enabled() )
+                    rt.get_denoised().write_color_pfm("render_denoised.pfm");
+            }
+
+            std::ofstream stats_file("stats.json");
+            rt.stats.write_json(stats_file);
+
+            std::cout << "Render time : " << rt.stats.get_frame_seconds() << "s ("
+                      << rt.stats.mrays_per_second() << " Mrays/s)" << std::endl;
+            print_paging();
+        };
+
+        if ( coordinator_port > 0 )
+        {
+            assets.wait();
+            assets.apply(rt);
+
+            Render_Coordinator(rt, coordinator_port).render();
+            publish();
+            return;
+        }
+
+        // Renders again whenever the camera moves or meshes are loaded, the
+        // first frame that completes with all of them is published
+        bool     published        = false;
+        bool     assets_complete  = false;
+        uint64_t rendered_version = ~(uint64_t) 0;
+
+        while ( true )
+        {
+            {
+                std::unique_lock<std::mutex> lock(view.mutex);
+                view.changed.wait(lock, [&]()
+                {
+                    return !view.running || (view.version != rendered_version);
+                });
+
+                if ( !view.running )
+                    break;
+
+                rendered_version = view.version;
+                view.cancel      = false;
+
+                Camera camera = rt.get_camera();
+                view.orbit.apply(camera);
+                rt.set_camera(camera);
+            }
+
+            assets.apply(rt);
+
+            if ( !assets_complete && assets.is_complete() )
+            {
+                print_assets(assets.get_assets());
+                assets_complete = true;
+            }
+
+            // Coarse preview first so the new view shows up immediately,
+            // unless most of the last frame can be reused
+            if ( !rt.temporal_cache_enabled() )
+            {
+                rt.set_pixel_step(PREVIEW_STEP);
+                bool previewed = rt.render_tiles(0, rt.get_tile_count());
+                rt.set_pixel_step(1);
+
+                if ( !previewed )
+                    continue;
+            }
+
+            if ( rt.render_tiles(0, rt.get_tile_count()) && !published && assets_complete )
+            {
+                publish();
+                published = true;
+            }
+        }
     });
     t1.launch();
 
@@ -66,21 +719,37 @@ int main()
     
     sf::Sprite sprite(texture);
 
+    Orbit_Camera orbit = view.orbit;
+    sf::Vector2i last_mouse{0, 0};
+
     while (window.isOpen())
     {
         sf::Event event;
         while (window.pollEvent(event))
+        {
             if (event.type == sf::Event::Closed)
                 window.close();
+            else if ( handle_camera_input(event, orbit, last_mouse) )
+                request_view(view, orbit);
+        }
 
-        texture.update(img_data);
+        {
+            Trace_Scope trace_upload("texture upload");
+            texture.update(img_data);
+        }
 
         window.clear(sf::Color(Color::LIGHT_GRAY));
         window.draw(sprite);
         window.display();
 
-        sf::sleep(sf::seconds(0.1f));
+        sf::sleep(sf::milliseconds(16));
     }
 
+    stop_rendering(view);
+    t1.wait();
+
+    if ( write_trace )
+        Trace::write_json("trace.json");
+
     return 0;
 }
\ No newline at end of file
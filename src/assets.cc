@@ -0,0 +1,252 @@
+#include "assets.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "trace.h"
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double seconds_since(Clock::time_point start_point)
+    {
+        std::chrono::duration<double> delta_time = Clock::now() - start_point;
+        return delta_time.count();
+    }
+}
+
+
+//  --  class Asset_Loader  --  //
+
+// Constructors
+Asset_Loader::Asset_Loader(int threads, Mesh_Cache* _cache)
+    : cache{_cache}
+{
+    if ( threads <= 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for ( int i = 0 ; i < threads ; i++ )
+    {
+        workers.emplace_back( [this, i]()
+        {
+            Trace::set_thread_name("loader " + std::to_string(i));
+            work_loop();
+        });
+    }
+}
+// Destructor
+Asset_Loader::~Asset_Loader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for ( std::thread& thread : workers )
+        thread.join();
+}
+
+// Member functions
+void Asset_Loader::load_mesh(Mesh* mesh, const std::string& filename, const Vec3& position)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto index = asset_index.find(filename);
+
+        if ( index == asset_index.end() )
+        {
+            Asset asset;
+            asset.filename = filename;
+
+            index = asset_index.emplace(filename, (int) assets.size()).first;
+
+            assets.push_back(asset);
+            meshes.emplace_back();
+            queue.push_back(index->second);
+        }
+        else if ( assets[index->second].failed )
+        {
+            // Tried again, the file may have been written since
+            assets[index->second] = Asset();
+            assets[index->second].filename = filename;
+
+            queue.push_back(index->second);
+        }
+
+        instances.push_back( Instance{ mesh, index->second, position } );
+    }
+    condition.notify_one();
+}
+
+int Asset_Loader::apply(Raytracer& rt, std::vector<std::string>* failed)
+{
+    std::set<const Shape*> shapes( rt.get_shapes().begin(), rt.get_shapes().end() );
+
+    std::vector<std::pair<Instance, std::shared_ptr<const Mesh>>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto pending = std::remove_if( instances.begin(), instances.end(), [&](const Instance& instance)
+        {
+            if ( shapes.count(instance.mesh) == 0 )
+                return false;
+
+            const Asset& asset = assets[instance.asset];
+
+            if ( asset.loaded )
+                ready.push_back( std::make_pair(instance, meshes[instance.asset]) );
+
+            if ( asset.failed && (failed != nullptr) )
+                failed->push_back(asset.filename);
+
+            return asset.loaded || asset.failed;
+        });
+
+        instances.erase(pending, instances.end());
+    }
+
+    // Loaded meshes are never changed, so they are shared without the lock
+    for ( auto& mesh : ready )
+    {
+        Instance& instance = mesh.first;
+
+        instance.mesh->copy_geometry(*mesh.second);
+        instance.mesh->translate(instance.position);
+
+        rt.invalidate_shape(instance.mesh->id);
+    }
+
+    return (int) ready.size();
+}
+
+void Asset_Loader::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return queue.empty() && (loading == 0); });
+}
+
+void Asset_Loader::wait(const Raytracer& rt)
+{
+    std::set<const Shape*> shapes( rt.get_shapes().begin(), rt.get_shapes().end() );
+
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&]()
+    {
+        for ( const Instance& instance : instances )
+        {
+            const Asset& asset = assets[instance.asset];
+
+            if ( (shapes.count(instance.mesh) > 0) && !asset.loaded && !asset.failed )
+                return false;
+        }
+
+        return true;
+    });
+}
+
+bool Asset_Loader::is_complete()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return instances.empty() && queue.empty() && (loading == 0);
+}
+
+std::vector<Asset_Loader::Asset> Asset_Loader::get_assets()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return assets;
+}
+
+void Asset_Loader::work_loop()
+{
+    while ( true )
+    {
+        int         index;
+        std::string filename;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+            if ( stopping )
+                return;
+
+            index    = queue.front();
+            filename = assets[index].filename;
+
+            queue.pop_front();
+            loading++;
+        }
+
+        Asset result;
+        result.filename = filename;
+
+        std::shared_ptr<const Mesh> mesh;
+
+        if ( cache != nullptr )
+            mesh = cache->find(filename);
+
+        if ( mesh )
+        {
+            result.cached = true;
+        }
+        else
+        {
+            Trace_Scope trace_asset("asset load", index);
+
+            Clock::time_point start_point = Clock::now();
+
+            // Whole file first, so reading and parsing are timed apart
+            std::ostringstream contents;
+            {
+                std::ifstream ifs(filename, std::ios::binary);
+                contents << ifs.rdbuf();
+            }
+
+            result.read_seconds = seconds_since(start_point);
+            start_point         = Clock::now();
+
+            std::vector<Triangle> triangles;
+            {
+                std::istringstream iss(contents.str());
+                read_obj(iss, Vec3(0.0f, 0.0f, 0.0f), triangles);
+            }
+
+            result.parse_seconds = seconds_since(start_point);
+            start_point          = Clock::now();
+
+            if ( !triangles.empty() )
+            {
+                mesh = std::make_shared<const Mesh>(std::move(triangles), filename);
+
+                if ( cache != nullptr )
+                    mesh = cache->insert(filename, mesh);
+            }
+
+            result.build_seconds = seconds_since(start_point);
+        }
+
+        if ( mesh )
+            result.triangles = (int) mesh->get_triangles().size();
+
+        result.loaded = (bool) mesh;
+        result.failed = !mesh;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            assets[index] = result;
+            meshes[index] = mesh;
+
+            loading--;
+        }
+        idle.notify_all();
+
+        if ( ready_callback )
+            ready_callback();
+    }
+}
@@ -0,0 +1,660 @@
+#include "bvh.h"
+
+#include <cmath>
+#include <atomic>
+
+#include "worker_pool.h"
+
+namespace
+{
+    const int   BINS          = 12;
+    const int   MAX_LEAF_SIZE = 8;
+    const int   MAX_DEPTH     = 60;     // Bvh::traverse() keeps a stack of 64
+
+    // Relative to testing one primitive
+    const float TRAVERSAL_COST = 1.0f;
+
+    // Subtrees the refit is split into, more than threads to balance them
+    const int   MAX_SUBTREES = 32;
+
+    // Fewer primitives are refit on the calling thread alone
+    const int   PARALLEL_REFIT_SIZE = 2048;
+
+    // Primitives a leaf child of a Wide_Bvh_Node can hold
+    const int   MAX_WIDE_LEAF_SIZE = std::numeric_limits<uint16_t>::max();
+
+    // Bound of a quantized step, computed as in Wide_Bvh::intersect_children()
+    float dequantize(float origin, int step, float scale)
+    {
+        return origin + (float) step * scale;
+    }
+
+    // Smallest steps of 2^exponent from origin that cover [min, max] of
+    // every slot, exponents grow until 255 steps reach far enough
+    template < typename Slot >
+    void quantize_axis( Wide_Bvh_Node& node,
+                        int axis,
+                        const Slot* slots, int slot_count,
+                        float origin, float extent )
+    {
+        int exponent;
+        std::frexp(extent / 255.0f, &exponent);
+        exponent = std::min(std::max(exponent, -126), 127);
+
+        for ( ; exponent <= 127 ; exponent++ )
+        {
+            float scale = wide_bvh_scale((int8_t) exponent);
+            bool  fits  = true;
+
+            for ( int i = 0 ; (i < slot_count) && fits ; i++ )
+            {
+                float min = slots[i].bounds.min[axis];
+                float max = slots[i].bounds.max[axis];
+
+                double lo_step = std::floor( ((double) min - origin) / scale );
+                double hi_step = std::ceil ( ((double) max - origin) / scale );
+
+                int lo = (int) std::min(std::max(lo_step, 0.0), 255.0);
+                int hi = (int) std::min(std::max(hi_step, 0.0), 255.0);
+
+                // Rounding of the dequantized bounds is fixed up by a step
+                while ( (lo > 0) && (dequantize(origin, lo, scale) > min) )
+                    lo--;
+                while ( (hi < 255) && (dequantize(origin, hi, scale) < max) )
+                    hi++;
+
+                fits = ( dequantize(origin, lo, scale) <= min ) &&
+                       ( dequantize(origin, hi, scale) >= max );
+
+                node.lo[axis][i] = (uint8_t) lo;
+                node.hi[axis][i] = (uint8_t) hi;
+            }
+
+            if ( fits )
+                break;
+        }
+
+        node.exponent[axis] = (int8_t) std::min(exponent, 127);
+    }
+}
+
+
+//  --  struct Aabb  --  //
+
+// Constructors
+Aabb::Aabb(const Vec3& _min, const Vec3& _max)
+{
+    float largest = std::max( { std::abs(_min.x), std::abs(_min.y), std::abs(_min.z),
+                                std::abs(_max.x), std::abs(_max.y), std::abs(_max.z) } );
+    float padding = 1e-5f * (1.0f + largest);
+
+    min[0] = _min.x - padding;  max[0] = _max.x + padding;
+    min[1] = _min.y - padding;  max[1] = _max.y + padding;
+    min[2] = _min.z - padding;  max[2] = _max.z + padding;
+}
+
+// Member functions
+void Aabb::extend(const Aabb& box)
+{
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+    {
+        min[axis] = std::min(min[axis], box.min[axis]);
+        max[axis] = std::max(max[axis], box.max[axis]);
+    }
+}
+
+float Aabb::surface_area() const
+{
+    if ( empty() )
+        return 0.0f;
+
+    float x = max[0] - min[0];
+    float y = max[1] - min[1];
+    float z = max[2] - min[2];
+
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+bool Aabb::intersect( const float origin[3],
+                      const float inverse_direction[3],
+                      float max_depth,
+                      float& depth ) const
+{
+    float near = -std::numeric_limits<float>::max();
+    float far  =  std::numeric_limits<float>::max();
+
+    // NaN from a ray in the plane of a slab leaves the bounds unchanged
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+    {
+        float t0 = (min[axis] - origin[axis]) * inverse_direction[axis];
+        float t1 = (max[axis] - origin[axis]) * inverse_direction[axis];
+
+        near = std::max(near, std::min(t0, t1));
+        far  = std::min(far,  std::max(t0, t1));
+    }
+
+    depth = near;
+
+    return (near <= far) && (far >= 0.0f) && (near <= max_depth);
+}
+
+
+//  --  class Bvh  --  //
+
+// Member functions
+void Bvh::build(const std::vector<Aabb>& bounds)
+{
+    nodes.clear();
+    subtrees.clear();
+
+    indices.resize(bounds.size());
+    for ( int i = 0 ; i < (int) indices.size() ; i++ )
+        indices[i] = i;
+
+    if ( bounds.empty() )
+    {
+        root = -1;
+        return;
+    }
+
+    nodes.reserve(2 * bounds.size());
+
+    root       = build_recursive(bounds, 0, (int) bounds.size(), 0);
+    live_nodes = (int) nodes.size();
+
+    find_subtrees(MAX_SUBTREES);
+
+    built_cost = cost(root);
+}
+
+int Bvh::update( const std::vector<Aabb>& bounds,
+                 Worker_Pool& workers,
+                 int threads,
+                 float rebuild_threshold )
+{
+    if ( (root < 0) || (bounds.size() != indices.size()) )
+    {
+        build(bounds);
+        return 1;
+    }
+
+    // Subtrees bottom-up on the threads, then the nodes above them
+    std::vector<float> costs(subtrees.size());
+    std::atomic<int>   next_subtree{0};
+
+    auto worker = [&]()
+    {
+        for ( int i = next_subtree++ ; i < (int) subtrees.size() ; i = next_subtree++ )
+        {
+            refit(subtrees[i].node, bounds, false);
+            costs[i] = cost(subtrees[i].node);
+        }
+    };
+
+    int workers_count = ( (int) indices.size() >= PARALLEL_REFIT_SIZE )
+                      ? std::min(threads, (int) subtrees.size()) : 1;
+
+    workers.run(workers_count, worker);
+
+    if ( nodes[root].subtree < 0 )
+        refit(root, bounds, true);
+
+    int rebuilt = 0;
+
+    for ( int i = 0 ; i < (int) subtrees.size() ; i++ )
+    {
+        if ( costs[i] > subtrees[i].built_cost * (1.0f + rebuild_threshold) )
+        {
+            rebuild_subtree(subtrees[i], bounds);
+            rebuilt++;
+        }
+    }
+
+    // Primitives moved across subtrees, or rebuilt subtrees left too many
+    // unused nodes behind
+    if ( (cost(root) > built_cost * (1.0f + rebuild_threshold)) ||
+         ((int) nodes.size() > 2 * live_nodes) )
+    {
+        build(bounds);
+        return 1;
+    }
+
+    return rebuilt;
+}
+
+size_t Bvh::get_memory() const
+{
+    return nodes.size() * sizeof(Bvh_Node) + indices.size() * sizeof(int);
+}
+
+float Bvh::sah_cost() const
+{
+    if ( root < 0 )
+        return 0.0f;
+
+    float area = nodes[root].bounds.surface_area();
+
+    return ( area > 0.0f ) ? cost(root) / area : 0.0f;
+}
+
+int Bvh::build_recursive(const std::vector<Aabb>& bounds, int first, int count, int depth)
+{
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+
+    Aabb node_bounds;
+    Aabb centroid_bounds;
+
+    for ( int i = first ; i < first + count ; i++ )
+    {
+        const Aabb& box = bounds[indices[i]];
+        node_bounds.extend(box);
+
+        Aabb centroid;
+        for ( int axis = 0 ; axis < 3 ; axis++ )
+            centroid.min[axis] = centroid.max[axis] = box.center(axis);
+        centroid_bounds.extend(centroid);
+    }
+
+    nodes[index].bounds = node_bounds;
+
+    auto make_leaf = [&]()
+    {
+        nodes[index].left_or_first = first;
+        nodes[index].count         = count;
+        return index;
+    };
+
+    if ( (count <= 2) || (depth >= MAX_DEPTH) )
+        return make_leaf();
+
+    // Binned surface area heuristic, cost of a leaf is its primitive count
+    float best_cost = std::numeric_limits<float>::max();
+    int   best_axis = -1;
+    int   best_bin  = 0;
+
+    float node_area = std::max(node_bounds.surface_area(), std::numeric_limits<float>::min());
+
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+    {
+        float low    = centroid_bounds.min[axis];
+        float extent = centroid_bounds.max[axis] - low;
+
+        if ( extent <= 0.0f )
+            continue;
+
+        Aabb bin_bounds[BINS];
+        int  bin_count [BINS] = {};
+
+        for ( int i = first ; i < first + count ; i++ )
+        {
+            const Aabb& box = bounds[indices[i]];
+            int bin = std::min( BINS - 1, (int) ((box.center(axis) - low) / extent * BINS) );
+
+            bin_bounds[bin].extend(box);
+            bin_count[bin]++;
+        }
+
+        // Right side areas swept from the top
+        float right_area [BINS];
+        int   right_count[BINS];
+        Aabb  right_bounds;
+        int   right_total = 0;
+
+        for ( int bin = BINS - 1 ; bin > 0 ; bin-- )
+        {
+            right_bounds.extend(bin_bounds[bin]);
+            right_total += bin_count[bin];
+
+            right_area [bin] = right_bounds.surface_area();
+            right_count[bin] = right_total;
+        }
+
+        Aabb left_bounds;
+        int  left_total = 0;
+
+        for ( int bin = 1 ; bin < BINS ; bin++ )
+        {
+            left_bounds.extend(bin_bounds[bin - 1]);
+            left_total += bin_count[bin - 1];
+
+            if ( (left_total == 0) || (right_count[bin] == 0) )
+                continue;
+
+            float split_cost = TRAVERSAL_COST +
+                               ( left_bounds.surface_area() * left_total +
+                                 right_area[bin] * right_count[bin] ) / node_area;
+
+            if ( split_cost < best_cost )
+            {
+                best_cost = split_cost;
+                best_axis = axis;
+                best_bin  = bin;
+            }
+        }
+    }
+
+    int middle;
+
+    if ( best_axis >= 0 )
+    {
+        if ( (best_cost >= count) && (count <= MAX_LEAF_SIZE) )
+            return make_leaf();
+
+        float low    = centroid_bounds.min[best_axis];
+        float extent = centroid_bounds.max[best_axis] - low;
+
+        int* split = std::partition( indices.data() + first,
+                                     indices.data() + first + count,
+                                     [&](int primitive)
+        {
+            float center = bounds[primitive].center(best_axis);
+            return std::min( BINS - 1, (int) ((center - low) / extent * BINS) ) < best_bin;
+        });
+
+        middle = (int) (split - indices.data());
+    }
+    else
+    {
+        // All centroids coincide, no split separates them
+        if ( count <= MAX_LEAF_SIZE )
+            return make_leaf();
+
+        middle = first + count / 2;
+    }
+
+    int left  = build_recursive(bounds, first,  middle - first,         depth + 1);
+    int right = build_recursive(bounds, middle, first + count - middle, depth + 1);
+
+    nodes[index].left_or_first = left;
+    nodes[index].right         = right;
+
+    return index;
+}
+
+float Bvh::cost(int node) const
+{
+    const Bvh_Node& current = nodes[node];
+
+    if ( current.is_leaf() )
+        return current.bounds.surface_area() * current.count;
+
+    return current.bounds.surface_area() * TRAVERSAL_COST +
+           cost(current.left_or_first) +
+           cost(current.right);
+}
+
+void Bvh::refit(int node, const std::vector<Aabb>& bounds, bool stop_at_subtrees)
+{
+    Bvh_Node& current = nodes[node];
+
+    if ( stop_at_subtrees && (current.subtree >= 0) )
+        return;
+
+    Aabb box;
+
+    if ( current.is_leaf() )
+    {
+        for ( int i = current.left_or_first ; i < current.left_or_first + current.count ; i++ )
+            box.extend(bounds[indices[i]]);
+    }
+    else
+    {
+        refit(current.left_or_first, bounds, stop_at_subtrees);
+        refit(current.right,         bounds, stop_at_subtrees);
+
+        box = nodes[current.left_or_first].bounds;
+        box.extend(nodes[current.right].bounds);
+    }
+
+    current.bounds = box;
+}
+
+int Bvh::count_nodes(int node) const
+{
+    const Bvh_Node& current = nodes[node];
+
+    if ( current.is_leaf() )
+        return 1;
+
+    return 1 + count_nodes(current.left_or_first) + count_nodes(current.right);
+}
+
+void Bvh::rebuild_subtree(Subtree& subtree, const std::vector<Aabb>& bounds)
+{
+    // The replaced nodes stay in nodes but are no longer reachable
+    int old_nodes = (int) nodes.size() - count_nodes(subtree.node);
+
+    int node = build_recursive(bounds, subtree.first, subtree.count, subtree.depth);
+    nodes[node].subtree = nodes[subtree.node].subtree;
+
+    if ( subtree.parent < 0 )
+        root = node;
+    else if ( nodes[subtree.parent].left_or_first == subtree.node )
+        nodes[subtree.parent].left_or_first = node;
+    else
+        nodes[subtree.parent].right = node;
+
+    subtree.node       = node;
+    subtree.built_cost = cost(node);
+
+    live_nodes += (int) nodes.size() - old_nodes;
+}
+
+void Bvh::find_subtrees(int max_subtrees)
+{
+    // Expands the frontier from the root one level at a time
+    std::vector<Subtree> frontier = { Subtree{root, -1, 0, (int) indices.size(), 0, 0.0f} };
+
+    while ( (int) frontier.size() * 2 <= max_subtrees )
+    {
+        std::vector<Subtree> next;
+        bool expanded = false;
+
+        for ( const Subtree& subtree : frontier )
+        {
+            const Bvh_Node& node = nodes[subtree.node];
+
+            if ( node.is_leaf() )
+            {
+                next.push_back(subtree);
+                continue;
+            }
+
+            // The left child owns the front of the parent's range
+            int left_count = 0;
+            std::vector<int> stack = { node.left_or_first };
+
+            while ( !stack.empty() )
+            {
+                const Bvh_Node& child = nodes[stack.back()];
+                stack.pop_back();
+
+                if ( child.is_leaf() )
+                {
+                    left_count += child.count;
+                }
+                else
+                {
+                    stack.push_back(child.left_or_first);
+                    stack.push_back(child.right);
+                }
+            }
+
+            next.push_back( Subtree{ node.left_or_first, subtree.node,
+                                     subtree.first, left_count,
+                                     subtree.depth + 1, 0.0f } );
+            next.push_back( Subtree{ node.right, subtree.node,
+                                     subtree.first + left_count, subtree.count - left_count,
+                                     subtree.depth + 1, 0.0f } );
+            expanded = true;
+        }
+
+        frontier.swap(next);
+
+        if ( !expanded )
+            break;
+    }
+
+    subtrees = frontier;
+
+    for ( int i = 0 ; i < (int) subtrees.size() ; i++ )
+    {
+        nodes[subtrees[i].node].subtree = i;
+        subtrees[i].built_cost = cost(subtrees[i].node);
+    }
+}
+
+
+//  --  class Wide_Bvh  --  //
+
+// Member functions
+void Wide_Bvh::build(const Bvh& bvh)
+{
+    nodes.clear();
+    indices = bvh.indices;
+
+    if ( bvh.root < 0 )
+    {
+        bounds = Aabb();
+        return;
+    }
+
+    // Nodes of about a third of the binary interior ones
+    nodes.reserve(bvh.live_nodes / 3 + 1);
+
+    const Bvh_Node& root = bvh.nodes[bvh.root];
+    bounds = root.bounds;
+
+    if ( root.is_leaf() )
+    {
+        Slot slot = { root.bounds, bvh.root, root.left_or_first, root.count };
+        build_node(bvh, &slot, 1);
+    }
+    else
+    {
+        collapse(bvh, bvh.root);
+    }
+
+    nodes.shrink_to_fit();
+}
+
+void Wide_Bvh::build(const std::vector<Aabb>& primitive_bounds)
+{
+    Bvh bvh;
+    bvh.build(primitive_bounds);
+
+    build(bvh);
+}
+
+size_t Wide_Bvh::get_memory() const
+{
+    return nodes.size() * sizeof(Wide_Bvh_Node) + indices.size() * sizeof(int);
+}
+
+// Private member functions
+int Wide_Bvh::collapse(const Bvh& bvh, int node)
+{
+    const Bvh_Node& binary = bvh.nodes[node];
+
+    Slot slots[4];
+    int  slot_count = 0;
+
+    for ( int child : { binary.left_or_first, binary.right } )
+    {
+        const Bvh_Node& child_node = bvh.nodes[child];
+        slots[slot_count++] = Slot{ child_node.bounds, child, child_node.left_or_first, child_node.count };
+    }
+
+    // Opens the interior child with the largest surface, the one rays
+    // are most likely to enter, until four children are gathered
+    while ( slot_count < 4 )
+    {
+        int   largest      = -1;
+        float largest_area = -1.0f;
+
+        for ( int i = 0 ; i < slot_count ; i++ )
+        {
+            bool interior = ( slots[i].node >= 0 ) && !bvh.nodes[slots[i].node].is_leaf();
+
+            if ( interior && (slots[i].bounds.surface_area() > largest_area) )
+            {
+                largest      = i;
+                largest_area = slots[i].bounds.surface_area();
+            }
+        }
+
+        if ( largest < 0 )
+            break;
+
+        const Bvh_Node& opened = bvh.nodes[slots[largest].node];
+        const Bvh_Node& left   = bvh.nodes[opened.left_or_first];
+        const Bvh_Node& right  = bvh.nodes[opened.right];
+
+        slots[largest]      = Slot{ left.bounds,  opened.left_or_first, left.left_or_first,  left.count  };
+        slots[slot_count++] = Slot{ right.bounds, opened.right,         right.left_or_first, right.count };
+    }
+
+    return build_node(bvh, slots, slot_count);
+}
+
+int Wide_Bvh::build_node(const Bvh& bvh, const Slot* slots, int slot_count)
+{
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+
+    int32_t  child[4] = {};
+    uint16_t count[4] = {};
+
+    for ( int i = 0 ; i < slot_count ; i++ )
+    {
+        const Slot& slot = slots[i];
+
+        if ( (slot.node >= 0) && !bvh.nodes[slot.node].is_leaf() )
+        {
+            child[i] = collapse(bvh, slot.node);
+        }
+        else if ( slot.count <= MAX_WIDE_LEAF_SIZE )
+        {
+            child[i] = slot.first;
+            count[i] = (uint16_t) slot.count;
+        }
+        else
+        {
+            // Leaves too large for a child are split into ranges
+            Slot ranges[4];
+            int  range_size = (slot.count + 3) / 4;
+
+            for ( int r = 0 ; r < 4 ; r++ )
+            {
+                int first = slot.first + r * range_size;
+                int last  = std::min(first + range_size, slot.first + slot.count);
+
+                ranges[r] = Slot{ slot.bounds, -1, first, last - first };
+            }
+
+            child[i] = build_node(bvh, ranges, 4);
+        }
+    }
+
+    // Children were built first, they may have moved the nodes
+    Wide_Bvh_Node& node = nodes[index];
+
+    Aabb parent;
+    for ( int i = 0 ; i < slot_count ; i++ )
+        parent.extend(slots[i].bounds);
+
+    node.child_count = (uint8_t) slot_count;
+
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+    {
+        node.origin[axis] = parent.min[axis];
+        quantize_axis( node, axis, slots, slot_count,
+                       parent.min[axis], parent.max[axis] - parent.min[axis] );
+    }
+
+    std::copy(child, child + 4, node.child);
+    std::copy(count, count + 4, node.count);
+
+    return index;
+}
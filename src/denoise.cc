@@ -0,0 +1,154 @@
+#include "denoise.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace
+{
+    const float KERNEL[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    void filter_rows( const Framebuffer& guide,
+                      const std::vector<float>& src,
+                      std::vector<float>& dst,
+                      int step,
+                      float sigma_color,
+                      const Denoise_Settings& settings,
+                      int y0, int y1 )
+    {
+        const int width  = guide.get_width();
+        const int height = guide.get_height();
+
+        const float inverse_color  = 1.0f / (sigma_color * sigma_color);
+        const float inverse_albedo = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+        const float inverse_depth  = 1.0f / (settings.sigma_depth * step);
+
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            for ( int x = 0 ; x < width ; x++ )
+            {
+                size_t p = (size_t) y * width + x;
+
+                const float* c_p = &src[p * 3];
+                const float* n_p = &guide.normal[p * 3];
+                const float* a_p = &guide.albedo[p * 3];
+                float        z_p = guide.depth[p];
+
+                float sum[3]     = { 0.0f, 0.0f, 0.0f };
+                float sum_weight = 0.0f;
+
+                for ( int j = -2 ; j <= 2 ; j++ )
+                {
+                    int qy = y + j * step;
+                    if ( (qy < 0) || (qy >= height) )
+                        continue;
+
+                    for ( int i = -2 ; i <= 2 ; i++ )
+                    {
+                        int qx = x + i * step;
+                        if ( (qx < 0) || (qx >= width) )
+                            continue;
+
+                        size_t q = (size_t) qy * width + qx;
+
+                        const float* c_q = &src[q * 3];
+                        float        z_q = guide.depth[q];
+
+                        // Background only mixes with background
+                        if ( (z_p > 0.0f) != (z_q > 0.0f) )
+                            continue;
+
+                        float dc[3] = { c_p[0] - c_q[0], c_p[1] - c_q[1], c_p[2] - c_q[2] };
+                        float exponent = -(dc[0] * dc[0] + dc[1] * dc[1] + dc[2] * dc[2]) * inverse_color;
+
+                        float weight = KERNEL[i + 2] * KERNEL[j + 2];
+
+                        if ( z_p > 0.0f )
+                        {
+                            const float* n_q = &guide.normal[q * 3];
+                            const float* a_q = &guide.albedo[q * 3];
+
+                            float cosine = n_p[0] * n_q[0] + n_p[1] * n_q[1] + n_p[2] * n_q[2];
+                            if ( cosine <= 0.0f )
+                                continue;
+
+                            float da[3] = { a_p[0] - a_q[0], a_p[1] - a_q[1], a_p[2] - a_q[2] };
+
+                            exponent -= (da[0] * da[0] + da[1] * da[1] + da[2] * da[2]) * inverse_albedo;
+                            exponent -= std::abs(z_p - z_q) * inverse_depth;
+
+                            // cosine^sigma_normal folded into the same exp()
+                            exponent += std::log(cosine) * settings.sigma_normal;
+                        }
+
+                        weight *= std::exp(exponent);
+
+                        sum[0] += c_q[0] * weight;
+                        sum[1] += c_q[1] * weight;
+                        sum[2] += c_q[2] * weight;
+                        sum_weight += weight;
+                    }
+                }
+
+                // The center tap always contributes, sum_weight > 0
+                dst[p * 3 + 0] = sum[0] / sum_weight;
+                dst[p * 3 + 1] = sum[1] / sum_weight;
+                dst[p * 3 + 2] = sum[2] / sum_weight;
+            }
+        }
+    }
+}
+
+//  --  Denoising  --  //
+
+bool denoise( const Framebuffer& input,
+              Framebuffer& output,
+              const Denoise_Settings& settings,
+              Worker_Pool& workers,
+              int threads )
+{
+    if ( !input.has(AOV_DEPTH) || !input.has(AOV_NORMAL) || !input.has(AOV_ALBEDO) )
+        return false;
+
+    Trace_Scope trace_denoise("denoise");
+
+    const int width  = input.get_width();
+    const int height = input.get_height();
+
+    if ( (output.get_width() != width) || (output.get_height() != height) )
+        output.resize(width, height, AOV_NONE);
+
+    // Average of the accumulated samples
+    float scale = 1.0f / std::max(input.get_samples(), 1);
+
+    std::vector<float> src(input.color.size());
+    for ( size_t i = 0 ; i < src.size() ; i++ )
+        src[i] = input.color[i] * scale;
+
+    std::vector<float> dst(src.size());
+
+    float sigma_color = settings.sigma_color;
+
+    for ( int iteration = 0 ; iteration < settings.iterations ; iteration++ )
+    {
+        int step = 1 << iteration;
+
+        workers.run_rows(height, threads, [&](int y0, int y1)
+        {
+            filter_rows(input, src, dst, step, sigma_color, settings, y0, y1);
+        });
+
+        std::swap(src, dst);
+
+        sigma_color *= 0.5f;
+    }
+
+    output.clear();
+    output.color = src;
+    output.add_sample_pass();
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#include "dependencies.h"
+
+#include <algorithm>
+
+namespace
+{
+    void sort_unique(std::vector<int>& ids)
+    {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    }
+}
+
+
+//  --  struct Tile_Dependencies  --  //
+
+Tile_Dependencies*& Tile_Dependencies::recording()
+{
+    thread_local Tile_Dependencies* dependencies = nullptr;
+    return dependencies;
+}
+
+// Member functions
+void Tile_Dependencies::reset()
+{
+    shaded.clear();
+    occluders.clear();
+    lights.clear();
+
+    reflections = false;
+    complete    = false;
+    has_hits    = false;
+}
+
+void Tile_Dependencies::add_shaded(int shape, const Vec3& point)
+{
+    shaded.push_back(shape);
+
+    if ( !has_hits )
+    {
+        hits_min = hits_max = point;
+        has_hits = true;
+        return;
+    }
+
+    hits_min = Vec3( std::min(hits_min.x, point.x),
+                     std::min(hits_min.y, point.y),
+                     std::min(hits_min.z, point.z) );
+    hits_max = Vec3( std::max(hits_max.x, point.x),
+                     std::max(hits_max.y, point.y),
+                     std::max(hits_max.z, point.z) );
+}
+
+void Tile_Dependencies::finish()
+{
+    sort_unique(shaded);
+    sort_unique(occluders);
+    sort_unique(lights);
+}
+
+bool Tile_Dependencies::shades(int shape) const
+{
+    return std::binary_search(shaded.begin(), shaded.end(), shape);
+}
+bool Tile_Dependencies::occluded_by(int shape) const
+{
+    return std::binary_search(occluders.begin(), occluders.end(), shape);
+}
+bool Tile_Dependencies::lit_by(int light) const
+{
+    return std::binary_search(lights.begin(), lights.end(), light);
+}
+
+bool Tile_Dependencies::in_shadow_of( const Vec3& center,
+                                      float radius,
+                                      const Vec3& light_direction ) const
+{
+    if ( !has_hits )
+        return false;
+
+    // Shadow rays leave against the light direction, so the shape can only
+    // block points near the half line from its center along it
+    Vec3  hits_center = (hits_min + hits_max) * 0.5f;
+    float hits_radius = (hits_max - hits_min).length() * 0.5f;
+
+    Vec3  offset = hits_center - center;
+    float along  = std::max(0.0f, offset * light_direction);
+
+    float distance = (offset - light_direction * along).length();
+
+    return distance <= radius + hits_radius;
+}
@@ -0,0 +1,389 @@
+#include "distributed.h"
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#include "scene_io.h"
+#include "trace.h"
+
+namespace
+{
+    enum Message : sf::Uint8
+    {
+        MESSAGE_SCENE  = 1,     // width, height, tile size, binary scene
+        MESSAGE_TILES  = 2,     // job, first tile, last tile
+        MESSAGE_RESULT = 3,     // job, pixels of the tiles in order
+        MESSAGE_DONE   = 4
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job
+    {
+        int first;
+        int last;
+
+        bool done = false;
+
+        Clock::time_point issue_time;
+    };
+
+    struct Connection
+    {
+        std::unique_ptr<sf::TcpSocket> socket;
+
+        int job = -1;
+    };
+
+    // Copies the pixels of tiles [first, last) between frame and a packed buffer
+    size_t tile_pixels_size(const Raytracer& rt, int first, int last)
+    {
+        size_t size = 0;
+
+        for ( int tile = first ; tile < last ; tile++ )
+        {
+            int x0, y0, x1, y1;
+            rt.get_tile_rect(tile, x0, y0, x1, y1);
+
+            size += (size_t) (x1 - x0) * (y1 - y0) * 4;
+        }
+
+        return size;
+    }
+
+    void pack_tiles(const Raytracer& rt, int first, int last, std::string& pixels)
+    {
+        pixels.resize( tile_pixels_size(rt, first, last) );
+
+        char* dst = &pixels[0];
+
+        for ( int tile = first ; tile < last ; tile++ )
+        {
+            int x0, y0, x1, y1;
+            rt.get_tile_rect(tile, x0, y0, x1, y1);
+
+            for ( int y = y0 ; y < y1 ; y++ )
+            {
+                size_t row = (size_t) (x1 - x0) * 4;
+
+                std::memcpy(dst, rt.frame + ((size_t) y * rt.get_width() + x0) * 4, row);
+                dst += row;
+            }
+        }
+    }
+
+    bool unpack_tiles(Raytracer& rt, int first, int last, const std::string& pixels)
+    {
+        if ( pixels.size() != tile_pixels_size(rt, first, last) )
+            return false;
+
+        const char* src = pixels.data();
+
+        for ( int tile = first ; tile < last ; tile++ )
+        {
+            int x0, y0, x1, y1;
+            rt.get_tile_rect(tile, x0, y0, x1, y1);
+
+            for ( int y = y0 ; y < y1 ; y++ )
+            {
+                size_t row = (size_t) (x1 - x0) * 4;
+
+                std::memcpy(rt.frame + ((size_t) y * rt.get_width() + x0) * 4, src, row);
+                src += row;
+            }
+        }
+
+        return true;
+    }
+}
+
+//  --  class Render_Coordinator  --  //
+
+// Constructors
+Render_Coordinator::Render_Coordinator( Raytracer& _rt,
+                                        unsigned short _port,
+                                        int   _tiles_per_job,
+                                        float _reissue_seconds,
+                                        float _worker_timeout )
+    : rt{_rt} , port{_port} ,
+      tiles_per_job{ (_tiles_per_job > 0) ? _tiles_per_job : 1 } ,
+      reissue_seconds{_reissue_seconds} ,
+      worker_timeout{_worker_timeout} {}
+
+// Member functions
+bool Render_Coordinator::render()
+{
+    Trace_Scope trace_frame("distributed frame");
+
+    std::ostringstream scene;
+    if ( !write_scene_binary(scene, rt) )
+        return false;
+
+    sf::Packet scene_packet;
+    scene_packet << (sf::Uint8) MESSAGE_SCENE
+                 << (sf::Int32) rt.get_width()
+                 << (sf::Int32) rt.get_height()
+                 << (sf::Int32) rt.get_tile_size()
+                 << scene.str();
+
+    std::vector<Job>  jobs;
+    std::deque<int>   pending;
+
+    for ( int first = 0 ; first < rt.get_tile_count() ; first += tiles_per_job )
+    {
+        Job job;
+        job.first = first;
+        job.last  = std::min(first + tiles_per_job, rt.get_tile_count());
+
+        pending.push_back( (int) jobs.size() );
+        jobs.push_back(job);
+    }
+
+    int remaining = (int) jobs.size();
+
+    sf::TcpListener listener;
+    if ( listener.listen(port) != sf::Socket::Done )
+    {
+        std::cout << "Unable to listen on port " << port << "." << std::endl;
+        return false;
+    }
+
+    sf::SocketSelector selector;
+    selector.add(listener);
+
+    std::vector<Connection> connections;
+
+    auto drop = [&](Connection& connection)
+    {
+        // Give the unfinished range to the next idle worker
+        if ( (connection.job >= 0) && !jobs[connection.job].done )
+            pending.push_front(connection.job);
+
+        selector.remove(*connection.socket);
+        connection.socket->disconnect();
+        connection.socket.reset();
+    };
+
+    // Last worker connected or range returned, nothing for worker_timeout
+    // means no worker is left or none is making progress
+    Clock::time_point last_progress = Clock::now();
+
+    while ( remaining > 0 )
+    {
+        std::chrono::duration<float> idle = Clock::now() - last_progress;
+        if ( idle.count() > worker_timeout )
+            break;
+
+        if ( selector.wait(sf::seconds(0.25f)) )
+        {
+            if ( selector.isReady(listener) )
+            {
+                Connection connection;
+                connection.socket.reset(new sf::TcpSocket);
+
+                if ( listener.accept(*connection.socket) == sf::Socket::Done )
+                {
+                    if ( connection.socket->send(scene_packet) == sf::Socket::Done )
+                    {
+                        selector.add(*connection.socket);
+                        connections.push_back(std::move(connection));
+
+                        last_progress = Clock::now();
+                    }
+                }
+            }
+
+            for ( Connection& connection : connections )
+            {
+                if ( !connection.socket || !selector.isReady(*connection.socket) )
+                    continue;
+
+                sf::Packet packet;
+
+                if ( connection.socket->receive(packet) != sf::Socket::Done )
+                {
+                    drop(connection);
+                    continue;
+                }
+
+                sf::Uint8   type = 0;
+                sf::Int32   job  = -1;
+                std::string pixels;
+
+                if ( !(packet >> type >> job >> pixels) || (type != MESSAGE_RESULT) ||
+                     (job < 0) || (job >= (int) jobs.size()) )
+                {
+                    drop(connection);
+                    continue;
+                }
+
+                // Duplicates of re-issued ranges arrive late and are ignored
+                if ( !jobs[job].done && unpack_tiles(rt, jobs[job].first, jobs[job].last, pixels) )
+                {
+                    jobs[job].done = true;
+                    remaining--;
+
+                    last_progress = Clock::now();
+                }
+
+                connection.job = -1;
+            }
+        }
+
+        // Hand out work to idle workers
+        for ( Connection& connection : connections )
+        {
+            if ( !connection.socket || (connection.job >= 0) )
+                continue;
+
+            while ( !pending.empty() && jobs[pending.front()].done )
+                pending.pop_front();
+
+            int job = -1;
+
+            if ( !pending.empty() )
+            {
+                job = pending.front();
+                pending.pop_front();
+            }
+            else
+            {
+                // Speculatively re-issue the oldest overdue range
+                Clock::time_point now = Clock::now();
+
+                for ( int i = 0 ; i < (int) jobs.size() ; i++ )
+                {
+                    std::chrono::duration<float> age = now - jobs[i].issue_time;
+
+                    if ( !jobs[i].done && (age.count() > reissue_seconds) &&
+                         ( (job < 0) || (jobs[i].issue_time < jobs[job].issue_time) ) )
+                        job = i;
+                }
+            }
+
+            if ( job < 0 )
+                break;
+
+            sf::Packet packet;
+            packet << (sf::Uint8) MESSAGE_TILES
+                   << (sf::Int32) job
+                   << (sf::Int32) jobs[job].first
+                   << (sf::Int32) jobs[job].last;
+
+            connection.job       = job;
+            jobs[job].issue_time = Clock::now();
+
+            if ( connection.socket->send(packet) != sf::Socket::Done )
+                drop(connection);
+        }
+
+        // Forget closed connections
+        for ( size_t i = 0 ; i < connections.size() ; )
+        {
+            if ( !connections[i].socket )
+                connections.erase(connections.begin() + i);
+            else
+                i++;
+        }
+    }
+
+    sf::Packet done;
+    done << (sf::Uint8) MESSAGE_DONE;
+
+    for ( Connection& connection : connections )
+    {
+        connection.socket->send(done);
+        connection.socket->disconnect();
+    }
+
+    if ( remaining == 0 )
+        return true;
+
+    std::cout << "No progress from workers for " << worker_timeout << " s, rendering "
+              << remaining << " of " << jobs.size() << " tile ranges locally." << std::endl;
+
+    for ( const Job& job : jobs )
+    {
+        if ( !job.done && !rt.render_tiles(job.first, job.last) )
+            break;
+    }
+
+    return false;
+}
+
+
+//  --  Worker  --  //
+
+bool run_render_worker(const std::string& host, unsigned short port, int threads)
+{
+    sf::TcpSocket socket;
+
+    bool connected = false;
+    for ( int attempt = 0 ; (attempt < 20) && !connected ; attempt++ )
+    {
+        connected = ( socket.connect(sf::IpAddress(host), port, sf::seconds(1.0f)) == sf::Socket::Done );
+
+        if ( !connected )
+            sf::sleep(sf::seconds(0.5f));
+    }
+
+    if ( !connected )
+    {
+        std::cout << "Unable to connect to " << host << ":" << port << "." << std::endl;
+        return false;
+    }
+
+    sf::Packet  packet;
+    sf::Uint8   type = 0;
+    sf::Int32   width = 0, height = 0, tile_size = 0;
+    std::string scene;
+
+    if ( (socket.receive(packet) != sf::Socket::Done) ||
+         !(packet >> type >> width >> height >> tile_size >> scene) ||
+         (type != MESSAGE_SCENE) )
+        return false;
+
+    Raytracer rt(width, height);
+    rt.set_tile_size(tile_size);
+
+    if ( threads > 0 )
+        rt.set_threads(threads);
+
+    std::istringstream iss(scene);
+    if ( !read_scene_binary(iss, rt) )
+    {
+        std::cout << "Received a malformed scene." << std::endl;
+        return false;
+    }
+
+    std::string pixels;
+
+    while ( socket.receive(packet) == sf::Socket::Done )
+    {
+        sf::Int32 job = 0, first = 0, last = 0;
+
+        if ( !(packet >> type) || (type == MESSAGE_DONE) )
+            break;
+
+        if ( (type != MESSAGE_TILES) || !(packet >> job >> first >> last) )
+            break;
+
+        rt.render_tiles(first, last);
+        pack_tiles(rt, first, last, pixels);
+
+        sf::Packet result;
+        result << (sf::Uint8) MESSAGE_RESULT << job << pixels;
+
+        if ( socket.send(result) != sf::Socket::Done )
+            break;
+    }
+
+    return true;
+}
@@ -0,0 +1,344 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//  --  class Framebuffer  --  //
+
+// Constructors
+Framebuffer::Framebuffer(int _width, int _height, unsigned int _aovs)
+{
+    resize(_width, _height, _aovs);
+}
+
+// Member functions
+void Framebuffer::resize(int _width, int _height, unsigned int _aovs)
+{
+    width  = _width;
+    height = _height;
+    aovs   = _aovs;
+
+    size_t pixels = (size_t) width * height;
+
+    color.assign(pixels * 3, 0.0f);
+
+    depth    .assign( has(AOV_DEPTH)     ? pixels     : 0, 0.0f );
+    normal   .assign( has(AOV_NORMAL)    ? pixels * 3 : 0, 0.0f );
+    albedo   .assign( has(AOV_ALBEDO)    ? pixels * 3 : 0, 0.0f );
+    shape_id .assign( has(AOV_SHAPE_ID)  ? pixels     : 0, -1   );
+    direct   .assign( has(AOV_DIRECT)    ? pixels * 3 : 0, 0.0f );
+    reflected.assign( has(AOV_REFLECTED) ? pixels * 3 : 0, 0.0f );
+
+    samples = 0;
+}
+void Framebuffer::clear()
+{
+    std::fill(color.begin(),     color.end(),     0.0f);
+    std::fill(depth.begin(),     depth.end(),     0.0f);
+    std::fill(normal.begin(),    normal.end(),    0.0f);
+    std::fill(albedo.begin(),    albedo.end(),    0.0f);
+    std::fill(shape_id.begin(),  shape_id.end(),  -1  );
+    std::fill(direct.begin(),    direct.end(),    0.0f);
+    std::fill(reflected.begin(), reflected.end(), 0.0f);
+
+    samples = 0;
+}
+void Framebuffer::clear(int x0, int y0, int x1, int y1)
+{
+    auto clear_rows = [&](auto& channel, int components, auto value)
+    {
+        if ( channel.empty() )
+            return;
+
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            size_t index = (size_t) y * width;
+
+            std::fill( channel.begin() + (index + x0) * components,
+                       channel.begin() + (index + x1) * components,
+                       value );
+        }
+    };
+
+    clear_rows(color,     3, 0.0f);
+    clear_rows(depth,     1, 0.0f);
+    clear_rows(normal,    3, 0.0f);
+    clear_rows(albedo,    3, 0.0f);
+    clear_rows(shape_id,  1, -1  );
+    clear_rows(direct,    3, 0.0f);
+    clear_rows(reflected, 3, 0.0f);
+}
+
+void Framebuffer::accumulate(int x, int y, const Pixel_Sample& sample)
+{
+    size_t index = (size_t) y * width + x;
+
+    color[index * 3 + 0] += sample.color.red;
+    color[index * 3 + 1] += sample.color.green;
+    color[index * 3 + 2] += sample.color.blue;
+
+    if ( aovs == AOV_NONE )
+        return;
+
+    if ( has(AOV_DEPTH) )
+        depth[index] = sample.depth;
+
+    if ( has(AOV_NORMAL) )
+    {
+        normal[index * 3 + 0] = sample.normal.x;
+        normal[index * 3 + 1] = sample.normal.y;
+        normal[index * 3 + 2] = sample.normal.z;
+    }
+    if ( has(AOV_ALBEDO) )
+    {
+        albedo[index * 3 + 0] = sample.albedo.red;
+        albedo[index * 3 + 1] = sample.albedo.green;
+        albedo[index * 3 + 2] = sample.albedo.blue;
+    }
+    if ( has(AOV_SHAPE_ID) )
+        shape_id[index] = sample.shape_id;
+
+    if ( has(AOV_DIRECT) )
+    {
+        direct[index * 3 + 0] += sample.direct.red;
+        direct[index * 3 + 1] += sample.direct.green;
+        direct[index * 3 + 2] += sample.direct.blue;
+    }
+    if ( has(AOV_REFLECTED) )
+    {
+        reflected[index * 3 + 0] += sample.reflected.red;
+        reflected[index * 3 + 1] += sample.reflected.green;
+        reflected[index * 3 + 2] += sample.reflected.blue;
+    }
+}
+
+void Framebuffer::store(int x, int y, const Pixel_Sample& average)
+{
+    size_t index = (size_t) y * width + x;
+    float  scale = (float) ( (samples > 0) ? samples : 1 );
+
+    Pixel_Sample sample = average;
+    sample.color     = average.color     * scale;
+    sample.direct    = average.direct    * scale;
+    sample.reflected = average.reflected * scale;
+
+    color[index * 3 + 0] = 0.0f;
+    color[index * 3 + 1] = 0.0f;
+    color[index * 3 + 2] = 0.0f;
+
+    if ( has(AOV_DIRECT) )
+        std::fill(&direct[index * 3], &direct[index * 3] + 3, 0.0f);
+    if ( has(AOV_REFLECTED) )
+        std::fill(&reflected[index * 3], &reflected[index * 3] + 3, 0.0f);
+
+    accumulate(x, y, sample);
+}
+
+Color Framebuffer::get_color(int x, int y) const
+{
+    size_t index = ((size_t) y * width + x) * 3;
+    float  scale = 1.0f / ( (samples > 0) ? samples : 1 );
+
+    return Color( color[index + 0] * scale,
+                  color[index + 1] * scale,
+                  color[index + 2] * scale );
+}
+
+Pixel_Sample Framebuffer::get_sample(int x, int y) const
+{
+    size_t index = (size_t) y * width + x;
+    float  scale = 1.0f / ( (samples > 0) ? samples : 1 );
+
+    Pixel_Sample sample;
+    sample.color = get_color(x, y);
+
+    if ( has(AOV_DEPTH) )
+        sample.depth = depth[index];
+    if ( has(AOV_NORMAL) )
+        sample.normal = Vec3(normal[index * 3 + 0], normal[index * 3 + 1], normal[index * 3 + 2]);
+    if ( has(AOV_ALBEDO) )
+        sample.albedo = Color(albedo[index * 3 + 0], albedo[index * 3 + 1], albedo[index * 3 + 2]);
+    if ( has(AOV_SHAPE_ID) )
+        sample.shape_id = shape_id[index];
+    if ( has(AOV_DIRECT) )
+        sample.direct = Color( direct[index * 3 + 0] * scale,
+                               direct[index * 3 + 1] * scale,
+                               direct[index * 3 + 2] * scale );
+    if ( has(AOV_REFLECTED) )
+        sample.reflected = Color( reflected[index * 3 + 0] * scale,
+                                  reflected[index * 3 + 1] * scale,
+                                  reflected[index * 3 + 2] * scale );
+
+    return sample;
+}
+
+void Framebuffer::quantize( int x0, int y0, int x1, int y1,
+                            uint8_t* rgba,
+                            const std::vector<uint8_t>& lut,
+                            float exposure ) const
+{
+    const float max_index = QUANTIZE_LUT_SIZE - 1;
+    const float scale     = exposure * max_index / ( (samples > 0) ? samples : 1 );
+
+    for ( int y = y0 ; y < y1 ; y++ )
+    {
+        const float* src = &color[((size_t) y * width + x0) * 3];
+        uint8_t*     dst = rgba + ((size_t) (y - y0) * width + x0) * 4;
+
+        int x = x0;
+
+#ifdef __SSE2__
+        // Four pixels, twelve channels per iteration
+        const __m128 v_scale = _mm_set1_ps(scale);
+        const __m128 v_zero  = _mm_setzero_ps();
+        const __m128 v_max   = _mm_set1_ps(max_index);
+
+        alignas(16) int32_t index[12];
+
+        for ( ; x + 4 <= x1 ; x += 4 )
+        {
+            for ( int i = 0 ; i < 3 ; i++ )
+            {
+                __m128 value = _mm_loadu_ps(src + i * 4);
+
+                value = _mm_mul_ps(value, v_scale);
+                value = _mm_min_ps(_mm_max_ps(value, v_zero), v_max);
+
+                _mm_store_si128((__m128i*) (index + i * 4), _mm_cvttps_epi32(value));
+            }
+
+            for ( int i = 0 ; i < 4 ; i++ )
+            {
+                dst[0] = lut[index[i * 3 + 0]];
+                dst[1] = lut[index[i * 3 + 1]];
+                dst[2] = lut[index[i * 3 + 2]];
+                dst[3] = 0xFF;
+
+                dst += 4;
+            }
+
+            src += 12;
+        }
+#endif
+
+        for ( ; x < x1 ; x++ )
+        {
+            for ( int i = 0 ; i < 3 ; i++ )
+            {
+                // NaN goes to 0 as with _mm_max_ps() above, the conversion
+                // of NaN or out of range values to int is undefined
+                float value = src[i] * scale;
+                value = !( value > 0.0f ) ? 0.0f : ( value > max_index ) ? max_index : value;
+
+                dst[i] = lut[(int) value];
+            }
+            dst[3] = 0xFF;
+
+            src += 3;
+            dst += 4;
+        }
+    }
+}
+
+bool Framebuffer::write_pfm(const std::string& filename, Aov aov) const
+{
+    const std::vector<float>* channel = nullptr;
+    int  channels = 3;
+    bool average  = false;
+
+    std::vector<float> ids;
+
+    switch ( aov )
+    {
+        case AOV_DEPTH     : channel = &depth;     channels = 1; break;
+        case AOV_NORMAL    : channel = &normal;    break;
+        case AOV_ALBEDO    : channel = &albedo;    break;
+        case AOV_DIRECT    : channel = &direct;    average = true; break;
+        case AOV_REFLECTED : channel = &reflected; average = true; break;
+        case AOV_SHAPE_ID  :
+            ids.assign(shape_id.begin(), shape_id.end());
+            channel  = &ids;
+            channels = 1;
+            break;
+        default : break;
+    }
+
+    if ( (channel == nullptr) || !has(aov) )
+        return false;
+
+    std::ofstream ofs(filename, std::ios::binary);
+
+    if ( !ofs.is_open() )
+        return false;
+
+    // Negative scale marks little endian data, rows are stored bottom up
+    ofs << ( (channels == 3) ? "PF" : "Pf" ) << "\n" << width << " " << height << "\n-1.0\n";
+
+    float scale = ( average && (samples > 0) ) ? 1.0f / samples : 1.0f;
+
+    std::vector<float> row((size_t) width * channels);
+
+    for ( int y = height - 1 ; y >= 0 ; y-- )
+    {
+        for ( size_t i = 0 ; i < row.size() ; i++ )
+            row[i] = (*channel)[(size_t) y * width * channels + i] * scale;
+
+        ofs.write((const char*) row.data(), row.size() * sizeof(float));
+    }
+
+    return (bool) ofs;
+}
+
+bool Framebuffer::write_color_pfm(const std::string& filename) const
+{
+    std::ofstream ofs(filename, std::ios::binary);
+
+    if ( !ofs.is_open() )
+        return false;
+
+    ofs << "PF\n" << width << " " << height << "\n-1.0\n";
+
+    std::vector<float> row((size_t) width * 3);
+
+    for ( int y = height - 1 ; y >= 0 ; y-- )
+    {
+        for ( int x = 0 ; x < width ; x++ )
+        {
+            Color pixel = get_color(x, y);
+
+            row[x * 3 + 0] = pixel.red;
+            row[x * 3 + 1] = pixel.green;
+            row[x * 3 + 2] = pixel.blue;
+        }
+
+        ofs.write((const char*) row.data(), row.size() * sizeof(float));
+    }
+
+    return (bool) ofs;
+}
+
+
+//  --  Helper functions  --  //
+
+std::vector<uint8_t> make_gamma_lut(float gamma)
+{
+    std::vector<uint8_t> lut(QUANTIZE_LUT_SIZE);
+
+    float inverse_gamma = 1.0f / gamma;
+
+    // Entries hold the center of their input range
+    for ( int i = 0 ; i < QUANTIZE_LUT_SIZE ; i++ )
+    {
+        float value = std::pow( (i + 0.5f) / (QUANTIZE_LUT_SIZE - 1), inverse_gamma );
+        value = ( value > 1.0f ) ? 1.0f : value;
+
+        lut[i] = (uint8_t) (value * 255.0f);
+    }
+
+    return lut;
+}
@@ -0,0 +1,65 @@
+#include "heatmap.h"
+
+#include <algorithm>
+
+#include "image.h"
+
+//  --  class Heatmap  --  //
+
+// Constructors
+Heatmap::Heatmap(int _width, int _height)
+    : width{_width} , height{_height} ,
+      tests(_width * _height) , steps(_width * _height) ,
+      rays(_width * _height)  , nanoseconds(_width * _height) {}
+
+// Member functions
+void Heatmap::record( int x, int y,
+                      const Render_Counters& before,
+                      const Render_Counters& after,
+                      uint32_t elapsed_ns )
+{
+    int index = y * width + x;
+
+    tests[index] = (after.shape_tests    - before.shape_tests) +
+                   (after.triangle_tests - before.triangle_tests);
+
+    steps[index] = after.traversal_steps - before.traversal_steps;
+
+    rays[index] = after.total_rays() - before.total_rays();
+
+    nanoseconds[index] = elapsed_ns;
+}
+
+bool Heatmap::write(const std::string& prefix) const
+{
+    bool ok = true;
+
+    ok &= write_channel(prefix + "_tests.ppm", tests,       width, height);
+    ok &= write_channel(prefix + "_steps.ppm", steps,       width, height);
+    ok &= write_channel(prefix + "_rays.ppm",  rays,        width, height);
+    ok &= write_channel(prefix + "_time.ppm",  nanoseconds, width, height);
+
+    return ok;
+}
+
+bool Heatmap::write_channel( const std::string& filename,
+                             const std::vector<uint32_t>& values,
+                             int width,
+                             int height )
+{
+    // Normalize against the 99th percentile so a few outliers
+    // do not flatten the rest of the image
+    std::vector<uint32_t> sorted(values);
+    size_t percentile = (sorted.size() * 99) / 100;
+
+    std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+
+    float scale = ( sorted[percentile] > 0 ) ? 1.0f / sorted[percentile] : 0.0f;
+
+    std::vector<uint8_t> image(values.size() * 4);
+
+    for ( size_t i = 0 ; i < values.size() ; i++ )
+        false_color(values[i] * scale, &image[i * 4]);
+
+    return write_ppm(filename, image.data(), width, height);
+}
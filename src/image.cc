@@ -0,0 +1,272 @@
+#include "image.h"
+
+#include "trace.h"
+
+//  --  Helper functions  --  //
+
+bool write_ppm( const std::string& filename,
+                const uint8_t* rgba,
+                int width,
+                int height )
+{
+    std::ofstream ofs(filename, std::ios::binary);
+
+    if ( !ofs.is_open() )
+        return false;
+
+    ofs << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> row(width * 3);
+
+    for ( int y = 0 ; y < height ; y++ )
+    {
+        const uint8_t* src = rgba + (size_t) y * width * 4;
+
+        for ( int x = 0 ; x < width ; x++ )
+        {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+
+        ofs.write((const char*) row.data(), row.size());
+    }
+
+    return (bool) ofs;
+}
+
+void false_color(float value, uint8_t* rgba)
+{
+    static const float ramp[5][3] = { { 0.0f, 0.0f, 1.0f },
+                                      { 0.0f, 1.0f, 1.0f },
+                                      { 0.0f, 1.0f, 0.0f },
+                                      { 1.0f, 1.0f, 0.0f },
+                                      { 1.0f, 0.0f, 0.0f } };
+
+    value = ( value < 0.0f ) ? 0.0f : ( value > 1.0f ) ? 1.0f : value;
+
+    float position = value * 4.0f;
+    int   index    = ( position >= 4.0f ) ? 3 : (int) position;
+    float t        = position - index;
+
+    for ( int c = 0 ; c < 3 ; c++ )
+    {
+        float channel = ramp[index][c] + (ramp[index + 1][c] - ramp[index][c]) * t;
+        rgba[c] = (uint8_t) (channel * 255.0f);
+    }
+
+    rgba[3] = 0xFF;
+}
+
+
+//  --  class Ppm_Stream  --  //
+
+// Constructors
+Ppm_Stream::Ppm_Stream( const std::string& filename,
+                        int _width,
+                        int _height,
+                        int _band_rows,
+                        int _buffers )
+    : ofs{filename, std::ios::binary} ,
+      width{_width} , height{_height} , band_rows{_band_rows}
+{
+    if ( !ofs.is_open() )
+        return;
+
+    ofs << "P6\n" << width << " " << height << "\n255\n";
+
+    buffers.resize(_buffers > 0 ? _buffers : 1);
+
+    for ( std::vector<uint8_t>& buffer : buffers )
+    {
+        buffer.resize((size_t) width * band_rows * 4);
+        free_bands.push_back(buffer.data());
+    }
+
+    writer = std::thread(&Ppm_Stream::write_loop, this);
+}
+// Destructor
+Ppm_Stream::~Ppm_Stream()
+{
+    close();
+}
+
+// Member functions
+uint8_t* Ppm_Stream::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return !free_bands.empty(); });
+
+    uint8_t* band = free_bands.front();
+    free_bands.pop_front();
+
+    return band;
+}
+
+void Ppm_Stream::submit(uint8_t* band, int rows)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued_bands.push_back( std::make_pair(band, rows) );
+    }
+    condition.notify_all();
+}
+
+bool Ppm_Stream::close()
+{
+    if ( writer.joinable() )
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        condition.notify_all();
+
+        writer.join();
+        ofs.close();
+    }
+
+    return !failed && !ofs.fail();
+}
+
+void Ppm_Stream::write_loop()
+{
+    Trace::set_thread_name("image writer");
+
+    std::vector<uint8_t> row(width * 3);
+
+    while ( true )
+    {
+        std::pair<uint8_t*,int> band;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return closing || !queued_bands.empty(); });
+
+            if ( queued_bands.empty() )
+                return;
+
+            band = queued_bands.front();
+            queued_bands.pop_front();
+        }
+
+        {
+            Trace_Scope trace_write("band write");
+
+            for ( int y = 0 ; y < band.second ; y++ )
+            {
+                const uint8_t* src = band.first + (size_t) y * width * 4;
+
+                for ( int x = 0 ; x < width ; x++ )
+                {
+                    row[x * 3 + 0] = src[x * 4 + 0];
+                    row[x * 3 + 1] = src[x * 4 + 1];
+                    row[x * 3 + 2] = src[x * 4 + 2];
+                }
+
+                ofs.write((const char*) row.data(), row.size());
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            failed |= !ofs;
+            free_bands.push_back(band.first);
+        }
+        condition.notify_all();
+    }
+}
+
+
+//  --  class Ppm_Writer  --  //
+
+// Constructors
+Ppm_Writer::Ppm_Writer(int _width, int _height, int _buffers)
+    : width{_width} , height{_height}
+{
+    buffers.resize(_buffers > 0 ? _buffers : 1);
+
+    for ( std::vector<uint8_t>& buffer : buffers )
+    {
+        buffer.resize((size_t) width * height * 4);
+        free_frames.push_back(buffer.data());
+    }
+
+    writer = std::thread(&Ppm_Writer::write_loop, this);
+}
+// Destructor
+Ppm_Writer::~Ppm_Writer()
+{
+    close();
+}
+
+// Member functions
+uint8_t* Ppm_Writer::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return !free_frames.empty(); });
+
+    uint8_t* frame = free_frames.front();
+    free_frames.pop_front();
+
+    return frame;
+}
+
+void Ppm_Writer::submit(uint8_t* frame, const std::string& filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued_frames.push_back( std::make_pair(frame, filename) );
+    }
+    condition.notify_all();
+}
+
+bool Ppm_Writer::close()
+{
+    if ( writer.joinable() )
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        condition.notify_all();
+
+        writer.join();
+    }
+
+    return !failed;
+}
+
+void Ppm_Writer::write_loop()
+{
+    Trace::set_thread_name("image writer");
+
+    while ( true )
+    {
+        std::pair<uint8_t*,std::string> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return closing || !queued_frames.empty(); });
+
+            if ( queued_frames.empty() )
+                return;
+
+            frame = queued_frames.front();
+            queued_frames.pop_front();
+        }
+
+        bool ok;
+        {
+            Trace_Scope trace_write("frame write");
+            ok = write_ppm(frame.second, frame.first, width, height);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            failed |= !ok;
+            free_frames.push_back(frame.first);
+        }
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,147 @@
+#include "job.h"
+
+#include <sstream>
+#include <vector>
+
+#include "assets.h"
+#include "scenes.h"
+
+namespace
+{
+    // Builds the scene, leaves placeholders of assets to load_job()
+    bool read_job( std::istream& is,
+                   Mesh_Cache& meshes,
+                   Render_Job& job,
+                   std::string& error,
+                   Asset_Loader* assets )
+    {
+        std::vector<std::string> lines;
+        std::string line;
+
+        int width  = 800;
+        int height = 600;
+
+        // The frame size is needed before anything can be added
+        while ( std::getline(is, line) )
+        {
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream iss(line);
+            std::string statement;
+
+            if ( !(iss >> statement) )
+                continue;
+
+            if ( statement == "size" )
+            {
+                if ( !(iss >> width >> height) || (width <= 0) || (height <= 0) ||
+                     ((long long) width * height > (1 << 26)) )
+                {
+                    error = "bad size: " + line;
+                    return false;
+                }
+            }
+            else
+            {
+                lines.push_back(line);
+            }
+        }
+
+        job.rt.reset(new Raytracer(width, height));
+        Raytracer& rt = *job.rt;
+
+        // Runs of scene statements are read together, so their meshes load
+        // in parallel
+        std::string scene;
+
+        auto read_scene = [&]()
+        {
+            std::istringstream scene_stream(scene);
+            scene.clear();
+
+            return read_scene_text(scene_stream, rt, error, &meshes, "", assets);
+        };
+
+        for ( const std::string& statement_line : lines )
+        {
+            std::istringstream iss(statement_line);
+            std::string statement;
+            iss >> statement;
+
+            if ( (statement != "priority") && (statement != "spp") && (statement != "scene") )
+            {
+                scene += statement_line + "\n";
+                continue;
+            }
+
+            if ( !read_scene() )
+                return false;
+
+            bool ok = true;
+
+            if ( statement == "priority" )
+            {
+                ok = (iss >> job.priority) && (job.priority > 0) &&
+                     (job.priority <= Render_Scheduler::MAX_PRIORITY);
+            }
+            else if ( statement == "spp" )
+            {
+                int samples;
+                ok = (iss >> samples) && (samples > 0) && (samples <= MAX_JOB_SAMPLES);
+
+                if ( ok )
+                    rt.set_samples_per_pixel(samples);
+            }
+            else
+            {
+                std::string name;
+                ok = (bool) (iss >> name);
+
+                if ( name == "default" )
+                    scene_default(rt);
+                else if ( name == "mesh" )
+                    scene_mesh(rt);
+                else
+                    ok = false;
+            }
+
+            if ( !ok )
+            {
+                error = "bad statement: " + statement_line;
+                return false;
+            }
+        }
+
+        return read_scene();
+    }
+}
+
+
+//  --  Helper functions  --  //
+
+bool load_job( std::istream& is,
+               Mesh_Cache& meshes,
+               Render_Job& job,
+               std::string& error,
+               Asset_Loader* assets )
+{
+    bool ok = read_job(is, meshes, job, error, assets);
+
+    // Placeholders of a shared loader are filled in even when the job
+    // failed, so none is left behind pointing into a deleted scene
+    if ( (assets != nullptr) && job.rt )
+    {
+        std::vector<std::string> failed;
+
+        assets->wait(*job.rt);
+        assets->apply(*job.rt, &failed);
+
+        if ( ok && !failed.empty() )
+        {
+            error = "unable to read mesh: " + failed.front();
+            ok    = false;
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,66 @@
+#include "orbit.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const float MAX_PITCH    = 1.5f;
+    const float MIN_DISTANCE = 0.01f;
+}
+
+//  --  class Orbit_Camera  --  //
+
+// Constructors
+Orbit_Camera::Orbit_Camera(const Vec3& _target, float _distance, float _yaw, float _pitch)
+    : target{_target} , distance{_distance} , yaw{_yaw} , pitch{_pitch} {}
+
+Orbit_Camera Orbit_Camera::from_camera(const Camera& camera, float distance)
+{
+    Vec3 forward = camera.get_forward();
+
+    float yaw   = std::atan2(forward.x, forward.z);
+    float pitch = std::asin(std::max(-1.0f, std::min(1.0f, -forward.y)));
+
+    return Orbit_Camera(camera.get_position() + forward * distance, distance, yaw, pitch);
+}
+
+// Member functions
+void Orbit_Camera::orbit(float delta_yaw, float delta_pitch)
+{
+    yaw  += delta_yaw;
+    pitch = std::max(-MAX_PITCH, std::min(MAX_PITCH, pitch + delta_pitch));
+}
+
+void Orbit_Camera::pan(float delta_right, float delta_up)
+{
+    Camera camera;
+    apply(camera);
+
+    target += camera.get_right() * (delta_right * distance);
+    target += camera.get_up()    * (delta_up    * distance);
+}
+
+void Orbit_Camera::zoom(float factor)
+{
+    distance = std::max(MIN_DISTANCE, distance * factor);
+}
+
+Vec3 Orbit_Camera::get_forward() const
+{
+    // Positive pitch looks down on the target
+    return Vec3(  std::sin(yaw) * std::cos(pitch),
+                 -std::sin(pitch),
+                  std::cos(yaw) * std::cos(pitch) );
+}
+
+Vec3 Orbit_Camera::get_position() const
+{
+    return target - get_forward() * distance;
+}
+
+void Orbit_Camera::apply(Camera& camera) const
+{
+    camera.set_position(get_position());
+    camera.set_orientation(get_forward(), Vec3(0.0f, 1.0f, 0.0f));
+}
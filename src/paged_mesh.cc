@@ -0,0 +1,638 @@
+#include "paged_mesh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace
+{
+    const char MAGIC[8] = { 'R', 'T', 'C', 'L', 'U', 'S', 'T', '\0' };
+
+    // Clusters of a damaged file should not allocate gigabytes up front
+    const uint32_t MAX_CLUSTER_COUNT = 1u << 24;
+
+    // Nine floats of vertices per triangle
+    const uint64_t TRIANGLE_BYTES = 9 * sizeof(float);
+
+    template < typename T >
+    void put(std::ostream& os, const T& value)
+    {
+        os.write((const char*) &value, sizeof(T));
+    }
+    void put(std::ostream& os, const Vec3& value)
+    {
+        put(os, value.x);
+        put(os, value.y);
+        put(os, value.z);
+    }
+
+    template < typename T >
+    bool get(std::istream& is, T& value)
+    {
+        return (bool) is.read((char*) &value, sizeof(T));
+    }
+
+    // Interleaves the low 10 bits of v with two zero bits each
+    uint32_t spread_bits(uint32_t v)
+    {
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v <<  8)) & 0x0300F00F;
+        v = (v | (v <<  4)) & 0x030C30C3;
+        v = (v | (v <<  2)) & 0x09249249;
+        return v;
+    }
+
+    uint32_t morton_code(const Vec3& point, const Vec3& min, const Vec3& scale)
+    {
+        auto cell = [](float value, float lo, float s)
+        {
+            float f = (value - lo) * s;
+            return (uint32_t) std::min(std::max(f, 0.0f), 1023.0f);
+        };
+
+        return ( spread_bits(cell(point.x, min.x, scale.x)) << 2 ) |
+               ( spread_bits(cell(point.y, min.y, scale.y)) << 1 ) |
+               ( spread_bits(cell(point.z, min.z, scale.z))      );
+    }
+
+    // What a resident cluster takes
+    size_t cluster_bytes(const Mesh& mesh)
+    {
+        return sizeof(Mesh) + mesh.get_memory();
+    }
+}
+
+
+//  --  struct Page_Faults  --  //
+
+Page_Faults& Page_Faults::local()
+{
+    static thread_local Page_Faults faults;
+    return faults;
+}
+
+
+//  --  class Cluster_File  --  //
+
+// Constructors
+Cluster_File::Cluster_File(Cluster_Cache* _cache, const std::string& _filename)
+    : cache{_cache}, filename{_filename}, stream{_filename, std::ios::binary}
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t cluster_count;
+
+    if ( !stream.read(magic, sizeof(magic)) || (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) ||
+         !get(stream, version) || (version != CLUSTER_FILE_VERSION) ||
+         !get(stream, cluster_count) || (cluster_count > MAX_CLUSTER_COUNT) ||
+         !get(stream, triangle_count) )
+    {
+        return;
+    }
+
+    std::vector<Cluster> table(cluster_count);
+
+    for ( Cluster& cluster : table )
+    {
+        // Written without overflow, first and count are untrusted
+        if ( !get(stream, cluster.bounds.min) || !get(stream, cluster.bounds.max) ||
+             !get(stream, cluster.first) || !get(stream, cluster.count) ||
+             (cluster.first > triangle_count) || (cluster.count > triangle_count - cluster.first) )
+        {
+            return;
+        }
+    }
+
+    data_offset = (uint64_t) stream.tellg();
+
+    // The triangles have to be in the file, so no cluster reads past its
+    // end or allocates more than the file holds
+    if ( !stream.seekg(0, std::ios::end) )
+        return;
+
+    uint64_t file_size = (uint64_t) stream.tellg();
+
+    if ( (file_size < data_offset) || (triangle_count > (file_size - data_offset) / TRIANGLE_BYTES) )
+        return;
+
+    clusters = std::move(table);
+    slots.reset(new Slot[clusters.size()]);
+}
+// Destructor
+Cluster_File::~Cluster_File()
+{
+    if ( is_open() )
+        cache->release(*this);
+}
+
+// Member functions
+bool Cluster_File::read(int cluster, std::vector<Triangle>& triangles)
+{
+    const Cluster& info = clusters[cluster];
+
+    std::vector<float> vertices((size_t) info.count * 9);
+
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+
+        stream.clear();
+        stream.seekg( (std::streamoff) (data_offset + info.first * TRIANGLE_BYTES) );
+
+        if ( !stream.read((char*) vertices.data(), vertices.size() * sizeof(float)) )
+            return false;
+    }
+
+    triangles.clear();
+    triangles.reserve(info.count);
+
+    for ( size_t i = 0 ; i < vertices.size() ; i += 9 )
+    {
+        const float* v = &vertices[i];
+        triangles.push_back( Triangle( Vec3(v[0], v[1], v[2]),
+                                       Vec3(v[3], v[4], v[5]),
+                                       Vec3(v[6], v[7], v[8]) ) );
+    }
+
+    return true;
+}
+
+
+//  --  class Cluster_Cache  --  //
+
+// Constructors
+Cluster_Cache::Cluster_Cache(size_t _capacity)
+    : capacity{_capacity}
+{
+    loader = std::thread( [this]()
+    {
+        Trace::set_thread_name("cluster loader");
+        work_loop();
+    });
+}
+// Destructor
+Cluster_Cache::~Cluster_Cache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    condition.notify_all();
+
+    loader.join();
+}
+
+// Member functions
+Cluster_Cache& Cluster_Cache::shared()
+{
+    static Cluster_Cache cache;
+    return cache;
+}
+
+std::shared_ptr<Cluster_File> Cluster_Cache::open(const std::string& filename)
+{
+    std::shared_ptr<Cluster_File> file = std::make_shared<Cluster_File>(this, filename);
+
+    if ( !file->is_open() )
+        return nullptr;
+
+    return file;
+}
+
+std::shared_ptr<const Mesh> Cluster_Cache::acquire( const std::shared_ptr<Cluster_File>& file,
+                                                    int cluster,
+                                                    bool wait )
+{
+    Cluster_File::Slot& slot = file->slots[cluster];
+
+    std::shared_ptr<const Mesh> mesh = std::atomic_load(&slot.mesh);
+
+    if ( mesh )
+    {
+        // Most uses find the stamp current, only the first after a load writes
+        uint64_t now = clock.load(std::memory_order_relaxed);
+
+        if ( slot.last_use.load(std::memory_order_relaxed) != now )
+            slot.last_use.store(now, std::memory_order_relaxed);
+
+        return mesh;
+    }
+
+    if ( !wait )
+    {
+        if ( slot.state.load() != Cluster_File::ABSENT )
+            return nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if ( slot.state != Cluster_File::ABSENT )
+                return nullptr;
+
+            slot.state = Cluster_File::QUEUED;
+            queue.push_back( Request{ file, cluster } );
+        }
+        condition.notify_one();
+
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while ( true )
+    {
+        mesh = std::atomic_load(&slot.mesh);
+
+        if ( mesh )
+            return mesh;
+
+        // Queued ones are taken over, the loader thread skips them then
+        if ( (slot.state == Cluster_File::ABSENT) || (slot.state == Cluster_File::QUEUED) )
+        {
+            slot.state = Cluster_File::LOADING;
+            lock.unlock();
+
+            return load(*file, cluster);
+        }
+
+        loaded.wait(lock);
+    }
+}
+
+void Cluster_Cache::set_capacity(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    capacity = bytes;
+    evict();
+}
+
+size_t Cluster_Cache::get_capacity()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return capacity;
+}
+
+size_t Cluster_Cache::get_size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return size;
+}
+
+uint64_t Cluster_Cache::get_loads()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return loads;
+}
+
+uint64_t Cluster_Cache::get_evictions()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return evictions;
+}
+
+// Private member functions
+std::shared_ptr<const Mesh> Cluster_Cache::load(Cluster_File& file, int cluster)
+{
+    Trace_Scope trace_load("cluster load", cluster);
+
+    std::vector<Triangle> triangles;
+
+    // A cluster that cannot be read stays empty rather than being retried
+    // by every ray
+    if ( !file.read(cluster, triangles) )
+    {
+        std::cout << "Unable to read cluster " << cluster << " of \""
+                  << file.get_filename() << "\"." << std::endl;
+        triangles.clear();
+    }
+
+    std::shared_ptr<const Mesh> mesh = std::make_shared<Mesh>(std::move(triangles));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Cluster_File::Slot& slot = file.slots[cluster];
+
+        std::atomic_store(&slot.mesh, mesh);
+        slot.state = Cluster_File::RESIDENT;
+        slot.bytes = cluster_bytes(*mesh);
+        slot.last_use.store(clock++);
+
+        size += slot.bytes;
+        loads++;
+
+        resident.push_back( Resident{ &file, cluster } );
+        evict();
+    }
+    loaded.notify_all();
+
+    return mesh;
+}
+
+void Cluster_Cache::evict()
+{
+    if ( size <= capacity )
+        return;
+
+    std::sort( resident.begin(), resident.end(), [](const Resident& a, const Resident& b)
+    {
+        return a.file->slots[a.cluster].last_use.load(std::memory_order_relaxed) <
+               b.file->slots[b.cluster].last_use.load(std::memory_order_relaxed);
+    });
+
+    size_t target  = capacity / 8 * 7;
+    size_t evicted = 0;
+
+    while ( (evicted < resident.size()) && (size > target) )
+    {
+        const Resident& oldest = resident[evicted++];
+        Cluster_File::Slot& slot = oldest.file->slots[oldest.cluster];
+
+        // Rays still using it keep it alive until they are done
+        std::atomic_store(&slot.mesh, std::shared_ptr<const Mesh>());
+        slot.state = Cluster_File::ABSENT;
+
+        size -= slot.bytes;
+        evictions++;
+    }
+
+    resident.erase(resident.begin(), resident.begin() + evicted);
+}
+
+void Cluster_Cache::release(Cluster_File& file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto first = std::remove_if( resident.begin(), resident.end(), [&](const Resident& entry)
+    {
+        if ( entry.file != &file )
+            return false;
+
+        size -= file.slots[entry.cluster].bytes;
+        return true;
+    });
+
+    resident.erase(first, resident.end());
+}
+
+void Cluster_Cache::work_loop()
+{
+    while ( true )
+    {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+            if ( stopping )
+                return;
+
+            request = std::move(queue.front());
+            queue.pop_front();
+
+            Cluster_File::Slot& slot = request.file->slots[request.cluster];
+
+            // Taken over by a thread that could not wait
+            if ( slot.state != Cluster_File::QUEUED )
+                continue;
+
+            slot.state = Cluster_File::LOADING;
+        }
+
+        load(*request.file, request.cluster);
+    }
+}
+
+
+//  --  class Paged_Mesh  --  //
+
+// Constructors
+Paged_Mesh::Paged_Mesh( const std::string& filename,
+                        const Vec3& position,
+                        Cluster_Cache* _cache )
+    : cache{ _cache ? _cache : &Cluster_Cache::shared() }, offset{position}
+{
+    file = cache->open(filename);
+
+    if ( !file )
+    {
+        std::cout << "Unable to open cluster file \"" << filename << "\"." << std::endl;
+        return;
+    }
+
+    std::vector<Aabb> bounds;
+    for ( const Cluster_File::Cluster& cluster : file->get_clusters() )
+        bounds.push_back(cluster.bounds);
+
+    bvh.build(bounds);
+}
+
+// Member functions
+const std::string& Paged_Mesh::get_filename() const
+{
+    static const std::string none;
+    return file ? file->get_filename() : none;
+}
+
+uint64_t Paged_Mesh::get_triangle_count() const
+{
+    return file ? file->get_triangle_count() : 0;
+}
+
+// Override functions
+float Paged_Mesh::intersect (const Ray& ray) const
+{
+    const Shape* surface;
+    return intersect(ray, surface);
+}
+
+float Paged_Mesh::intersect (const Ray& ray, const Shape*& surface) const
+{
+    float closest_depth = std::numeric_limits<float>::max();
+    int   closest_index = -1;
+
+    std::shared_ptr<const Mesh> closest_cluster;
+    const Shape*                closest_surface = this;
+
+    surface = this;
+
+    if ( !file )
+        return closest_depth;
+
+    Render_Counters& counters = Render_Stats::local();
+    Page_Faults&     faults   = Page_Faults::local();
+
+    // Clusters keep the coordinates of the file
+    Ray local = ray;
+    local.ori = ray.ori - offset;
+
+    // Clusters only know their own bounds, rays leaving the surface of the
+    // mesh see all of them in full so it never shadows a copy of itself
+    const Aabb& bounds = bvh.get_bounds();
+    const float origin[3] = { local.ori.x, local.ori.y, local.ori.z };
+
+    bool inside = true;
+    for ( int axis = 0 ; axis < 3 ; axis++ )
+        inside = inside && (origin[axis] >= bounds.min[axis]) && (origin[axis] <= bounds.max[axis]);
+
+    if ( inside )
+    {
+        local.footprint = 0.0f;
+        local.spread    = 0.0f;
+    }
+
+    // Equal depths go to the lowest cluster, as if testing in order
+    counters.traversal_steps += bvh.traverse( local.ori, local.dir, closest_depth, [&](int i)
+    {
+        std::shared_ptr<const Mesh> cluster = cache->acquire(file, i, !faults.defer);
+
+        if ( !cluster )
+        {
+            faults.missed++;
+            return;
+        }
+
+        const Shape* cluster_surface;
+        float depth = cluster->intersect(local, cluster_surface);
+
+        if ( ( depth > 0.0001f ) &&
+             ( ( depth < closest_depth ) || ( ( depth == closest_depth ) && ( i < closest_index ) ) ) )
+        {
+            closest_depth   = depth;
+            closest_index   = i;
+            closest_cluster = std::move(cluster);
+            closest_surface = cluster_surface;
+        }
+    });
+
+    // The triangle reported has to outlive an eviction of its cluster
+    if ( closest_cluster )
+    {
+        faults.pins.push_back(std::move(closest_cluster));
+        surface = closest_surface;
+    }
+
+    return closest_depth;
+}
+
+Vec3  Paged_Mesh::get_normal(const Vec3& /*point*/) const
+{
+    // Only the surfaces from intersect() know their normal, searching
+    // the file for the closest triangle would page it all in
+    return Vec3(0.0f, 1.0f, 0.0f);
+}
+
+bool  Paged_Mesh::get_bounds(Vec3& min, Vec3& max) const
+{
+    if ( bvh.empty() )
+        return false;
+
+    min = bvh.get_bounds().get_min() + offset;
+    max = bvh.get_bounds().get_max() + offset;
+
+    return true;
+}
+
+Vec3  Paged_Mesh::get_position() const
+{
+    Vec3 min, max;
+
+    if ( !get_bounds(min, max) )
+        return offset;
+
+    return (min + max) * 0.5f;
+}
+
+void  Paged_Mesh::translate(const Vec3& _offset)
+{
+    offset += _offset;
+}
+
+
+//  --  Helper functions  --  //
+
+bool write_clusters( const std::vector<Triangle>& triangles,
+                     const std::string& filename,
+                     int cluster_triangles )
+{
+    if ( triangles.empty() || (cluster_triangles <= 0) )
+        return false;
+
+    // Sorted along a Morton curve through the centroids, so consecutive
+    // triangles, and with them the clusters, are close together
+    Aabb centroids;
+    for ( const Triangle& triangle : triangles )
+    {
+        Vec3 center = triangle.get_position();
+        centroids.extend( Aabb(center, center) );
+    }
+
+    Vec3 min    = centroids.get_min();
+    Vec3 extent = centroids.get_max() - min;
+    Vec3 scale( extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+                extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+                extent.z > 0.0f ? 1023.0f / extent.z : 0.0f );
+
+    std::vector<uint32_t> codes(triangles.size());
+    for ( size_t i = 0 ; i < triangles.size() ; i++ )
+        codes[i] = morton_code(triangles[i].get_position(), min, scale);
+
+    std::vector<uint32_t> order(triangles.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort( order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        return codes[a] < codes[b];
+    });
+
+    std::vector<Cluster_File::Cluster> clusters;
+
+    for ( size_t first = 0 ; first < order.size() ; first += cluster_triangles )
+    {
+        Cluster_File::Cluster cluster;
+        cluster.first = first;
+        cluster.count = (uint32_t) std::min(order.size() - first, (size_t) cluster_triangles);
+
+        for ( size_t i = first ; i < first + cluster.count ; i++ )
+        {
+            Vec3 tri_min, tri_max;
+            triangles[order[i]].get_bounds(tri_min, tri_max);
+            cluster.bounds.extend( Aabb(tri_min, tri_max) );
+        }
+
+        clusters.push_back(cluster);
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+
+    if ( !ofs.is_open() )
+        return false;
+
+    ofs.write(MAGIC, sizeof(MAGIC));
+    put(ofs, CLUSTER_FILE_VERSION);
+    put(ofs, (uint32_t) clusters.size());
+    put(ofs, (uint64_t) triangles.size());
+
+    for ( const Cluster_File::Cluster& cluster : clusters )
+    {
+        put(ofs, cluster.bounds.min);
+        put(ofs, cluster.bounds.max);
+        put(ofs, cluster.first);
+        put(ofs, cluster.count);
+    }
+
+    for ( uint32_t index : order )
+    {
+        put(ofs, triangles[index].vertex_a);
+        put(ofs, triangles[index].vertex_b);
+        put(ofs, triangles[index].vertex_c);
+    }
+
+    return (bool) ofs;
+}
@@ -0,0 +1,95 @@
+#include "quality.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+//  --  class Quality_Controller  --  //
+
+// Constructors
+Quality_Controller::Quality_Controller(double _budget_seconds)
+    : budget_seconds{_budget_seconds}
+{
+    levels = 
+    {
+        { 0.25f, 1, 1 },
+        { 0.35f, 2, 1 },
+        { 0.50f, 2, 1 },
+        { 0.50f, 3, 1 },
+        { 0.70f, 3, 1 },
+        { 0.70f, 4, 1 },
+        { 1.00f, 4, 1 },
+        { 1.00f, 4, 2 },
+        { 1.00f, 4, 4 }
+    };
+
+    // Start in the middle, the first frames settle it
+    level = (int) levels.size() / 2;
+}
+
+// Member functions
+bool Quality_Controller::update(double frame_seconds)
+{
+    if ( frame_seconds <= 0.0 )
+        return false;
+
+    average_seconds = ( average_seconds > 0.0 ) ? 
+                      0.5 * (average_seconds + frame_seconds) : 
+                      frame_seconds;
+
+    // Time per unit of cost measured at the current level
+    double seconds_per_cost = average_seconds / cost(levels[level]);
+
+    int next = level;
+
+    if ( frame_seconds > budget_seconds )
+    {
+        // Missed the deadline, drop to the best level predicted to fit
+        fast_frames = 0;
+
+        next = 0;
+        for ( int i = level - 1 ; i > 0 ; i-- )
+        {
+            if ( cost(levels[i]) * seconds_per_cost <= budget_seconds * HEADROOM )
+            {
+                next = i;
+                break;
+            }
+        }
+    }
+    else if ( level + 1 < (int) levels.size() )
+    {
+        bool fits = cost(levels[level + 1]) * seconds_per_cost <= budget_seconds * HEADROOM;
+
+        fast_frames = fits ? fast_frames + 1 : 0;
+
+        if ( fast_frames >= RAISE_FRAMES )
+        {
+            fast_frames = 0;
+            next = level + 1;
+        }
+    }
+
+    if ( next == level )
+        return false;
+
+    // The average belongs to the old level
+    average_seconds = 0.0;
+    level = next;
+
+    return true;
+}
+
+void Quality_Controller::get_size(int width, int height, int& scaled_width, int& scaled_height) const
+{
+    scaled_width  = std::max(1, (int) std::lround(width  * levels[level].scale));
+    scaled_height = std::max(1, (int) std::lround(height * levels[level].scale));
+}
+
+double Quality_Controller::cost(const Quality_Level& quality_level)
+{
+    // Each bounce adds a fraction of the primary ray cost in a typical scene
+    double depth_factor = 1.0 + 0.5 * (quality_level.max_depth - 1);
+
+    return quality_level.scale * quality_level.scale * quality_level.samples * depth_factor;
+}
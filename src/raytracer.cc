@@ -1,136 +1,1555 @@
 #include "raytracer.h"
 
 #include <cmath>
+#include <cstring>
 #include <limits>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 
-#include "timer.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "stats.h"
+#include "trace.h"
+#include "image.h"
+#include "temporal.h"
+#include "render_cache.h"
+#include "paged_mesh.h"
+#include "worker_pool.h"
+
+
+//  --  Helper functions  --  //
+
+namespace
+{
+    uint32_t sample_hash(int x, int y, uint32_t s)
+    {
+        uint32_t h = (uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u ^ s * 83492791u;
+
+        h ^= h >> 16;  h *= 0x7feb352du;
+        h ^= h >> 15;  h *= 0x846ca68bu;
+        h ^= h >> 16;
+
+        return h;
+    }
+
+    // Subpixel offset in [-0.5, 0.5) for sample s of pixel (x, y). Hashed
+    // rather than drawn from a generator so the image does not depend on
+    // which thread traced which tile.
+    void sample_offset(int x, int y, int s, float& dx, float& dy)
+    {
+        uint32_t h = sample_hash(x, y, (uint32_t) s);
+
+        dx = (h & 0xffff) / 65536.0f - 0.5f;
+        dy = (h >> 16)    / 65536.0f - 0.5f;
+    }
+
+    // Point of the unit disk for sample s of pixel (x, y), hashed apart from
+    // the subpixel offset. Concentric mapping of the square, so stratified
+    // offsets stay stratified on the lens.
+    void lens_offset(int x, int y, int s, float& lx, float& ly)
+    {
+        uint32_t h = sample_hash(x, y, ~(uint32_t) s);
+
+        float a = (h & 0xffff) / 32768.0f - 1.0f;
+        float b = (h >> 16)    / 32768.0f - 1.0f;
+
+        if ( (a == 0.0f) && (b == 0.0f) )
+        {
+            lx = ly = 0.0f;
+        }
+        else if ( std::abs(a) > std::abs(b) )
+        {
+            lx = a * std::cos((PI / 4.0f) * (b / a));
+            ly = a * std::sin((PI / 4.0f) * (b / a));
+        }
+        else
+        {
+            lx = b * std::cos((PI / 2.0f) - (PI / 4.0f) * (a / b));
+            ly = b * std::sin((PI / 2.0f) - (PI / 4.0f) * (a / b));
+        }
+    }
+}
+
+
+//  --  struct Ray_Buffer  --  //
+
+// Member functions
+void Ray_Buffer::resize(int _count)
+{
+    count = _count;
+
+    size_t padded = ((size_t) count + 3) & ~(size_t) 3;
+
+    for ( std::vector<float>* component : { &origin_x, &origin_y, &origin_z,
+                                            &dir_x,    &dir_y,    &dir_z,
+                                            &spread,
+                                            &film_x,   &film_y,
+                                            &lens_x,   &lens_y } )
+    {
+        component->resize(padded);
+    }
+}
+
+Ray Ray_Buffer::get(int i) const
+{
+    Ray ray( Vec3(dir_x[i],    dir_y[i],    dir_z[i]),
+             Vec3(origin_x[i], origin_y[i], origin_z[i]) );
+
+    ray.spread = spread[i];
+
+    return ray;
+}
 
 
 //  --  class Camera  --  //
 
-// Constructors
-Camera::Camera(int _width, int _height, float _fov)
-    : width{_width} , height{_height} ,
-      position{0.0f, 0.0f, 0.0f}
+// Constructors
+Camera::Camera(int _width, int _height, float _fov)
+    : width{_width} , height{_height} ,
+      position{0.0f, 0.0f, 0.0f} ,
+      forward{0.0f, 0.0f, 1.0f} ,
+      right{1.0f, 0.0f, 0.0f} ,
+      up{0.0f, 1.0f, 0.0f}
+{
+    fov = degree_to_radian(_fov);
+
+    update_image_plane();
+}
+
+// Member functions
+float Camera::get_fov() const
+{
+    return radian_to_degree(fov);
+}
+
+Ray Camera::get_primary_ray(int x, int y) const
+{
+    Vec3 local = image_plane_pixel_origin + 
+                 (offset_vec_width  * x)  + 
+                 (offset_vec_height * y);
+
+    Vec3 dir = (right * local.x) + (up * local.y) + (forward * local.z);
+    float length = dir.length();
+    dir.normalize();
+
+    Ray ray(dir, position);
+
+    // Pixel width per unit of distance along dir
+    ray.spread = offset_vec_width.x / length;
+
+    return ray;
+}
+Ray Camera::get_primary_ray(int x, int y, float dx, float dy) const
+{
+    Vec3 local = image_plane_pixel_origin + 
+                 (offset_vec_width  * (x + dx))  + 
+                 (offset_vec_height * (y + dy));
+
+    Vec3 dir = (right * local.x) + (up * local.y) + (forward * local.z);
+    float length = dir.length();
+    dir.normalize();
+
+    Ray ray(dir, position);
+
+    // Pixel width per unit of distance along dir
+    ray.spread = offset_vec_width.x / length;
+
+    return ray;
+}
+
+void Camera::get_primary_rays( int x0, int y0, int x1, int y1,
+                               int step,
+                               int samples,
+                               Ray_Buffer& rays ) const
+{
+    int columns = (x1 - x0 + step - 1) / step;
+    int rows    = (y1 - y0 + step - 1) / step;
+
+    rays.resize(columns * rows * samples);
+
+    bool lens = ( aperture > 0.0f );
+
+    // Sample positions first, the hashes do not vectorize
+    int i = 0;
+
+    for ( int y = y0 ; y < y1 ; y += step )
+    {
+        for ( int x = x0 ; x < x1 ; x += step )
+        {
+            for ( int s = 0 ; s < samples ; s++, i++ )
+            {
+                float dx = 0.0f;
+                float dy = 0.0f;
+                float lx = 0.0f;
+                float ly = 0.0f;
+
+                if ( samples > 1 )
+                    sample_offset(x, y, s, dx, dy);
+                if ( lens )
+                    lens_offset(x, y, s, lx, ly);
+
+                rays.film_x[i] = x + dx;
+                rays.film_y[i] = y + dy;
+                rays.lens_x[i] = lx;
+                rays.lens_y[i] = ly;
+            }
+        }
+    }
+
+    // Padding traces through the last sample
+    for ( ; i < (int) rays.film_x.size() ; i++ )
+    {
+        rays.film_x[i] = rays.film_x[i - 1];
+        rays.film_y[i] = rays.film_y[i - 1];
+        rays.lens_x[i] = rays.lens_x[i - 1];
+        rays.lens_y[i] = rays.lens_y[i - 1];
+    }
+
+    // The same operations as get_primary_ray() in the same order, so single
+    // samples through a pinhole match it bit for bit
+#ifdef __SSE2__
+    const __m128 plane_x  = _mm_set1_ps(image_plane_pixel_origin.x);
+    const __m128 plane_y  = _mm_set1_ps(image_plane_pixel_origin.y);
+    const __m128 plane_z  = _mm_set1_ps(image_plane_pixel_origin.z);
+    const __m128 width_x  = _mm_set1_ps(offset_vec_width.x);
+    const __m128 width_y  = _mm_set1_ps(offset_vec_width.y);
+    const __m128 width_z  = _mm_set1_ps(offset_vec_width.z);
+    const __m128 height_x = _mm_set1_ps(offset_vec_height.x);
+    const __m128 height_y = _mm_set1_ps(offset_vec_height.y);
+    const __m128 height_z = _mm_set1_ps(offset_vec_height.z);
+
+    const __m128 basis[3][3] = { { _mm_set1_ps(right.x),   _mm_set1_ps(right.y),   _mm_set1_ps(right.z)   },
+                                 { _mm_set1_ps(up.x),      _mm_set1_ps(up.y),      _mm_set1_ps(up.z)      },
+                                 { _mm_set1_ps(forward.x), _mm_set1_ps(forward.y), _mm_set1_ps(forward.z) } };
+
+    const __m128 origin[3] = { _mm_set1_ps(position.x), _mm_set1_ps(position.y), _mm_set1_ps(position.z) };
+    const __m128 radius    = _mm_set1_ps(aperture);
+    const __m128 focus     = _mm_set1_ps(focus_distance);
+
+    for ( i = 0 ; i < (int) rays.film_x.size() ; i += 4 )
+    {
+        __m128 film_x = _mm_loadu_ps(&rays.film_x[i]);
+        __m128 film_y = _mm_loadu_ps(&rays.film_y[i]);
+
+        __m128 local[3] = { _mm_add_ps( _mm_add_ps(plane_x, _mm_mul_ps(width_x, film_x)), _mm_mul_ps(height_x, film_y) ),
+                            _mm_add_ps( _mm_add_ps(plane_y, _mm_mul_ps(width_y, film_x)), _mm_mul_ps(height_y, film_y) ),
+                            _mm_add_ps( _mm_add_ps(plane_z, _mm_mul_ps(width_z, film_x)), _mm_mul_ps(height_z, film_y) ) };
+
+        __m128 dir[3];
+        for ( int axis = 0 ; axis < 3 ; axis++ )
+            dir[axis] = _mm_add_ps( _mm_add_ps( _mm_mul_ps(basis[0][axis], local[0]),
+                                                _mm_mul_ps(basis[1][axis], local[1]) ),
+                                    _mm_mul_ps(basis[2][axis], local[2]) );
+
+        __m128 length = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(dir[0], dir[0]),
+                                                             _mm_mul_ps(dir[1], dir[1]) ),
+                                                 _mm_mul_ps(dir[2], dir[2]) ) );
+
+        _mm_storeu_ps(&rays.spread[i], _mm_div_ps(width_x, length));
+
+        __m128 start[3] = { origin[0], origin[1], origin[2] };
+
+        // From a point of the lens towards where the pinhole ray crosses
+        // the plane in focus, dir is 1 long along forward
+        if ( lens )
+        {
+            __m128 lens_x = _mm_mul_ps(radius, _mm_loadu_ps(&rays.lens_x[i]));
+            __m128 lens_y = _mm_mul_ps(radius, _mm_loadu_ps(&rays.lens_y[i]));
+
+            for ( int axis = 0 ; axis < 3 ; axis++ )
+            {
+                __m128 offset = _mm_add_ps( _mm_mul_ps(basis[0][axis], lens_x),
+                                            _mm_mul_ps(basis[1][axis], lens_y) );
+
+                dir[axis]   = _mm_sub_ps(_mm_mul_ps(dir[axis], focus), offset);
+                start[axis] = _mm_add_ps(start[axis], offset);
+            }
+
+            length = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(dir[0], dir[0]),
+                                                          _mm_mul_ps(dir[1], dir[1]) ),
+                                              _mm_mul_ps(dir[2], dir[2]) ) );
+        }
+
+        _mm_storeu_ps(&rays.dir_x[i], _mm_div_ps(dir[0], length));
+        _mm_storeu_ps(&rays.dir_y[i], _mm_div_ps(dir[1], length));
+        _mm_storeu_ps(&rays.dir_z[i], _mm_div_ps(dir[2], length));
+
+        _mm_storeu_ps(&rays.origin_x[i], start[0]);
+        _mm_storeu_ps(&rays.origin_y[i], start[1]);
+        _mm_storeu_ps(&rays.origin_z[i], start[2]);
+    }
+#else
+    for ( i = 0 ; i < (int) rays.film_x.size() ; i++ )
+    {
+        Vec3 local = image_plane_pixel_origin +
+                     (offset_vec_width  * rays.film_x[i]) +
+                     (offset_vec_height * rays.film_y[i]);
+
+        Vec3  dir    = (right * local.x) + (up * local.y) + (forward * local.z);
+        Vec3  start  = position;
+
+        rays.spread[i] = offset_vec_width.x / dir.length();
+
+        if ( lens )
+        {
+            Vec3 offset = (right * (aperture * rays.lens_x[i])) + (up * (aperture * rays.lens_y[i]));
+
+            dir    = (dir * focus_distance) - offset;
+            start += offset;
+        }
+
+        dir.normalize();
+
+        rays.dir_x[i] = dir.x;
+        rays.dir_y[i] = dir.y;
+        rays.dir_z[i] = dir.z;
+
+        rays.origin_x[i] = start.x;
+        rays.origin_y[i] = start.y;
+        rays.origin_z[i] = start.z;
+    }
+#endif
+}
+
+bool Camera::project(const Vec3& point, float& x, float& y) const
+{
+    Vec3 relative = point - position;
+
+    float local_z = relative * forward;
+    if ( local_z <= 0.0f )
+        return false;
+
+    // Onto the image plane at distance 1
+    float local_x = (relative * right) / local_z;
+    float local_y = (relative * up)    / local_z;
+
+    x = (local_x - image_plane_pixel_origin.x) / offset_vec_width.x;
+    y = (local_y - image_plane_pixel_origin.y) / offset_vec_height.y;
+
+    return true;
+}
+
+void Camera::look_at(const Vec3& target, const Vec3& world_up)
+{
+    set_orientation(target - position, world_up);
+}
+void Camera::set_orientation(const Vec3& _forward, const Vec3& _up)
+{
+    // No direction to turn to, e.g. a target at the position
+    if ( _forward.length() == 0.0f )
+        return;
+
+    forward = _forward;
+    forward.normalize();
+
+    right = _up.cross_product(forward);
+
+    // Looking straight along up, the world axis least aligned with forward
+    // stands in for it
+    if ( right.length() <= 1.0e-6f * _up.length() )
+    {
+        Vec3 axis = ( std::abs(forward.z) < 0.9f ) ? Vec3(0.0f, 0.0f, 1.0f) : Vec3(1.0f, 0.0f, 0.0f);
+        right = axis.cross_product(forward);
+    }
+
+    right.normalize();
+
+    up = forward.cross_product(right);
+}
+
+void Camera::set_basis(const Vec3& _forward, const Vec3& _right, const Vec3& _up)
+{
+    forward = _forward;
+    right   = _right;
+    up      = _up;
+}
+
+void Camera::set_resolution(int _width, int _height)
+{
+    width  = _width;
+    height = _height;
+
+    update_image_plane();
+}
+
+void Camera::set_lens(float _aperture, float _focus_distance)
+{
+    aperture       = std::max(_aperture, 0.0f);
+    focus_distance = std::max(_focus_distance, 0.0001f);
+}
+
+void Camera::update_image_plane()
+{
+    aspect_ratio = (float) width / (float) height;
+
+    // Image plane at distance 1 in camera space, x right, y up, z forward
+    float image_plane_width  = 2.0f * std::tan(fov / 2.0f) * aspect_ratio;
+    float image_plane_height = 2.0f * std::tan(fov / 2.0f);
+
+    offset_vec_width = Vec3( image_plane_width / width, 
+                             0.0f, 
+                             0.0f );
+
+    offset_vec_height = Vec3(  0.0f, 
+                              -image_plane_height / height, 
+                               0.0f );
+
+    image_plane_pixel_origin = Vec3 (-image_plane_width / 2.0f,
+                                      image_plane_height / 2.0f,
+                                      1.0f );
+
+    image_plane_pixel_origin += offset_vec_width  * 0.5f;
+    image_plane_pixel_origin += offset_vec_height * 0.5f;
+}
+
+
+//  --  class Raytracer  --  //
+
+// Constructors
+Raytracer::Raytracer(int _width, int _height, bool allocate_frame)
+    : width{_width} , height{_height} ,
+      camera{_width , _height , 80.0f} ,
+      workers{new Worker_Pool("worker")}
+{
+    frame = allocate_frame ? new uint8_t[(size_t) width * height * 4] : nullptr;
+
+    set_threads(std::thread::hardware_concurrency());
+
+    framebuffer.resize( allocate_frame ? width  : 0,
+                        allocate_frame ? height : 0,
+                        AOV_NONE );
+    gamma_lut = make_gamma_lut(gamma);
+
+    ambient    = Color(0.13f, 0.13f, 0.16f);
+    background = Color(0x8b9dc300);
+
+    invalidate_tiles();
+}
+// Destructor
+Raytracer::~Raytracer()
+{
+    delete[] frame;
+
+    for ( Shape* shape : shapes )
+        delete shape;
+
+    for ( Light* light : lights )
+        delete light;
+}
+
+// Member functions
+
+void Raytracer::add(Shape* p_shape)
+{
+    if ( p_shape != nullptr )
+    {
+        p_shape->id = (int) shapes.size();
+        shapes.push_back(p_shape);
+
+        scene_bvh_built = false;
+
+        invalidate_tiles();
+        invalidate_temporal_cache();
+    }
+}
+void Raytracer::add(Light* p_light)
+{
+    if ( p_light != nullptr )
+    {
+        lights.push_back(p_light);
+
+        invalidate_tiles();
+        invalidate_temporal_cache();
+    }
+}
+void Raytracer::reserve(int shape_count, int light_count)
+{
+    shapes.reserve(shapes.size() + std::max(shape_count, 0));
+    lights.reserve(lights.size() + std::max(light_count, 0));
+}
+
+void Raytracer::set_camera(const Camera& _camera)
+{
+    // The camera has to match the frame size
+    if ( (_camera.get_width() == width) && (_camera.get_height() == height) )
+    {
+        camera = _camera;
+        invalidate_tiles();
+    }
+}
+
+void Raytracer::resize(int _width, int _height)
+{
+    if ( (_width == width) && (_height == height) )
+        return;
+
+    bool allocate_frame = ( frame != nullptr );
+
+    width  = _width;
+    height = _height;
+
+    camera.set_resolution(width, height);
+
+    delete[] frame;
+    frame = allocate_frame ? new uint8_t[(size_t) width * height * 4] : nullptr;
+
+    if ( allocate_frame )
+        framebuffer.resize(width, height, framebuffer.get_aovs());
+
+    denoised = Framebuffer();
+
+    if ( heatmap )
+        heatmap.reset(new Heatmap(width, height));
+
+    invalidate_tiles();
+}
+
+void Raytracer::set_tile_size(int _tile_size)
+{
+    tile_size = ( _tile_size > 0 ) ? _tile_size : 1;
+    invalidate_tiles();
+}
+
+int Raytracer::get_tile_count() const
+{
+    int tiles_x = (width  + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+
+    return tiles_x * tiles_y;
+}
+void Raytracer::get_tile_rect(int tile, int& x0, int& y0, int& x1, int& y1) const
+{
+    int tiles_x = (width + tile_size - 1) / tile_size;
+
+    x0 = (tile % tiles_x) * tile_size;
+    y0 = (tile / tiles_x) * tile_size;
+    x1 = std::min(x0 + tile_size, width);
+    y1 = std::min(y0 + tile_size, height);
+}
+
+void Raytracer::set_threads(int _threads)
+{
+    threads = ( _threads > 0 ) ? _threads : 1;
+}
+
+void Raytracer::enable_aovs(unsigned int aovs)
+{
+    // The denoiser is guided by these
+    if ( denoiser )
+        aovs |= AOV_DEPTH | AOV_NORMAL | AOV_ALBEDO;
+
+    // Reprojection needs the surface point and identity
+    if ( temporal_cache )
+        aovs |= AOV_DEPTH | AOV_NORMAL | AOV_SHAPE_ID;
+
+    if ( frame != nullptr )
+        framebuffer.resize(width, height, aovs);
+}
+
+void Raytracer::set_gamma(float _gamma, float _exposure)
+{
+    gamma     = ( _gamma > 0.0f ) ? _gamma : 1.0f;
+    exposure  = _exposure;
+    gamma_lut = make_gamma_lut(gamma);
+}
+
+void Raytracer::resolve() const
+{
+    if ( frame == nullptr )
+        return;
+
+    if ( denoiser && (denoised.get_samples() > 0) )
+        denoised.quantize(0, 0, width, height, frame, gamma_lut, exposure);
+    else
+        framebuffer.quantize(0, 0, width, height, frame, gamma_lut, exposure);
+}
+
+void Raytracer::set_samples_per_pixel(int _samples)
+{
+    samples_per_pixel = ( _samples > 0 ) ? _samples : 1;
+}
+
+void Raytracer::set_pixel_step(int _pixel_step)
+{
+    pixel_step = ( _pixel_step > 0 ) ? _pixel_step : 1;
+}
+
+void Raytracer::set_cancel_token(const std::atomic<bool>* _cancel_token)
+{
+    cancel_token = _cancel_token;
+}
+
+bool Raytracer::cancel_requested() const
+{
+    return (cancel_token != nullptr) && cancel_token->load(std::memory_order_relaxed);
+}
+
+void Raytracer::enable_denoiser(bool enable, const Denoise_Settings& settings)
+{
+    denoiser         = enable;
+    denoise_settings = settings;
+
+    if ( enable )
+        enable_aovs(framebuffer.get_aovs());
+    else
+        denoised = Framebuffer();
+}
+
+void Raytracer::enable_temporal_cache(bool enable)
+{
+    if ( enable )
+        enable_temporal_cache(Temporal_Settings());
+    else
+        temporal_cache.reset();
+}
+void Raytracer::enable_temporal_cache(const Temporal_Settings& settings)
+{
+    temporal_cache.reset(new Temporal_Cache(settings));
+    enable_aovs(framebuffer.get_aovs());
+}
+
+void Raytracer::invalidate_temporal_cache()
+{
+    if ( temporal_cache )
+        temporal_cache->invalidate();
+}
+
+void Raytracer::enable_dependency_tracking(bool enable)
+{
+    dependency_tracking = enable;
+}
+
+void Raytracer::set_material(int shape, const Material& material)
+{
+    if ( (shape < 0) || (shape >= (int) shapes.size()) )
+        return;
+
+    shapes[shape]->material = material;
+
+    invalidate_tiles_if( [shape](const Tile_Dependencies& dependencies, int /*tile*/)
+    {
+        return dependencies.shades(shape);
+    });
+}
+
+void Raytracer::translate(int shape, const Vec3& offset)
+{
+    if ( (shape < 0) || (shape >= (int) shapes.size()) )
+        return;
+
+    shapes[shape]->translate(offset);
+    shapes_moved = true;
+
+    // Tiles that saw the shape or its shadow before the move recorded it,
+    // the ones it moves into are found from its new bounds
+    Vec3 min, max;
+    bool bounded = shapes[shape]->get_bounds(min, max);
+
+    Vec3  center = (min + max) * 0.5f;
+    float radius = (max - min).length() * 0.5f;
+
+    // Screen rectangle of the bounding box, covers every pixel whose center
+    // ray or jittered samples can hit the shape
+    bool  on_screen = bounded;
+    float screen_x0 = std::numeric_limits<float>::max();
+    float screen_y0 = std::numeric_limits<float>::max();
+    float screen_x1 = std::numeric_limits<float>::lowest();
+    float screen_y1 = std::numeric_limits<float>::lowest();
+
+    for ( int corner = 0 ; on_screen && (corner < 8) ; corner++ )
+    {
+        Vec3 point( (corner & 1) ? max.x : min.x,
+                    (corner & 2) ? max.y : min.y,
+                    (corner & 4) ? max.z : min.z );
+
+        float x, y;
+        if ( !camera.project(point, x, y) )
+        {
+            on_screen = false;
+            break;
+        }
+
+        screen_x0 = std::min(screen_x0, x - 1.0f);
+        screen_y0 = std::min(screen_y0, y - 1.0f);
+        screen_x1 = std::max(screen_x1, x + 1.0f);
+        screen_y1 = std::max(screen_y1, y + 1.0f);
+    }
+
+    invalidate_tiles_if( [&](const Tile_Dependencies& dependencies, int tile)
+    {
+        // Unbounded or partly behind the camera, may be seen anywhere
+        if ( !on_screen )
+            return true;
+
+        if ( dependencies.shades(shape) || dependencies.occluded_by(shape) )
+            return true;
+
+        if ( dependencies.reflections )
+            return true;
+
+        int x0, y0, x1, y1;
+        get_tile_rect(tile, x0, y0, x1, y1);
+
+        if ( (screen_x1 >= x0) && (screen_x0 < x1) && (screen_y1 >= y0) && (screen_y0 < y1) )
+            return true;
+
+        for ( Light* light : lights )
+        {
+            if ( dependencies.in_shadow_of(center, radius, light->get_direction(center)) )
+                return true;
+        }
+
+        return false;
+    });
+}
+
+void Raytracer::set_position(int shape, const Vec3& position)
+{
+    if ( (shape < 0) || (shape >= (int) shapes.size()) )
+        return;
+
+    translate(shape, position - shapes[shape]->get_position());
+}
+
+void Raytracer::set_light(int light, const Color& color, float intensity)
+{
+    if ( (light < 0) || (light >= (int) lights.size()) )
+        return;
+
+    lights[light]->color     = color;
+    lights[light]->intensity = intensity;
+
+    invalidate_tiles_if( [light](const Tile_Dependencies& dependencies, int /*tile*/)
+    {
+        return dependencies.lit_by(light);
+    });
+}
+
+void Raytracer::set_light_direction(int light, const Vec3& direction)
+{
+    if ( (light < 0) || (light >= (int) lights.size()) )
+        return;
+
+    Light_Direction* directional = dynamic_cast<Light_Direction*>(lights[light]);
+
+    if ( directional == nullptr )
+        return;
+
+    directional->direction = direction;
+    directional->direction.normalize();
+
+    // Changes what is lit and shadowed on every surface
+    invalidate_tiles_if( [](const Tile_Dependencies& dependencies, int /*tile*/)
+    {
+        return dependencies.has_hits;
+    });
+}
+
+void Raytracer::invalidate_shape(int shape)
+{
+    if ( (shape < 0) || (shape >= (int) shapes.size()) )
+        return;
+
+    scene_bvh_built = false;
+
+    invalidate_tiles();
+    invalidate_temporal_cache();
+}
+
+void Raytracer::invalidate_tiles()
+{
+    // Nothing traced since the last time, e.g. while a scene is being
+    // added shape by shape. Dependencies are reset when a tile is traced.
+    if ( ((int) tile_valid.size() == get_tile_count()) &&
+         (std::memchr(tile_valid.data(), 1, tile_valid.size()) == nullptr) )
+        return;
+
+    tile_valid.assign(get_tile_count(), 0);
+    tile_dependencies.assign(get_tile_count(), Tile_Dependencies());
+}
+
+int Raytracer::get_invalid_tile_count() const
+{
+    return (int) std::count(tile_valid.begin(), tile_valid.end(), 0);
+}
+
+template <typename Predicate>
+void Raytracer::invalidate_tiles_if(Predicate depends)
+{
+    for ( int tile = 0 ; tile < (int) tile_valid.size() ; tile++ )
+    {
+        const Tile_Dependencies& dependencies = tile_dependencies[tile];
+
+        if ( !dependencies.complete || depends(dependencies, tile) )
+            tile_valid[tile] = 0;
+    }
+
+    invalidate_temporal_cache();
+}
+
+void Raytracer::update_scene() const
+{
+    if ( scene_bvh_built && !shapes_moved )
+        return;
+
+    Stage_Timer build_time(Stage::Build);
+    Trace_Scope trace_build("build");
+
+    Render_Counters& counters = Render_Stats::local();
+
+    if ( !scene_bvh_built )
+    {
+        bounded_shapes.clear();
+        unbounded_shapes.clear();
+
+        Vec3 min, max;
+        for ( Shape* shape : shapes )
+        {
+            if ( shape->get_bounds(min, max) )
+                bounded_shapes.push_back(shape);
+            else
+                unbounded_shapes.push_back(shape);
+        }
+    }
+
+    std::vector<Aabb> bounds;
+    bounds.reserve(bounded_shapes.size());
+
+    for ( Shape* shape : bounded_shapes )
+    {
+        Vec3 min, max;
+        shape->get_bounds(min, max);
+        bounds.emplace_back(min, max);
+    }
+
+    if ( !scene_bvh_built )
+    {
+        scene_bvh.build(bounds);
+        counters.bvh_rebuilds++;
+    }
+    else
+    {
+        counters.bvh_rebuilds += scene_bvh.update(bounds, *workers, threads, bvh_rebuild_threshold);
+        counters.bvh_refits++;
+    }
+
+    scene_wide_bvh.build(scene_bvh);
+
+    scene_bvh_built = true;
+    shapes_moved    = false;
+}
+
+uint64_t Raytracer::get_render_key() const
+{
+    // Camera with its lens, lights, shapes, ambient, background and
+    // recursion limits
+    uint64_t scene = hash_scene(*this);
+
+    if ( scene == 0 )
+        return 0;
+
+    uint64_t key = fnv1a_value(RENDER_CACHE_VERSION, FNV_OFFSET);
+    key = fnv1a_value(scene, key);
+
+    key = fnv1a_value(tile_size,         key);
+    key = fnv1a_value(samples_per_pixel, key);
+    key = fnv1a_value(pixel_step,        key);
+    key = fnv1a_value(gamma,             key);
+    key = fnv1a_value(exposure,          key);
+    key = fnv1a_value(denoiser,          key);
+    key = fnv1a_value(level_of_detail,   key);
+
+    if ( denoiser )
+    {
+        key = fnv1a_value(denoise_settings.iterations,   key);
+        key = fnv1a_value(denoise_settings.sigma_color,  key);
+        key = fnv1a_value(denoise_settings.sigma_normal, key);
+        key = fnv1a_value(denoise_settings.sigma_depth,  key);
+        key = fnv1a_value(denoise_settings.sigma_albedo, key);
+    }
+
+    return key;
+}
+
+void Raytracer::enable_heatmap(bool enable)
+{
+    if ( enable )
+        heatmap.reset(new Heatmap(width, height));
+    else
+        heatmap.reset();
+}
+
+unsigned char* Raytracer::render() const
+{
+    render_tiles(0, get_tile_count());
+
+    return (unsigned char*) frame;
+}
+
+bool Raytracer::render_tiles(int first, int last) const
+{
+    Trace_Scope trace_frame("frame");
+
+    std::chrono::high_resolution_clock::time_point start_point;
+    start_point = std::chrono::high_resolution_clock::now();
+
+    stats.begin_frame();
+
+    framebuffer.clear();
+    for ( int s = 0 ; s < samples_per_pixel ; s++ )
+        framebuffer.add_sample_pass();
+
+    // Tiles outside of [first, last) were just cleared
+    std::fill(tile_valid.begin(), tile_valid.end(), 0);
+
+    update_scene();
+
+    // Camera motion with a previous frame, reuse what is still visible
+    bool full_frame = (first == 0) && (last == get_tile_count()) && (pixel_step == 1);
+    bool reproject  = temporal_cache && full_frame;
+
+    if ( reproject )
+        temporal_cache->reproject(camera, shapes, framebuffer, trace_mask, *workers, threads);
+
+    // Denoised tiles depend on the whole frame
+    bool cached = render_cache && !reproject && !heatmap && (frame != nullptr) &&
+                  (!denoiser || full_frame);
+
+    uint64_t key = cached ? get_render_key() : 0;
+    cached = ( key != 0 );
+
+    std::vector<int> tiles;
+    if ( cached )
+        tiles = load_cached_tiles(key, first, last);
+
+    if ( !cached || (denoiser && !tiles.empty()) )
+    {
+        tiles.clear();
+        for ( int tile = first ; tile < last ; tile++ )
+            tiles.push_back(tile);
+    }
+
+    bool completed = trace_tiles( tiles, framebuffer, frame, 0,
+                                  reproject ? trace_mask.data() : nullptr ) == (int) tiles.size();
+
+    if ( completed && reproject )
+        temporal_cache->store(camera, framebuffer, trace_mask, *workers, threads);
+
+    if ( completed && denoiser && full_frame && !tiles.empty() )
+        denoise_frame();
+
+    if ( completed && cached )
+        store_cached_tiles(key, tiles);
+
+    std::chrono::duration<double> delta_time = 
+        std::chrono::high_resolution_clock::now() - start_point;
+    stats.end_frame(delta_time.count(), threads);
+
+    return completed;
+}
+
+int Raytracer::render_invalidated() const
+{
+    if ( frame == nullptr )
+        return 0;
+
+    Trace_Scope trace_frame("frame");
+
+    std::chrono::high_resolution_clock::time_point start_point;
+    start_point = std::chrono::high_resolution_clock::now();
+
+    stats.begin_frame();
+
+    // Nothing rendered yet, or the framebuffer was reallocated
+    if ( framebuffer.get_samples() != samples_per_pixel )
+    {
+        framebuffer.clear();
+        for ( int s = 0 ; s < samples_per_pixel ; s++ )
+            framebuffer.add_sample_pass();
+
+        std::fill(tile_valid.begin(), tile_valid.end(), 0);
+    }
+
+    update_scene();
+
+    std::vector<int> tiles;
+    for ( int tile = 0 ; tile < (int) tile_valid.size() ; tile++ )
+    {
+        if ( tile_valid[tile] )
+            continue;
+
+        int x0, y0, x1, y1;
+        get_tile_rect(tile, x0, y0, x1, y1);
+        framebuffer.clear(x0, y0, x1, y1);
+
+        tiles.push_back(tile);
+    }
+
+    int traced = trace_tiles(tiles, framebuffer, frame, 0, nullptr);
+
+    if ( (traced == (int) tiles.size()) && !tiles.empty() && denoiser && (pixel_step == 1) )
+        denoise_frame();
+
+    std::chrono::duration<double> delta_time = 
+        std::chrono::high_resolution_clock::now() - start_point;
+    stats.end_frame(delta_time.count(), threads);
+
+    return traced;
+}
+
+bool Raytracer::render_views( const std::vector<Camera>& cameras,
+                              std::vector<std::vector<uint8_t>>& images ) const
 {
-    fov = degree_to_radian(_fov);
-    aspect_ratio = (float) width / (float) height;
+    Trace_Scope trace_frame("views");
 
-    float image_plane_width  = 2.0f * std::tan(fov / 2.0f) * aspect_ratio;
-    float image_plane_height = 2.0f * std::tan(fov / 2.0f);
+    std::chrono::high_resolution_clock::time_point start_point;
+    start_point = std::chrono::high_resolution_clock::now();
 
-    offset_vec_width = Vec3( image_plane_width / width, 
-                             0.0f, 
-                             0.0f );
+    stats.begin_frame();
 
-    offset_vec_height = Vec3(  0.0f, 
-                              -image_plane_height / height, 
-                               0.0f );
+    update_scene();
 
-    image_plane_pixel_origin = Vec3 (-image_plane_width / 2.0f,
-                                      image_plane_height / 2.0f,
-                                      1.0f );
+    int views = (int) cameras.size();
 
-    image_plane_pixel_origin += offset_vec_width  * 0.5f;
-    image_plane_pixel_origin += offset_vec_height * 0.5f;
+    // The denoiser needs whole frames with their AOVs
+    std::vector<Framebuffer> view_framebuffers( denoiser ? views : 0 );
+
+    images.resize(views);
+
+    // (view, tile) pairs of every view in one list
+    std::vector<std::pair<int,int>> tiles;
+
+    for ( int v = 0 ; v < views ; v++ )
+    {
+        int view_width  = cameras[v].get_width();
+        int view_height = cameras[v].get_height();
+
+        images[v].assign((size_t) view_width * view_height * 4, 0);
+
+        if ( denoiser )
+        {
+            view_framebuffers[v].resize(view_width, view_height, framebuffer.get_aovs());
+            for ( int s = 0 ; s < samples_per_pixel ; s++ )
+                view_framebuffers[v].add_sample_pass();
+        }
+
+        int tiles_x = (view_width  + tile_size - 1) / tile_size;
+        int tiles_y = (view_height + tile_size - 1) / tile_size;
+
+        for ( int tile = 0 ; tile < tiles_x * tiles_y ; tile++ )
+            tiles.push_back( std::make_pair(v, tile) );
+    }
+
+    std::atomic<int> next_tile{0};
+    std::atomic<int> finished_tiles{0};
+
+    auto worker = [&]()
+    {
+        Framebuffer band;
+
+        for ( int i = next_tile++ ; i < (int) tiles.size() ; i = next_tile++ )
+        {
+            if ( cancel_requested() )
+                break;
+
+            int view = tiles[i].first;
+            int tile = tiles[i].second;
+
+            int view_width  = cameras[view].get_width();
+            int view_height = cameras[view].get_height();
+            int tiles_x     = (view_width + tile_size - 1) / tile_size;
+
+            int x0 = (tile % tiles_x) * tile_size;
+            int y0 = (tile / tiles_x) * tile_size;
+            int x1 = std::min(x0 + tile_size, view_width);
+            int y1 = std::min(y0 + tile_size, view_height);
+
+            Framebuffer* fb = &band;
+            int target_y    = y0;
+
+            if ( denoiser )
+            {
+                fb       = &view_framebuffers[view];
+                target_y = 0;
+            }
+            else if ( band.get_width() != view_width )
+            {
+                band.resize(view_width, tile_size, AOV_NONE);
+                for ( int s = 0 ; s < samples_per_pixel ; s++ )
+                    band.add_sample_pass();
+            }
+            else
+            {
+                band.clear(x0, 0, x1, y1 - y0);
+            }
+
+            render_tile(cameras[view], x0, y0, x1, y1, *fb, target_y, nullptr);
+
+            fb->quantize( x0, y0 - target_y, x1, y1 - target_y,
+                          images[view].data() + (size_t) y0 * view_width * 4,
+                          gamma_lut,
+                          exposure );
+
+            finished_tiles++;
+        }
+
+        stats.merge_local();
+    };
+
+    workers->run(std::min(threads, (int) tiles.size()), worker);
+
+    bool completed = ( finished_tiles == (int) tiles.size() );
+
+    if ( completed && denoiser )
+    {
+        Framebuffer filtered;
+
+        for ( int v = 0 ; v < views ; v++ )
+        {
+            {
+                Stage_Timer denoise_time(Stage::Denoise);
+
+                if ( !denoise(view_framebuffers[v], filtered, denoise_settings, *workers, threads) )
+                    continue;
+            }
+
+            filtered.quantize( 0, 0, cameras[v].get_width(), cameras[v].get_height(),
+                               images[v].data(), gamma_lut, exposure );
+        }
+
+        stats.merge_local();
+    }
+
+    std::chrono::duration<double> delta_time = 
+        std::chrono::high_resolution_clock::now() - start_point;
+    stats.end_frame(delta_time.count(), threads);
+
+    return completed;
 }
 
-// Member functions
-Ray Camera::get_primary_ray(int x, int y) const
+bool Raytracer::render_to_file(const std::string& filename) const
 {
-    Vec3 dir = image_plane_pixel_origin + 
-               (offset_vec_width  * x)  + 
-               (offset_vec_height * y);
+    Trace_Scope trace_frame("frame");
 
-    dir -= position;
-    dir.normalize();
+    std::chrono::high_resolution_clock::time_point start_point;
+    start_point = std::chrono::high_resolution_clock::now();
+
+    stats.begin_frame();
+
+    // One row of tiles per band, the I/O thread writes a band while
+    // the next one is traced on the worker pool
+    Ppm_Stream stream(filename, width, height, tile_size);
+
+    if ( !stream.is_open() )
+        return false;
+
+    update_scene();
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+
+    Framebuffer band_framebuffer(width, tile_size, AOV_NONE);
+
+    for ( int y = 0 ; y < height ; y += tile_size )
+    {
+        uint8_t* band = stream.acquire();
+
+        band_framebuffer.clear();
+        for ( int s = 0 ; s < samples_per_pixel ; s++ )
+            band_framebuffer.add_sample_pass();
+
+        int first = (y / tile_size) * tiles_x;
+        if ( !trace_tiles(first, first + tiles_x, band_framebuffer, band, y) )
+            break;
+
+        stream.submit(band, std::min(tile_size, height - y));
+    }
+
+    // A cancelled image is left truncated
+    bool ok = stream.close() && !cancel_requested();
 
-    return Ray(dir, position);
+    std::chrono::duration<double> delta_time = 
+        std::chrono::high_resolution_clock::now() - start_point;
+    stats.end_frame(delta_time.count(), threads);
+
+    return ok;
 }
 
+bool Raytracer::trace_tiles( int first, int last,
+                             Framebuffer& fb,
+                             uint8_t* rgba,
+                             int target_y,
+                             const uint8_t* mask ) const
+{
+    std::vector<int> tiles;
+    for ( int tile = first ; tile < last ; tile++ )
+        tiles.push_back(tile);
 
-//  --  class Raytracer  --  //
+    return trace_tiles(tiles, fb, rgba, target_y, mask) == last - first;
+}
 
-// Constructors
-Raytracer::Raytracer(int _width, int _height)
-    : width{_width} , height{_height} ,
-      camera{_width , _height , 80.0f}
+int Raytracer::trace_tiles( const std::vector<int>& tiles,
+                            Framebuffer& fb,
+                            uint8_t* rgba,
+                            int target_y,
+                            const uint8_t* mask ) const
 {
-    frame = new uint8_t[width * height * 4];
+    std::atomic<int> finished_tiles{0};
 
-    ambient    = Color(0.13f, 0.13f, 0.16f);
-    background = Color(0x8b9dc300);
+    // Tiles that passed by clusters of paged meshes, see paged_mesh.h
+    std::vector<int> deferred;
+    std::mutex       deferred_mutex;
+
+    auto trace_list = [&](const std::vector<int>& list, bool retrace)
+    {
+        // Tiles are handed out in list order to whichever thread is free
+        std::atomic<int> next_tile{0};
+
+        int tile_count = (int) list.size();
+
+        auto worker = [&]()
+        {
+            Page_Faults& faults = Page_Faults::local();
+
+            // A second trace would lose reprojected pixels, tiles with a
+            // mask wait for their clusters instead
+            faults.defer = !retrace && (mask == nullptr);
+
+            for ( int i = next_tile++ ; i < tile_count ; i = next_tile++ )
+            {
+                if ( cancel_requested() )
+                    break;
+
+                if ( retrace )
+                {
+                    int x0, y0, x1, y1;
+                    get_tile_rect(list[i], x0, y0, x1, y1);
+                    fb.clear(x0, y0 - target_y, x1, y1 - target_y);
+                }
+
+                faults.missed = 0;
+                trace_tile(list[i], fb, rgba, target_y, mask);
+
+                if ( faults.missed > 0 )
+                {
+                    std::lock_guard<std::mutex> lock(deferred_mutex);
+                    deferred.push_back(list[i]);
+                    continue;
+                }
+
+                finished_tiles++;
+            }
+
+            faults.defer = false;
+            faults.pins.clear();
+
+            stats.merge_local();
+        };
+
+        workers->run(std::min(threads, tile_count), worker);
+    };
+
+    trace_list(tiles, false);
+
+    // Traced again once the rest of the frame gave the loader time to page
+    // their clusters in, what is still missing is loaded while tracing
+    if ( !deferred.empty() )
+    {
+        Trace_Scope trace_deferred("deferred tiles", (int) deferred.size());
+
+        std::vector<int> retrace;
+        retrace.swap(deferred);
+
+        Render_Stats::local().deferred_tiles += retrace.size();
+        trace_list(retrace, true);
+    }
+
+    return finished_tiles;
 }
-// Destructor
-Raytracer::~Raytracer()
+
+std::vector<int> Raytracer::load_cached_tiles(uint64_t key, int first, int last) const
 {
-    delete[] frame;
+    Trace_Scope trace_cache("cache lookup");
 
-    for ( Shape* shape : shapes )
-        delete shape;
+    std::vector<int>     missing;
+    std::vector<uint8_t> pixels;
+
+    Render_Counters& counters = Render_Stats::local();
+
+    for ( int tile = first ; tile < last ; tile++ )
+    {
+        int x0, y0, x1, y1;
+        get_tile_rect(tile, x0, y0, x1, y1);
+
+        size_t row_size = (size_t) (x1 - x0) * 4;
+
+        if ( !render_cache->load(fnv1a_value(tile, key), pixels) ||
+             (pixels.size() != row_size * (y1 - y0)) )
+        {
+            missing.push_back(tile);
+            continue;
+        }
+
+        for ( int y = y0 ; y < y1 ; y++ )
+            std::copy_n( pixels.data() + (y - y0) * row_size, row_size,
+                         frame + ((size_t) y * width + x0) * 4 );
+
+        counters.cached_tiles++;
+    }
+
+    stats.merge_local();
+
+    return missing;
 }
 
-// Member functions
+void Raytracer::store_cached_tiles(uint64_t key, const std::vector<int>& tiles) const
+{
+    Trace_Scope trace_cache("cache store");
 
-void Raytracer::add(Shape* p_shape)
+    std::vector<uint8_t> pixels;
+
+    for ( int tile : tiles )
+    {
+        int x0, y0, x1, y1;
+        get_tile_rect(tile, x0, y0, x1, y1);
+
+        size_t row_size = (size_t) (x1 - x0) * 4;
+        pixels.resize(row_size * (y1 - y0));
+
+        for ( int y = y0 ; y < y1 ; y++ )
+            std::copy_n( frame + ((size_t) y * width + x0) * 4, row_size,
+                         pixels.data() + (y - y0) * row_size );
+
+        if ( !render_cache->store(fnv1a_value(tile, key), pixels.data(), pixels.size()) )
+            break;
+    }
+}
+
+void Raytracer::trace_tile( int tile,
+                            Framebuffer& fb,
+                            uint8_t* rgba,
+                            int target_y,
+                            const uint8_t* mask ) const
 {
-    if ( p_shape != nullptr )
-        shapes.push_back(p_shape);
+    int x0, y0, x1, y1;
+    get_tile_rect(tile, x0, y0, x1, y1);
+
+    // Only tiles of the frame are tracked, not bands of render_to_file()
+    if ( &fb == &framebuffer )
+    {
+        Tile_Dependencies& dependencies = tile_dependencies[tile];
+        dependencies.reset();
+
+        if ( dependency_tracking )
+            Tile_Dependencies::recording() = &dependencies;
+
+        render_tile(camera, x0, y0, x1, y1, fb, target_y, mask);
+
+        Tile_Dependencies::recording() = nullptr;
+        dependencies.finish();
+
+        // Reprojected pixels and preview blocks were not recorded
+        dependencies.complete = dependency_tracking && (mask == nullptr) && (pixel_step == 1);
+        tile_valid[tile]      = ( pixel_step == 1 );
+    }
+    else
+    {
+        render_tile(camera, x0, y0, x1, y1, fb, target_y, mask);
+    }
+
+    // Quantized per tile so viewers can show the frame while it renders
+    fb.quantize( x0, y0 - target_y, x1, y1 - target_y,
+                 rgba + (size_t) (y0 - target_y) * width * 4,
+                 gamma_lut,
+                 exposure );
 }
-void Raytracer::add(Light* p_light)
+
+void Raytracer::begin_tiles() const
 {
-    if ( p_light != nullptr )
-        lights.push_back(p_light);
+    stats.begin_frame();
+
+    framebuffer.clear();
+    for ( int s = 0 ; s < samples_per_pixel ; s++ )
+        framebuffer.add_sample_pass();
+
+    std::fill(tile_valid.begin(), tile_valid.end(), 0);
+
+    update_scene();
+    stats.merge_local();
 }
 
-unsigned char* Raytracer::render() const
+void Raytracer::trace_tile(int tile) const
 {
-    Timer render_time("Render time", std::cout);
-    
-    int index = 0;
-    for ( int y = 0 ; y < height ; y++ )
+    if ( (frame == nullptr) || (tile < 0) || (tile >= get_tile_count()) )
+        return;
+
+    trace_tile(tile, framebuffer, frame, 0, nullptr);
+
+    // Scheduler threads trace tiles of other scenes in between
+    stats.merge_local();
+}
+
+void Raytracer::end_tiles(double seconds, int _threads) const
+{
+    if ( denoiser && (pixel_step == 1) )
+        denoise_frame();
+
+    stats.end_frame(seconds, _threads);
+}
+
+void Raytracer::denoise_frame() const
+{
+    if ( frame == nullptr )
+        return;
+
+    {
+        Stage_Timer denoise_time(Stage::Denoise);
+
+        if ( !denoise(framebuffer, denoised, denoise_settings, *workers, threads) )
+            return;
+    }
+
+    stats.merge_local();
+
+    denoised.quantize(0, 0, width, height, frame, gamma_lut, exposure);
+}
+
+void Raytracer::render_tile( const Camera& view,
+                             int x0, int y0, int x1, int y1,
+                             Framebuffer& fb,
+                             int target_y,
+                             const uint8_t* mask ) const
+{
+    Trace_Scope trace_tile("tile", x0, y0);
+    Stage_Timer trace_time(Stage::Trace);
+
+    Render_Counters& counters = Render_Stats::local();
+    counters.traced_tiles++;
+
+    Pixel_Sample sample;
+
+    // The heatmap has the size of the frame
+    bool record_heatmap = heatmap && (&view == &camera);
+
+    // Preview passes trace the top left pixel of each block and fill the block
+    static thread_local Ray_Buffer rays;
+    view.get_primary_rays(x0, y0, x1, y1, pixel_step, samples_per_pixel, rays);
+
+    int first_ray = 0;
+
+    for ( int y = y0 ; y < y1 ; y += pixel_step )
     {
-        for ( int x = 0 ; x < width ; x++ )
+        for ( int x = x0 ; x < x1 ; x += pixel_step, first_ray += samples_per_pixel )
         {
-            Ray primary_ray = camera.get_primary_ray(x, y);
-            Color color = cast_ray(primary_ray, 0, 1.0f);
-            
-            frame[index++] = color.red   * 255.0f;
-            frame[index++] = color.green * 255.0f;
-            frame[index++] = color.blue  * 255.0f;
-            frame[index++] = 0xFF;
+            if ( (mask != nullptr) && !mask[(size_t) y * width + x] )
+                continue;
+
+            Render_Counters before;
+            std::chrono::high_resolution_clock::time_point pixel_start;
+
+            if ( record_heatmap )
+            {
+                before      = counters;
+                pixel_start = std::chrono::high_resolution_clock::now();
+            }
+
+            for ( int s = 0 ; s < samples_per_pixel ; s++ )
+            {
+                Ray primary_ray = rays.get(first_ray + s);
+                counters.primary_rays++;
+
+                sample = Pixel_Sample();
+                sample.color = cast_ray(primary_ray, 0, 1.0f, &sample);
+
+                if ( pixel_step == 1 )
+                {
+                    fb.accumulate(x, y - target_y, sample);
+                    continue;
+                }
+
+                for ( int block_y = y ; block_y < std::min(y + pixel_step, y1) ; block_y++ )
+                    for ( int block_x = x ; block_x < std::min(x + pixel_step, x1) ; block_x++ )
+                        fb.accumulate(block_x, block_y - target_y, sample);
+            }
+
+            if ( record_heatmap )
+            {
+                std::chrono::nanoseconds elapsed = 
+                    std::chrono::high_resolution_clock::now() - pixel_start;
+
+                heatmap->record(x, y, before, counters, elapsed.count());
+            }
         }
     }
-
-    return (unsigned char*) frame;
 }
 
 Color Raytracer::cast_ray( const Ray& ray, 
                            int recursion_depth,
                            float influence ) const
+{
+    return cast_ray(ray, recursion_depth, influence, nullptr);
+}
+
+Color Raytracer::cast_ray( const Ray& ray, 
+                           int recursion_depth,
+                           float influence,
+                           Pixel_Sample* sample ) const
 {
     Color output;
 
-    if ( (recursion_depth >= max_recursion_depth) || (influence < min_influence) )
+    if ( recursion_depth >= max_recursion_depth )
+    {
+        Render_Stats::local().depth_cutoffs++;
+        return output;
+    }
+    if ( influence < min_influence )
+    {
+        Render_Stats::local().influence_cutoffs++;
         return output;
+    }
 
-    float  closest_depth = 0.0f;
-    Shape* closest_shape = intersection_closest(ray, closest_depth);
+    // Only rays past the cutoffs are traced and counted, primary rays are
+    // counted per pixel sample by render_tile()
+    if ( recursion_depth > 0 )
+        Render_Stats::local().reflection_rays++;
+
+    float        closest_depth   = 0.0f;
+    const Shape* closest_surface = nullptr;
+    Shape*       closest_shape   = intersection_closest( ray, 
+                                                         closest_depth, 
+                                                         nullptr,
+                                                         &closest_surface );
 
     if ( closest_shape != nullptr )
     {
         Vec3  point  = (ray.dir * closest_depth) + ray.ori;
-        Vec3  normal = closest_shape->get_normal(point);
+        Vec3  normal = closest_surface->get_normal(point);
+
+        if ( dependency_tracking && Tile_Dependencies::recording() )
+            Tile_Dependencies::recording()->add_shaded(closest_shape->id, point);
 
+        Color reflected;
+
+        // Colors stay unclamped, quantization clamps them
         output = shade_point( ray, 
                               point, 
                               normal, 
                               closest_shape->material,
-                              recursion_depth );
+                              recursion_depth,
+                              closest_depth,
+                              &reflected );
 
-        output.red   = ( output.red   > 1.0f ) ? 1.0f : output.red;
-        output.green = ( output.green > 1.0f ) ? 1.0f : output.green;
-        output.blue  = ( output.blue  > 1.0f ) ? 1.0f : output.blue;
+        if ( sample != nullptr )
+        {
+            sample->depth     = closest_depth;
+            sample->normal    = normal;
+            sample->albedo    = closest_shape->material.color;
+            sample->shape_id  = closest_shape->id;
+            sample->direct    = output - reflected;
+            sample->reflected = reflected;
+        }
     }
     else
     {
@@ -142,41 +1561,101 @@ Color Raytracer::cast_ray( const Ray& ray,
 
 Shape* Raytracer::intersection_closest( const Ray& ray, 
                                         float& closest_depth, 
-                                        Shape* ignore_shape ) const
+                                        Shape* ignore_shape,
+                                        const Shape** closest_surface ) const
 {
     Shape* closest_shape = nullptr;
     closest_depth = std::numeric_limits<float>::max();
 
-    for ( Shape* shape : shapes )
+    const Shape* surface = nullptr;
+
+    Render_Counters& counters = Render_Stats::local();
+
+    // Clusters of paged meshes pinned for the surface of the previous ray
+    std::vector<std::shared_ptr<const Mesh>>& pins = Page_Faults::local().pins;
+    if ( !pins.empty() )
+        pins.clear();
+
+    // Equal depths go to the shape added first, the same as testing all
+    // shapes in order
+    auto test = [&](Shape* shape)
     {
-        if ( shape != ignore_shape )
+        if ( shape == ignore_shape )
+            return;
+
+        counters.shape_tests++;
+        float depth = shape->intersect(ray, surface);
+
+        if ( ( depth > 0.0001f ) &&
+             ( ( depth < closest_depth ) ||
+               ( ( depth == closest_depth ) && closest_shape && ( shape->id < closest_shape->id ) ) ) )
         {
-            float depth = shape->intersect(ray);
+            closest_depth = depth;
+            closest_shape = shape;
 
-            if ( ( depth > 0.0001f ) && ( depth < closest_depth) )
-            {
-                closest_depth = depth;
-                closest_shape = shape;
-            }
+            if ( closest_surface != nullptr )
+                *closest_surface = surface;
         }
+    };
+
+    // cast_ray() called directly after editing the scene
+    if ( !scene_bvh_built || shapes_moved )
+    {
+        counters.traversal_steps += shapes.size();
+
+        for ( Shape* shape : shapes )
+            test(shape);
+    }
+    else
+    {
+        counters.traversal_steps += unbounded_shapes.size();
+
+        for ( Shape* shape : unbounded_shapes )
+            test(shape);
+
+        counters.traversal_steps += scene_wide_bvh.traverse( ray.ori, ray.dir, closest_depth, [&](int i)
+        {
+            test(bounded_shapes[i]);
+        });
     }
 
+    if ( closest_shape != nullptr )
+        counters.hits++;
+
     return closest_shape;
 }
 
+Ray Raytracer::secondary_ray( const Ray&  ray,
+                              const Vec3& dir,
+                              const Vec3& point,
+                              float distance,
+                              float weight ) const
+{
+    if ( !level_of_detail )
+        return Ray(dir, point);
+
+    return ray.secondary(dir, point, distance, weight);
+}
+
 bool Raytracer::point_in_shadow( const Light* light,
-                                 const Vec3&  light_direction,
-                                 const Vec3&  point ) const
+                                 const Ray&   shadow_ray ) const
 {
-    Ray   shadow_ray(light_direction, point);
+    const Vec3& point = shadow_ray.ori;
     float shadow_depth;
+
+    Render_Stats::local().shadow_rays++;
     
     Shape* closest_shape_shadow = intersection_closest( shadow_ray,
                                                         shadow_depth );
 
     float light_distance = light->get_distance(point);
 
-    return (closest_shape_shadow == nullptr ) || ( shadow_depth > light_distance);
+    bool lit = (closest_shape_shadow == nullptr ) || ( shadow_depth > light_distance);
+
+    if ( !lit && dependency_tracking && Tile_Dependencies::recording() )
+        Tile_Dependencies::recording()->add_occluder(closest_shape_shadow->id);
+
+    return lit;
 }
 
 
@@ -184,21 +1663,30 @@ Color Raytracer::shade_point( const Ray& ray,
                               const Vec3& point,
                               const Vec3& normal,
                               const Material& material,
-                              int recursion_depth ) const
+                              int recursion_depth,
+                              float distance,
+                              Color* reflected ) const
 {
     Color diffuse;
     Color specular;
     Color reflection;
 
-    for ( Light* light : lights )
+    Tile_Dependencies* dependencies = dependency_tracking ? Tile_Dependencies::recording() : nullptr;
+
+    for ( int i = 0 ; i < (int) lights.size() ; i++ )
     {
+        const Light* light = lights[i];
+
         Vec3  light_direction = light->get_direction(point) * (-1.0f);
         float incident = normal * light_direction;
 
         if ( incident > 0.0f )
         {
-            if( point_in_shadow(light, light_direction, point) )
+            if( point_in_shadow(light, secondary_ray(ray, light_direction, point, distance, 1.0f)) )
             {
+                if ( dependencies != nullptr )
+                    dependencies->add_light(i);
+
                 diffuse  += shade_diffuse( incident,
                                            light, 
                                            material );
@@ -217,7 +1705,11 @@ Color Raytracer::shade_point( const Ray& ray,
                                    normal, 
                                    point, 
                                    material, 
-                                   recursion_depth);
+                                   recursion_depth,
+                                   distance );
+
+    if ( reflected != nullptr )
+        *reflected = reflection;
 
     return diffuse + specular + reflection + ( ambient * (1.0f - material.reflection));
 }
@@ -259,7 +1751,8 @@ Color Raytracer::shade_reflection( const Ray& ray,
                                    const Vec3& normal,
                                    const Vec3& point,
                                    const Material& material,
-                                   int recursion_depth ) const
+                                   int recursion_depth,
+                                   float distance ) const
 {
     if ( material.reflection > 0.0f )
     {
@@ -267,7 +1760,10 @@ Color Raytracer::shade_reflection( const Ray& ray,
 
         reflection.normalize(); // ????
         
-        Ray ray_reflection(reflection, point);
+        Ray ray_reflection = secondary_ray(ray, reflection, point, distance, material.reflection);
+
+        if ( dependency_tracking && Tile_Dependencies::recording() )
+            Tile_Dependencies::recording()->reflections = true;
 
         return material.reflection * cast_ray( ray_reflection,
                                                recursion_depth + 1,
@@ -0,0 +1,249 @@
+#include "render_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <streambuf>
+
+#include "scene_io.h"
+
+namespace
+{
+    const char MAGIC[8] = { 'R', 'T', 'T', 'I', 'L', 'E', '\0', '\0' };
+
+    // Hashes what is written instead of keeping it, meshes can be large
+    class Hash_Buffer : public std::streambuf
+    {
+        public:
+
+            uint64_t hash = FNV_OFFSET;
+
+        protected:
+
+            int_type overflow(int_type c) override
+            {
+                if ( c != traits_type::eof() )
+                {
+                    char byte = (char) c;
+                    hash = fnv1a(&byte, 1, hash);
+                }
+
+                return traits_type::not_eof(c);
+            }
+
+            std::streamsize xsputn(const char* s, std::streamsize n) override
+            {
+                hash = fnv1a(s, (size_t) n, hash);
+                return n;
+            }
+    };
+}
+
+
+//  --  Helper functions  --  //
+
+uint64_t hash_scene(const Raytracer& rt)
+{
+    Hash_Buffer  buffer;
+    std::ostream os(&buffer);
+
+    if ( !write_scene_binary(os, rt) )
+        return 0;
+
+    return buffer.hash;
+}
+
+
+//  --  class Render_Cache  --  //
+
+// Constructors
+Render_Cache::Render_Cache(const std::string& _directory, uint64_t _capacity)
+    : directory(_directory), capacity(_capacity)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+
+    // Oldest first, so the most recently written ends up in front
+    std::vector<std::pair<fs::file_time_type, fs::path>> files;
+
+    for ( const fs::directory_entry& file : fs::directory_iterator(directory, error) )
+    {
+        if ( file.path().extension() == ".tile" )
+            files.push_back( std::make_pair(file.last_write_time(error), file.path()) );
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for ( const auto& file : files )
+    {
+        uint64_t key = std::strtoull(file.second.stem().string().c_str(), nullptr, 16);
+        uint64_t file_size = fs::file_size(file.second, error);
+
+        if ( error || entries.count(key) )
+            continue;
+
+        uses.push_front(key);
+        entries[key] = Entry{ file_size, uses.begin() };
+        size += file_size;
+    }
+
+    evict();
+}
+
+// Member functions
+bool Render_Cache::load(uint64_t key, std::vector<uint8_t>& data)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entries.find(key);
+        if ( entry == entries.end() )
+        {
+            misses++;
+            return false;
+        }
+
+        uses.splice(uses.begin(), uses, entry->second.use);
+    }
+
+    std::ifstream ifs(filename(key), std::ios::binary);
+
+    char     magic[8];
+    uint64_t stored_key  = 0;
+    uint64_t stored_size = 0;
+
+    bool ok = ifs.read(magic, sizeof(magic)) &&
+              (std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0) &&
+              ifs.read((char*) &stored_key, sizeof(stored_key)) &&
+              ifs.read((char*) &stored_size, sizeof(stored_size)) &&
+              (stored_key == key) && (stored_size < (1ull << 32));
+
+    if ( ok )
+    {
+        data.resize(stored_size);
+        ok = (bool) ifs.read((char*) data.data(), stored_size);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if ( !ok )
+    {
+        // Deleted or damaged behind our back, forget it
+        auto entry = entries.find(key);
+        if ( entry != entries.end() )
+        {
+            size -= entry->second.size;
+            uses.erase(entry->second.use);
+            entries.erase(entry);
+        }
+
+        misses++;
+        return false;
+    }
+
+    // Keeps the use order for the next process
+    std::error_code error;
+    std::filesystem::last_write_time( filename(key),
+                                      std::filesystem::file_time_type::clock::now(),
+                                      error );
+    hits++;
+
+    return true;
+}
+
+bool Render_Cache::store(uint64_t key, const uint8_t* data, size_t data_size)
+{
+    std::string name = filename(key);
+
+    // Written under a temporary name so readers never see half a tile
+    std::string temporary = name + ".tmp";
+    {
+        std::ofstream ofs(temporary, std::ios::binary);
+
+        uint64_t stored_size = data_size;
+
+        ofs.write(MAGIC, sizeof(MAGIC));
+        ofs.write((const char*) &key, sizeof(key));
+        ofs.write((const char*) &stored_size, sizeof(stored_size));
+        ofs.write((const char*) data, data_size);
+
+        if ( !ofs )
+            return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::error_code error;
+    std::filesystem::rename(temporary, name, error);
+
+    if ( error )
+    {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    uint64_t file_size = sizeof(MAGIC) + 2 * sizeof(uint64_t) + data_size;
+
+    auto entry = entries.find(key);
+    if ( entry != entries.end() )
+    {
+        size -= entry->second.size;
+        uses.erase(entry->second.use);
+        entries.erase(entry);
+    }
+
+    uses.push_front(key);
+    entries[key] = Entry{ file_size, uses.begin() };
+    size += file_size;
+
+    evict();
+
+    return true;
+}
+
+uint64_t Render_Cache::get_size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return size;
+}
+
+uint64_t Render_Cache::get_hits()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+uint64_t Render_Cache::get_misses()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::string Render_Cache::filename(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.tile", (unsigned long long) key);
+
+    return (std::filesystem::path(directory) / name).string();
+}
+
+void Render_Cache::evict()
+{
+    std::error_code error;
+
+    while ( (size > capacity) && !uses.empty() )
+    {
+        uint64_t key = uses.back();
+
+        std::filesystem::remove(filename(key), error);
+
+        size -= entries[key].size;
+        entries.erase(key);
+        uses.pop_back();
+    }
+}
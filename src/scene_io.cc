@@ -0,0 +1,1010 @@
+#include "scene_io.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include "assets.h"
+#include "paged_mesh.h"
+
+namespace
+{
+    const char MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+    enum Shape_Type : uint8_t
+    {
+        SHAPE_SPHERE   = 1,
+        SHAPE_PLANE    = 2,
+        SHAPE_TRIANGLE = 3,
+        SHAPE_MESH     = 4,
+        SHAPE_MESH_FILE = 5,    // Name of an obj file and the offset of the mesh
+        SHAPE_PAGED    = 6      // Name of a cluster file and the offset of the mesh
+    };
+
+    enum Light_Type : uint8_t
+    {
+        LIGHT_DIRECTION = 1
+    };
+
+    // -- Writing -- //
+
+    template < typename T >
+    void put(std::ostream& os, const T& value)
+    {
+        os.write((const char*) &value, sizeof(T));
+    }
+    void put(std::ostream& os, const Vec3& value)
+    {
+        put(os, value.x);
+        put(os, value.y);
+        put(os, value.z);
+    }
+    void put(std::ostream& os, const Color& value)
+    {
+        put(os, value.red);
+        put(os, value.green);
+        put(os, value.blue);
+    }
+    void put(std::ostream& os, const Material& value)
+    {
+        put(os, value.color);
+        put(os, value.specular);
+        put(os, value.reflection);
+    }
+    void put(std::ostream& os, const std::string& value)
+    {
+        put(os, (uint32_t) value.size());
+        os.write(value.data(), value.size());
+    }
+
+    // -- Reading -- //
+
+    template < typename T >
+    bool get(std::istream& is, T& value)
+    {
+        return (bool) is.read((char*) &value, sizeof(T));
+    }
+    bool get(std::istream& is, Vec3& value)
+    {
+        return get(is, value.x) && get(is, value.y) && get(is, value.z);
+    }
+    bool get(std::istream& is, Color& value)
+    {
+        return get(is, value.red) && get(is, value.green) && get(is, value.blue);
+    }
+    bool get(std::istream& is, Material& value)
+    {
+        return get(is, value.color) && get(is, value.specular) && get(is, value.reflection);
+    }
+    bool get(std::istream& is, std::string& value)
+    {
+        uint32_t size;
+
+        // Longer than any path
+        if ( !get(is, size) || (size > 4096) )
+            return false;
+
+        value.resize(size);
+        return (bool) is.read(&value[0], size);
+    }
+
+    bool read_header(std::istream& is, uint32_t& version, int& width, int& height)
+    {
+        char     magic[8];
+        int32_t  w, h;
+
+        if ( !is.read(magic, sizeof(magic)) || (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) )
+            return false;
+
+        // Version 1 has no camera orientation
+        if ( !get(is, version) || (version < 1) || (version > SCENE_BINARY_VERSION) )
+            return false;
+
+        if ( !get(is, w) || !get(is, h) )
+            return false;
+
+        width  = w;
+        height = h;
+
+        return true;
+    }
+
+    // -- Mesh files -- //
+
+    // Meshes are added to the scene empty while parsing, so shapes keep
+    // their order, and filled in by an Asset_Loader. Without one given, a
+    // loader of its own reads them all before the scene is returned.
+    class Mesh_Loads
+    {
+        private:
+
+            std::string   directory;
+            Mesh_Cache*   meshes;
+            Asset_Loader* assets;
+
+            std::unique_ptr<Asset_Loader> own_assets;
+
+        public:
+
+            Mesh_Loads( const std::string& _directory,
+                        Mesh_Cache* _meshes,
+                        Asset_Loader* _assets )
+                : directory{_directory}, meshes{_meshes}, assets{_assets} {}
+
+            // Relative paths are taken from the directory of the scene
+            std::string resolve(const std::string& filename) const
+            {
+                std::filesystem::path path(filename);
+
+                if ( !directory.empty() && path.is_relative() )
+                    path = std::filesystem::path(directory) / path;
+
+                return path.string();
+            }
+
+            Mesh* add(const std::string& filename, const Vec3& position)
+            {
+                if ( assets == nullptr )
+                {
+                    own_assets.reset(new Asset_Loader(0, meshes));
+                    assets = own_assets.get();
+                }
+
+                Mesh* mesh = new Mesh( std::vector<Triangle>() );
+                assets->load_mesh(mesh, resolve(filename), position);
+
+                return mesh;
+            }
+
+            bool finish(Raytracer& rt, std::string& error)
+            {
+                if ( !own_assets )
+                    return true;
+
+                own_assets->wait();
+                own_assets->apply(rt);
+
+                for ( const Asset_Loader::Asset& asset : own_assets->get_assets() )
+                {
+                    if ( asset.failed )
+                    {
+                        error = "unable to read mesh: " + asset.filename;
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+    };
+
+    // -- Text -- //
+
+    // Cursor over one line of a text scene
+    class Line_Reader
+    {
+        private:
+
+            const char* p;
+
+            void skip_spaces()
+            {
+                while ( (*p == ' ') || (*p == '\t') || (*p == '\r') )
+                    p++;
+            }
+
+        public:
+
+            Line_Reader(const char* line) : p{line} {}
+
+            bool word(std::string& value)
+            {
+                skip_spaces();
+
+                const char* start = p;
+                while ( (*p != '\0') && (*p != ' ') && (*p != '\t') && (*p != '\r') )
+                    p++;
+
+                value.assign(start, p);
+                return p != start;
+            }
+
+            // Plain decimals of up to 15 digits, what write_scene_text()
+            // produces, are converted here. strtof() takes most of the load
+            // time of large scenes otherwise. Other forms, and longer ones,
+            // are left to it.
+            bool decimal(float& value)
+            {
+                static const double POWERS_OF_TEN[16] =
+                {
+                    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+                    1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+                };
+
+                const char* s = p;
+
+                bool negative = ( *s == '-' );
+                if ( (*s == '-') || (*s == '+') )
+                    s++;
+
+                uint64_t mantissa = 0;
+                int      digits   = 0;
+                int      decimals = 0;
+
+                for ( ; (*s >= '0') && (*s <= '9') ; s++, digits++ )
+                    mantissa = mantissa * 10 + (*s - '0');
+
+                if ( *s == '.' )
+                {
+                    for ( s++ ; (*s >= '0') && (*s <= '9') ; s++, digits++, decimals++ )
+                        mantissa = mantissa * 10 + (*s - '0');
+                }
+
+                if ( (digits == 0) || (digits > 15) || (*s == 'e') || (*s == 'E') )
+                    return false;
+
+                // Below 2^53 both are exact in a double, so the quotient is
+                // the correctly rounded double
+                double parsed = (double) mantissa / POWERS_OF_TEN[decimals];
+
+                value = (float) ( negative ? -parsed : parsed );
+                p     = s;
+                return true;
+            }
+
+            // Leave value as it is when there is no number, for optional ones
+            bool number(float& value)
+            {
+                skip_spaces();
+
+                if ( decimal(value) )
+                    return true;
+
+                char* end;
+                float parsed = std::strtof(p, &end);
+
+                if ( end == p )
+                    return false;
+
+                value = parsed;
+                p     = end;
+                return true;
+            }
+
+            bool number(int& value)
+            {
+                char* end;
+                long parsed = std::strtol(p, &end, 10);
+
+                if ( end == p )
+                    return false;
+
+                value = (int) parsed;
+                p     = end;
+                return true;
+            }
+
+            bool vec3(Vec3& value)
+            {
+                return number(value.x) && number(value.y) && number(value.z);
+            }
+
+            bool color(Color& value)
+            {
+                return number(value.red) && number(value.green) && number(value.blue);
+            }
+
+            // Color with optional specular and reflection
+            bool material(Material& value)
+            {
+                if ( !color(value.color) )
+                    return false;
+
+                if ( number(value.specular) )
+                    number(value.reflection);
+
+                return true;
+            }
+
+            bool end()
+            {
+                skip_spaces();
+                return *p == '\0';
+            }
+    };
+
+    void put_text(std::ostream& os, const Vec3& value)
+    {
+        os << value.x << " " << value.y << " " << value.z;
+    }
+    void put_text(std::ostream& os, const Color& value)
+    {
+        os << value.red << " " << value.green << " " << value.blue;
+    }
+    void put_text(std::ostream& os, const Material& value)
+    {
+        put_text(os, value.color);
+        os << "  " << value.specular << " " << value.reflection;
+    }
+}
+
+
+//  --  class Mesh_Cache  --  //
+
+// Member functions
+std::shared_ptr<const Mesh> Mesh_Cache::get(const std::string& filename)
+{
+    std::shared_ptr<const Mesh> mesh = find(filename);
+
+    if ( mesh )
+        return mesh;
+
+    // Loaded outside of the lock, two threads may race to load the same
+    // file and the first one is kept
+    mesh = std::make_shared<const Mesh>(filename.c_str());
+
+    if ( mesh->get_triangles().empty() )
+        return nullptr;
+
+    return insert(filename, mesh);
+}
+
+std::shared_ptr<const Mesh> Mesh_Cache::find(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto cached = meshes.find(filename);
+    if ( cached == meshes.end() )
+        return nullptr;
+
+    return cached->second;
+}
+
+std::shared_ptr<const Mesh> Mesh_Cache::insert(const std::string& filename,
+                                               std::shared_ptr<const Mesh> mesh)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return meshes.emplace(filename, mesh).first->second;
+}
+
+Mesh* Mesh_Cache::instance(const std::string& filename, const Vec3& position)
+{
+    std::shared_ptr<const Mesh> mesh = get(filename);
+
+    if ( !mesh )
+        return nullptr;
+
+    // Shares the geometry, only the offset is the instance's own
+    Mesh* copy = new Mesh(*mesh);
+    copy->translate(position);
+
+    return copy;
+}
+
+int Mesh_Cache::get_size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) meshes.size();
+}
+
+
+//  --  Binary scene format  --  //
+
+bool write_scene_binary(std::ostream& os, const Raytracer& rt, bool mesh_references)
+{
+    const Camera& camera = rt.get_camera();
+
+    os.write(MAGIC, sizeof(MAGIC));
+    put(os, SCENE_BINARY_VERSION);
+
+    // Camera
+    put(os, (int32_t) camera.get_width());
+    put(os, (int32_t) camera.get_height());
+    put(os, camera.get_fov());
+    put(os, camera.get_position());
+    put(os, camera.get_forward());
+    put(os, camera.get_right());
+    put(os, camera.get_up());
+    put(os, camera.get_aperture());
+    put(os, camera.get_focus_distance());
+
+    // Settings
+    put(os, (int32_t) rt.get_max_recursion_depth());
+    put(os, rt.get_min_influence());
+    put(os, rt.get_ambient());
+    put(os, rt.get_background());
+
+    // Lights
+    std::vector<const Light_Direction*> lights;
+    for ( const Light* light : rt.get_lights() )
+    {
+        const Light_Direction* light_direction = dynamic_cast<const Light_Direction*>(light);
+
+        if ( light_direction != nullptr )
+            lights.push_back(light_direction);
+    }
+
+    put(os, (uint32_t) lights.size());
+    for ( const Light_Direction* light : lights )
+    {
+        put(os, LIGHT_DIRECTION);
+        put(os, light->color);
+        put(os, light->intensity);
+        put(os, light->direction);
+    }
+
+    // Shapes
+    put(os, (uint32_t) rt.get_shapes().size());
+    for ( const Shape* shape : rt.get_shapes() )
+    {
+        if ( const Sphere* sphere = dynamic_cast<const Sphere*>(shape) )
+        {
+            put(os, SHAPE_SPHERE);
+            put(os, shape->material);
+            put(os, sphere->center);
+            put(os, sphere->radius);
+        }
+        else if ( const Plane* plane = dynamic_cast<const Plane*>(shape) )
+        {
+            put(os, SHAPE_PLANE);
+            put(os, shape->material);
+            put(os, plane->position);
+            put(os, plane->normal);
+        }
+        else if ( const Triangle* triangle = dynamic_cast<const Triangle*>(shape) )
+        {
+            put(os, SHAPE_TRIANGLE);
+            put(os, shape->material);
+            put(os, triangle->vertex_a);
+            put(os, triangle->vertex_b);
+            put(os, triangle->vertex_c);
+        }
+        else if ( const Paged_Mesh* paged = dynamic_cast<const Paged_Mesh*>(shape) )
+        {
+            // Always by reference, the file may not fit in memory
+            put(os, SHAPE_PAGED);
+            put(os, shape->material);
+            put(os, paged->get_filename());
+            put(os, paged->get_offset());
+        }
+        else if ( const Mesh* mesh = dynamic_cast<const Mesh*>(shape) )
+        {
+            if ( mesh_references && !mesh->get_source().empty() )
+            {
+                put(os, SHAPE_MESH_FILE);
+                put(os, shape->material);
+                put(os, mesh->get_source());
+                put(os, mesh->get_source_offset());
+                continue;
+            }
+
+            put(os, SHAPE_MESH);
+            put(os, shape->material);
+            put(os, (uint32_t) mesh->get_triangles().size());
+
+            Vec3 offset = mesh->get_offset();
+
+            for ( const Triangle& triangle : mesh->get_triangles() )
+            {
+                put(os, triangle.vertex_a + offset);
+                put(os, triangle.vertex_b + offset);
+                put(os, triangle.vertex_c + offset);
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return (bool) os;
+}
+
+bool read_scene_binary( std::istream& is,
+                        Raytracer& rt,
+                        Mesh_Cache* meshes,
+                        const std::string& directory,
+                        Asset_Loader* assets )
+{
+    uint32_t version;
+    int      width, height;
+
+    if ( !read_header(is, version, width, height) || (width <= 0) || (height <= 0) )
+        return false;
+
+    // Camera
+    float fov;
+    Vec3  position;
+    Vec3  forward(0.0f, 0.0f, 1.0f);
+    Vec3  right(1.0f, 0.0f, 0.0f);
+    Vec3  up(0.0f, 1.0f, 0.0f);
+
+    if ( !get(is, fov) || !get(is, position) )
+        return false;
+
+    if ( (version >= 2) && (!get(is, forward) || !get(is, right) || !get(is, up)) )
+        return false;
+
+    // Pinhole before version 5
+    float aperture       = 0.0f;
+    float focus_distance = 1.0f;
+
+    if ( (version >= 5) && (!get(is, aperture) || !get(is, focus_distance)) )
+        return false;
+
+    Camera camera(width, height, fov);
+    camera.set_position(position);
+    camera.set_basis(forward, right, up);
+    camera.set_lens(aperture, focus_distance);
+    camera.set_resolution(rt.get_width(), rt.get_height());
+    rt.set_camera(camera);
+
+    // Settings
+    int32_t max_recursion_depth;
+    float   min_influence;
+    Color   ambient, background;
+
+    if ( !get(is, max_recursion_depth) || !get(is, min_influence) ||
+         !get(is, ambient) || !get(is, background) )
+        return false;
+
+    rt.set_max_recursion_depth(max_recursion_depth);
+    rt.set_min_influence(min_influence);
+    rt.set_ambient(ambient);
+    rt.set_background(background);
+
+    // Lights
+    uint32_t light_count;
+    if ( !get(is, light_count) )
+        return false;
+
+    rt.reserve(0, (int) std::min(light_count, 1024u));
+
+    for ( uint32_t i = 0 ; i < light_count ; i++ )
+    {
+        uint8_t type;
+        Color   color;
+        float   intensity;
+        Vec3    direction;
+
+        if ( !get(is, type) || (type != LIGHT_DIRECTION) )
+            return false;
+
+        if ( !get(is, color) || !get(is, intensity) || !get(is, direction) )
+            return false;
+
+        Light_Direction* light = new Light_Direction(direction, color, intensity);
+
+        // Normalizing again may change the last bit, keep the stored value
+        light->direction = direction;
+        rt.add(light);
+    }
+
+    // Shapes
+    uint32_t shape_count;
+    if ( !get(is, shape_count) )
+        return false;
+
+    // A damaged count should not allocate gigabytes up front
+    rt.reserve((int) std::min(shape_count, 1u << 24), 0);
+
+    Mesh_Loads mesh_loads(directory, meshes, assets);
+
+    for ( uint32_t i = 0 ; i < shape_count ; i++ )
+    {
+        uint8_t  type;
+        Material material(Color(Color::LIGHT_GRAY));
+
+        if ( !get(is, type) || !get(is, material) )
+            return false;
+
+        Shape* shape = nullptr;
+
+        switch ( type )
+        {
+            case SHAPE_SPHERE :
+            {
+                Vec3  center;
+                float radius;
+
+                if ( get(is, center) && get(is, radius) )
+                    shape = new Sphere(center, radius);
+                break;
+            }
+            case SHAPE_PLANE :
+            {
+                Vec3 position, normal;
+
+                if ( get(is, position) && get(is, normal) )
+                    shape = new Plane(position, normal);
+                break;
+            }
+            case SHAPE_TRIANGLE :
+            {
+                Vec3 a, b, c;
+
+                if ( get(is, a) && get(is, b) && get(is, c) )
+                    shape = new Triangle(a, b, c);
+                break;
+            }
+            case SHAPE_MESH :
+            {
+                uint32_t count;
+
+                if ( !get(is, count) )
+                    break;
+
+                std::vector<Triangle> triangles;
+                triangles.reserve(count);
+
+                Vec3 a, b, c;
+                for ( uint32_t t = 0 ; t < count ; t++ )
+                {
+                    if ( !get(is, a) || !get(is, b) || !get(is, c) )
+                        return false;
+
+                    triangles.push_back( Triangle(a, b, c) );
+                }
+
+                shape = new Mesh(triangles);
+                break;
+            }
+            case SHAPE_MESH_FILE :
+            {
+                std::string filename;
+                Vec3        offset;
+
+                if ( get(is, filename) && get(is, offset) )
+                    shape = mesh_loads.add(filename, offset);
+                break;
+            }
+            case SHAPE_PAGED :
+            {
+                std::string filename;
+                Vec3        offset;
+
+                if ( !get(is, filename) || !get(is, offset) )
+                    break;
+
+                Paged_Mesh* paged = new Paged_Mesh(mesh_loads.resolve(filename), offset);
+
+                if ( paged->is_open() )
+                    shape = paged;
+                else
+                    delete paged;
+                break;
+            }
+        }
+
+        if ( shape == nullptr )
+            return false;
+
+        shape->material = material;
+        rt.add(shape);
+    }
+
+    std::string error;
+    return mesh_loads.finish(rt, error);
+}
+
+bool read_scene_binary_size(std::istream& is, int& width, int& height)
+{
+    uint32_t version;
+    return read_header(is, version, width, height);
+}
+
+
+//  --  Text scene format  --  //
+
+bool write_scene_text(std::ostream& os, const Raytracer& rt)
+{
+    const Camera& camera = rt.get_camera();
+
+    // Enough digits to read back the same floats
+    std::streamsize precision = os.precision(std::numeric_limits<float>::max_digits10);
+
+    os << "rtscene " << SCENE_TEXT_VERSION << "\n\n";
+
+    os << "camera     ";
+    put_text(os, camera.get_position());
+    os << "  ";
+    put_text(os, camera.get_position() + camera.get_forward());
+    os << "  " << camera.get_fov() << "\n";
+    os << "lens       " << camera.get_aperture() << " " << camera.get_focus_distance() << "\n";
+
+    os << "recursion  " << rt.get_max_recursion_depth() << " " << rt.get_min_influence() << "\n";
+    os << "ambient    ";
+    put_text(os, rt.get_ambient());
+    os << "\nbackground ";
+    put_text(os, rt.get_background());
+    os << "\n\n";
+
+    for ( const Light* light : rt.get_lights() )
+    {
+        if ( const Light_Direction* light_direction = dynamic_cast<const Light_Direction*>(light) )
+        {
+            os << "light      ";
+            put_text(os, light_direction->direction);
+            os << "  ";
+            put_text(os, light->color);
+            os << "  " << light->intensity << "\n";
+        }
+    }
+
+    os << "\n";
+
+    bool ok = true;
+
+    for ( const Shape* shape : rt.get_shapes() )
+    {
+        if ( const Sphere* sphere = dynamic_cast<const Sphere*>(shape) )
+        {
+            os << "sphere     ";
+            put_text(os, sphere->center);
+            os << "  " << sphere->radius << "  ";
+        }
+        else if ( const Plane* plane = dynamic_cast<const Plane*>(shape) )
+        {
+            os << "plane      ";
+            put_text(os, plane->position);
+            os << "  ";
+            put_text(os, plane->normal);
+            os << "  ";
+        }
+        else if ( const Triangle* triangle = dynamic_cast<const Triangle*>(shape) )
+        {
+            os << "triangle   ";
+            put_text(os, triangle->vertex_a);
+            os << "  ";
+            put_text(os, triangle->vertex_b);
+            os << "  ";
+            put_text(os, triangle->vertex_c);
+            os << "  ";
+        }
+        else if ( const Mesh* mesh = dynamic_cast<const Mesh*>(shape) )
+        {
+            // Only written by reference
+            if ( mesh->get_source().empty() )
+            {
+                os << "# mesh without a file\n";
+                ok = false;
+                continue;
+            }
+
+            os << "mesh       " << mesh->get_source() << "  ";
+            put_text(os, mesh->get_source_offset());
+            os << "  ";
+        }
+        else if ( const Paged_Mesh* paged = dynamic_cast<const Paged_Mesh*>(shape) )
+        {
+            os << "paged      " << paged->get_filename() << "  ";
+            put_text(os, paged->get_offset());
+            os << "  ";
+        }
+        else
+        {
+            ok = false;
+            continue;
+        }
+
+        put_text(os, shape->material);
+        os << "\n";
+    }
+
+    os.precision(precision);
+
+    return ok && (bool) os;
+}
+
+bool read_scene_text( std::istream& is,
+                      Raytracer& rt,
+                      std::string& error,
+                      Mesh_Cache* meshes,
+                      const std::string& directory,
+                      Asset_Loader* assets )
+{
+    int width  = rt.get_width();
+    int height = rt.get_height();
+
+    Mesh_Loads mesh_loads(directory, meshes, assets);
+
+    std::string line;
+    std::string statement;
+
+    bool first = true;
+
+    while ( std::getline(is, line) )
+    {
+        size_t comment = line.find('#');
+        if ( comment != std::string::npos )
+            line.resize(comment);
+
+        Line_Reader reader(line.c_str());
+
+        if ( !reader.word(statement) )
+            continue;
+
+        bool ok = true;
+
+        if ( statement == "rtscene" )
+        {
+            int version;
+            ok = first && reader.number(version) && (version >= 1) && (version <= SCENE_TEXT_VERSION);
+        }
+        else if ( statement == "camera" )
+        {
+            Vec3  position, target;
+            float fov = rt.get_camera().get_fov();
+
+            ok = reader.vec3(position) && reader.vec3(target);
+            reader.number(fov);
+
+            // The lens is kept, whichever statement comes first
+            if ( ok )
+            {
+                const Camera& current = rt.get_camera();
+
+                Camera camera(width, height, fov);
+                camera.set_position(position);
+                camera.look_at(target);
+                camera.set_lens(current.get_aperture(), current.get_focus_distance());
+                rt.set_camera(camera);
+            }
+        }
+        else if ( statement == "lens" )
+        {
+            float aperture, focus_distance;
+            ok = reader.number(aperture) && reader.number(focus_distance);
+
+            if ( ok )
+            {
+                Camera camera = rt.get_camera();
+                camera.set_lens(aperture, focus_distance);
+                rt.set_camera(camera);
+            }
+        }
+        else if ( statement == "recursion" )
+        {
+            int   depth;
+            float influence;
+            ok = reader.number(depth) && reader.number(influence);
+
+            if ( ok )
+            {
+                rt.set_max_recursion_depth(depth);
+                rt.set_min_influence(influence);
+            }
+        }
+        else if ( (statement == "ambient") || (statement == "background") )
+        {
+            Color color;
+            ok = reader.color(color);
+
+            if ( ok && (statement == "ambient") )
+                rt.set_ambient(color);
+            else if ( ok )
+                rt.set_background(color);
+        }
+        else if ( statement == "light" )
+        {
+            Vec3  direction;
+            Color color;
+            float intensity = 1.0f;
+
+            ok = reader.vec3(direction) && reader.color(color);
+            reader.number(intensity);
+
+            if ( ok )
+                rt.add( new Light_Direction(direction, color, intensity) );
+        }
+        else
+        {
+            Material material{Color(Color::LIGHT_GRAY)};
+            Shape*   shape = nullptr;
+
+            if ( statement == "sphere" )
+            {
+                Vec3  center;
+                float radius;
+
+                if ( reader.vec3(center) && reader.number(radius) && reader.material(material) )
+                    shape = new Sphere(center, radius);
+            }
+            else if ( statement == "plane" )
+            {
+                Vec3 position, normal;
+
+                if ( reader.vec3(position) && reader.vec3(normal) && reader.material(material) )
+                    shape = new Plane(position, normal);
+            }
+            else if ( statement == "triangle" )
+            {
+                Vec3 a, b, c;
+
+                if ( reader.vec3(a) && reader.vec3(b) && reader.vec3(c) && reader.material(material) )
+                    shape = new Triangle(a, b, c);
+            }
+            else if ( statement == "mesh" )
+            {
+                std::string filename;
+                Vec3        position;
+
+                if ( reader.word(filename) && reader.vec3(position) && reader.material(material) )
+                    shape = mesh_loads.add(filename, position);
+            }
+            else if ( statement == "paged" )
+            {
+                std::string filename;
+                Vec3        position;
+
+                if ( reader.word(filename) && reader.vec3(position) && reader.material(material) )
+                {
+                    Paged_Mesh* paged = new Paged_Mesh(mesh_loads.resolve(filename), position);
+
+                    if ( paged->is_open() )
+                        shape = paged;
+                    else
+                        delete paged;
+                }
+            }
+
+            ok = ( shape != nullptr );
+
+            if ( ok )
+            {
+                shape->material = material;
+                rt.add(shape);
+            }
+        }
+
+        if ( !ok || !reader.end() )
+        {
+            error = "bad statement: " + line;
+            return false;
+        }
+
+        first = false;
+    }
+
+    return mesh_loads.finish(rt, error);
+}
+
+bool load_scene( const std::string& filename,
+                 Raytracer& rt,
+                 std::string& error,
+                 Mesh_Cache* meshes,
+                 Asset_Loader* assets )
+{
+    std::ifstream ifs(filename, std::ios::binary);
+
+    if ( !ifs.is_open() )
+    {
+        error = "unable to open " + filename;
+        return false;
+    }
+
+    std::string directory = std::filesystem::path(filename).parent_path().string();
+
+    char magic[sizeof(MAGIC)] = {};
+    ifs.read(magic, sizeof(magic));
+
+    ifs.clear();
+    ifs.seekg(0);
+
+    if ( std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 )
+    {
+        if ( read_scene_binary(ifs, rt, meshes, directory, assets) )
+            return true;
+
+        error = "malformed binary scene " + filename;
+        return false;
+    }
+
+    // Text is read line by line, binary mode only keeps the \r, which
+    // the reader skips
+    return read_scene_text(ifs, rt, error, meshes, directory, assets);
+}
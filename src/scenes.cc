@@ -0,0 +1,181 @@
+#include "scenes.h"
+
+#include <cmath>
+#include <random>
+
+//  --  Reference scenes  --  //
+
+void scene_default(Raytracer& rt)
+{
+    Light_Direction* light1 = new Light_Direction( Vec3(1.0f, -1.0f, 1.0f),
+                                                   Color(0.9f, 0.88f, 0.83f),
+                                                   1.0f );
+
+    Light_Direction* light2 = new Light_Direction( Vec3( -1.0f, -0.5f,  1.0f),
+                                                   Color( 0.45f, 0.45f, 0.5f),
+                                                   1.0f );
+
+    rt.add(light1);
+    rt.add(light2);
+
+    Sphere* sphere_left   = new Sphere( Vec3(-3.5f, -0.5f, 10.0f),  1.5f);
+    sphere_left->material = Material(Color(Color::ORANGE), 40.0f, 0.0f);
+
+    Sphere* sphere_middle   = new Sphere( Vec3( 0.0f, 1.0f, 12.0f), 3.0f);
+    sphere_middle->material = Material(Color(Color::GREEN), 200.0f, 0.0f);
+
+    Sphere* sphere_right   = new Sphere( Vec3( 2.5f, -0.5f, 9.0f), 1.5f);
+    sphere_right->material = Material(Color(Color::PURPLE), 40.0f, 0.0f);
+
+    rt.add(sphere_left);
+    rt.add(sphere_middle);
+    rt.add(sphere_right);
+
+    Plane* plane = new Plane(Vec3(0.0f, -2.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+    plane->material = Material(Color(Color::LIGHT_GRAY), 0.0, 0.0f);
+    rt.add(plane);
+}
+
+void scene_mesh(Raytracer& rt)
+{
+    rt.add( new Light_Direction( Vec3(1.0f, -1.0f, 1.0f),
+                                 Color(0.9f, 0.88f, 0.83f),
+                                 1.0f ) );
+
+    Sphere* sphere_left   = new Sphere( Vec3(-3.5f, -0.5f, 10.0f),  1.5f);
+    sphere_left->material = Material(Color(Color::ORANGE), 40.0f, 0.3f);
+    rt.add(sphere_left);
+
+    Mesh* mesh = new Mesh( tessellate_sphere(Vec3(0.0f, 1.0f, 12.0f), 3.0f, 12, 24) );
+    mesh->material = Material(Color(Color::GREEN), 200.0f, 0.0f);
+    rt.add(mesh);
+
+    Plane* plane = new Plane(Vec3(0.0f, -2.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+    plane->material = Material(Color(Color::LIGHT_GRAY), 0.0, 0.0f);
+    rt.add(plane);
+}
+
+
+//  --  Procedural scenes  --  //
+
+namespace
+{
+    // std::mt19937 output is fixed by the standard, distributions are not
+    class Scene_Random
+    {
+        private:
+
+            std::mt19937 engine;
+
+        public:
+
+            Scene_Random(unsigned int seed)
+                : engine{seed} {}
+
+            float operator () (float low, float high)
+            {
+                float t = (engine() >> 8) * (1.0f / 16777216.0f);
+                return low + (high - low) * t;
+            }
+    };
+}
+
+void scene_generate(Raytracer& rt, const Scene_Params& params)
+{
+    Scene_Random random(params.seed);
+
+    static const unsigned int palette[] = { Color::RED,  Color::YELLOW, Color::ORANGE,
+                                            Color::GREEN, Color::TEAL,  Color::BLUE,
+                                            Color::PURPLE };
+
+    for ( int i = 0 ; i < params.lights ; i++ )
+    {
+        Vec3 direction( random(-1.0f, 1.0f), random(-1.0f, -0.2f), random(-0.2f, 1.0f) );
+
+        // Keep the total light roughly constant with the light count
+        float scale = 1.2f / params.lights;
+
+        rt.add( new Light_Direction( direction,
+                                     Color( random(0.7f, 1.0f) * scale,
+                                            random(0.7f, 1.0f) * scale,
+                                            random(0.7f, 1.0f) * scale ),
+                                     1.0f ) );
+    }
+
+    for ( int i = 0 ; i < params.spheres ; i++ )
+    {
+        float radius = random(0.3f, 1.2f);
+
+        Sphere* sphere = new Sphere( Vec3( random(-10.0f, 10.0f),
+                                           random(-2.0f + radius, 5.0f),
+                                           random(8.0f, 30.0f) ),
+                                     radius );
+
+        float reflection = ( random(0.0f, 1.0f) < params.reflective_fraction ) ? 0.5f : 0.0f;
+
+        sphere->material = Material( Color(palette[i % 7]),
+                                     random(0.0f, 200.0f),
+                                     reflection );
+        rt.add(sphere);
+    }
+
+    if ( params.mesh_triangles > 0 )
+    {
+        // A sphere with r rings and 2 * (r - 1) segments has 4 * (r - 1)^2 triangles
+        int rings    = 1 + (int) std::lround( std::sqrt(params.mesh_triangles / 4.0f) );
+        rings        = ( rings < 2 ) ? 2 : rings;
+        int segments = 2 * (rings - 1);
+
+        Mesh* mesh = new Mesh( tessellate_sphere( Vec3( random(-3.0f, 3.0f), 1.0f, 16.0f ),
+                                                  3.0f,
+                                                  rings,
+                                                  segments ) );
+        mesh->material = Material(Color(Color::LIGHT_GRAY), 40.0f, 0.0f);
+        rt.add(mesh);
+    }
+
+    Plane* plane = new Plane(Vec3(0.0f, -2.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+    plane->material = Material(Color(Color::LIGHT_GRAY), 0.0, 0.0f);
+    rt.add(plane);
+}
+
+
+//  --  Helper functions  --  //
+
+std::vector<Triangle> tessellate_sphere( const Vec3& center,
+                                         float radius,
+                                         int rings,
+                                         int segments )
+{
+    std::vector<Triangle> triangles;
+    triangles.reserve(2 * (rings - 1) * segments);
+
+    auto point = [&](int ring, int segment)
+    {
+        float theta = PI * ring / rings;
+        float phi   = 2.0f * PI * segment / segments;
+
+        return center + Vec3( std::sin(theta) * std::cos(phi),
+                              std::cos(theta),
+                              std::sin(theta) * std::sin(phi) ) * radius;
+    };
+
+    for ( int ring = 0 ; ring < rings ; ring++ )
+    {
+        for ( int segment = 0 ; segment < segments ; segment++ )
+        {
+            Vec3 a = point(ring,     segment);
+            Vec3 b = point(ring,     segment + 1);
+            Vec3 c = point(ring + 1, segment);
+            Vec3 d = point(ring + 1, segment + 1);
+
+            // Triangles touching the poles collapse to a line
+            if ( ring > 0 )
+                triangles.push_back( Triangle(a, c, b) );
+            if ( ring < rings - 1 )
+                triangles.push_back( Triangle(b, c, d) );
+        }
+    }
+
+    return triangles;
+}
@@ -0,0 +1,141 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+//  --  class Render_Scheduler  --  //
+
+// Constructors
+Render_Scheduler::Render_Scheduler(int threads)
+{
+    if ( threads <= 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for ( int i = 0 ; i < threads ; i++ )
+    {
+        workers.emplace_back( [this, i]()
+        {
+            Trace::set_thread_name("scheduler " + std::to_string(i));
+            work_loop();
+        });
+    }
+}
+// Destructor
+Render_Scheduler::~Render_Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for ( std::thread& thread : workers )
+        thread.join();
+}
+
+// Member functions
+void Render_Scheduler::submit( std::shared_ptr<const Raytracer> rt,
+                               int priority,
+                               Progress progress )
+{
+    rt->begin_tiles();
+
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    frame->rt          = rt;
+    frame->priority    = std::min(std::max(priority, 1), MAX_PRIORITY);
+    frame->progress    = progress;
+    frame->tile_count  = rt->get_tile_count();
+    frame->start_point = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Joins at the pass of the frames still handing out tiles
+        bool first = true;
+        for ( const std::shared_ptr<Frame>& other : frames )
+        {
+            if ( other->cancelled || (other->next_tile == other->tile_count) )
+                continue;
+
+            frame->pass = first ? other->pass : std::min(frame->pass, other->pass);
+            first = false;
+        }
+
+        frames.push_back(frame);
+    }
+    condition.notify_all();
+}
+
+void Render_Scheduler::work_loop()
+{
+    while ( true )
+    {
+        std::shared_ptr<Frame> frame;
+        int tile;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            auto lowest_pass = [this]()
+            {
+                std::shared_ptr<Frame> lowest;
+
+                for ( const std::shared_ptr<Frame>& candidate : frames )
+                {
+                    if ( candidate->cancelled || (candidate->next_tile == candidate->tile_count) )
+                        continue;
+
+                    if ( !lowest || (candidate->pass < lowest->pass) )
+                        lowest = candidate;
+                }
+
+                return lowest;
+            };
+
+            condition.wait(lock, [&]()
+            {
+                frame = lowest_pass();
+                return stopping || frame;
+            });
+
+            if ( stopping )
+                return;
+
+            tile = frame->next_tile++;
+            frame->pass += STRIDE / frame->priority;
+        }
+
+        frame->rt->trace_tile(tile);
+
+        int  done;
+        bool complete;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            done     = ++frame->done;
+            complete = ( done == frame->tile_count );
+        }
+
+        if ( complete )
+        {
+            std::chrono::duration<double> delta_time =
+                std::chrono::steady_clock::now() - frame->start_point;
+
+            frame->rt->end_tiles(delta_time.count(), get_threads());
+        }
+
+        bool keep = frame->progress ? frame->progress(done, frame->tile_count) : true;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if ( !keep )
+                frame->cancelled = true;
+
+            // Forgotten once the last tile in flight is back
+            if ( (complete || frame->cancelled) && (frame->done == frame->next_tile) )
+                frames.erase( std::remove(frames.begin(), frames.end(), frame), frames.end() );
+        }
+    }
+}
@@ -0,0 +1,220 @@
+#include "sequence.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "image.h"
+#include "trace.h"
+
+namespace
+{
+    Vec3 lerp(const Vec3& a, const Vec3& b, float t)
+    {
+        return a + (b - a) * t;
+    }
+
+    // Index of the key at or before frame and the blend towards the next one
+    template <typename Key>
+    void find_keys(const std::vector<Key>& keys, float frame, int& index, float& t)
+    {
+        auto next = std::upper_bound( keys.begin(), keys.end(), frame,
+                                      [](float f, const Key& key) { return f < key.frame; } );
+
+        if ( next == keys.begin() )
+        {
+            index = 0;
+            t     = 0.0f;
+            return;
+        }
+
+        index = (int) (next - keys.begin()) - 1;
+
+        if ( next == keys.end() )
+        {
+            t = 0.0f;
+            return;
+        }
+
+        t = (frame - keys[index].frame) / (next->frame - keys[index].frame);
+    }
+
+    template <typename Key>
+    void insert_sorted(std::vector<Key>& keys, const Key& key)
+    {
+        auto position = std::upper_bound( keys.begin(), keys.end(), key.frame,
+                                          [](float f, const Key& other) { return f < other.frame; } );
+        keys.insert(position, key);
+    }
+}
+
+
+//  --  class Sequence  --  //
+
+// Member functions
+void Sequence::add_camera_key(const Camera_Key& key)
+{
+    insert_sorted(camera_keys, key);
+}
+void Sequence::add_object_key(int shape, const Object_Key& key)
+{
+    insert_sorted(object_keys[shape], key);
+}
+
+bool Sequence::load(std::istream& is)
+{
+    std::string line;
+
+    while ( std::getline(is, line) )
+    {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream iss(line);
+        std::string type;
+
+        if ( !(iss >> type) )
+            continue;
+
+        if ( type == "camera" )
+        {
+            Camera_Key key;
+            Vec3& p = key.position;
+            Vec3& t = key.target;
+
+            if ( !(iss >> key.frame >> p.x >> p.y >> p.z >> t.x >> t.y >> t.z) )
+                return false;
+
+            add_camera_key(key);
+        }
+        else if ( type == "object" )
+        {
+            int shape;
+            Object_Key key;
+            Vec3& p = key.position;
+
+            if ( !(iss >> shape >> key.frame >> p.x >> p.y >> p.z) )
+                return false;
+
+            add_object_key(shape, key);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Sequence::apply(Raytracer& rt, float frame) const
+{
+    int   index;
+    float t;
+
+    if ( !camera_keys.empty() )
+    {
+        find_keys(camera_keys, frame, index, t);
+
+        const Camera_Key& key  = camera_keys[index];
+        const Camera_Key& next = camera_keys[std::min(index + 1, (int) camera_keys.size() - 1)];
+
+        Vec3 position = lerp(key.position, next.position, t);
+        Vec3 target   = lerp(key.target,   next.target,   t);
+
+        Camera camera = rt.get_camera();
+        camera.set_position(position);
+
+        if ( (target - position).length() > 0.0f )
+            camera.look_at(target);
+
+        rt.set_camera(camera);
+    }
+
+    for ( auto& object : object_keys )
+    {
+        const std::vector<Object_Key>& keys = object.second;
+
+        find_keys(keys, frame, index, t);
+
+        const Object_Key& key  = keys[index];
+        const Object_Key& next = keys[std::min(index + 1, (int) keys.size() - 1)];
+
+        rt.set_position(object.first, lerp(key.position, next.position, t));
+    }
+}
+
+
+//  --  Helper functions  --  //
+
+std::string sequence_filename(const std::string& pattern, int frame)
+{
+    std::string number = std::to_string(frame);
+
+    size_t last = pattern.rfind('#');
+
+    if ( last == std::string::npos )
+    {
+        size_t dot = pattern.rfind('.');
+
+        if ( (dot == std::string::npos) || (pattern.find('/', dot) != std::string::npos) )
+            return pattern + "_" + number;
+
+        return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+    }
+
+    size_t first = last;
+    while ( (first > 0) && (pattern[first - 1] == '#') )
+        first--;
+
+    size_t digits = last - first + 1;
+    if ( number.size() < digits )
+        number.insert(0, digits - number.size(), '0');
+
+    return pattern.substr(0, first) + number + pattern.substr(last + 1);
+}
+
+bool render_sequence( Raytracer& rt,
+                      const Sequence& sequence,
+                      int frame_count,
+                      const std::string& pattern )
+{
+    int width  = rt.get_width();
+    int height = rt.get_height();
+
+    std::chrono::high_resolution_clock::time_point start_point;
+    start_point = std::chrono::high_resolution_clock::now();
+
+    double trace_seconds = 0.0;
+
+    // Two frames in flight, tracing only waits when writing falls behind
+    Ppm_Writer writer(width, height, 2);
+
+    for ( int frame = 0 ; frame < frame_count ; frame++ )
+    {
+        Trace_Scope trace_frame("sequence frame", frame);
+
+        sequence.apply(rt, (float) frame);
+        rt.render();
+
+        trace_seconds += rt.stats.get_frame_seconds();
+
+        uint8_t* buffer = writer.acquire();
+        std::memcpy(buffer, rt.frame, (size_t) width * height * 4);
+        writer.submit(buffer, sequence_filename(pattern, frame));
+
+        std::cout << "Frame " << frame << " : " << rt.stats.get_frame_seconds() << "s ("
+                  << rt.stats.mrays_per_second() << " Mrays/s)" << std::endl;
+    }
+
+    bool ok = writer.close();
+
+    std::chrono::duration<double> delta_time =
+        std::chrono::high_resolution_clock::now() - start_point;
+
+    std::cout << frame_count << " frames in " << delta_time.count() << "s, "
+              << trace_seconds << "s of it rendering" << std::endl;
+
+    return ok;
+}
@@ -0,0 +1,341 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <SFML/Network.hpp>
+
+#include "trace.h"
+
+namespace
+{
+    const size_t MAX_HEADER_SIZE = 16 * 1024;
+    const size_t MAX_BODY_SIZE   = 1024 * 1024;
+
+    struct Request
+    {
+        std::string method;
+        std::string path;
+        std::string body;
+    };
+
+    // Progress of one job, written by the render threads and sent by the
+    // connection thread
+    struct Job_State
+    {
+        std::mutex              mutex;
+        std::condition_variable changed;
+
+        int  done     = 0;
+        int  total    = 0;
+        bool complete = false;
+
+        std::atomic<bool> cancelled{false};
+    };
+
+    bool send_all(sf::TcpSocket& socket, const std::string& data)
+    {
+        return socket.send(data.data(), data.size()) == sf::Socket::Done;
+    }
+
+    bool send_chunk(sf::TcpSocket& socket, const std::string& data)
+    {
+        std::ostringstream oss;
+        oss << std::hex << data.size() << "\r\n";
+
+        return send_all(socket, oss.str() + data + "\r\n");
+    }
+
+    void send_error(sf::TcpSocket& socket, const std::string& status, const std::string& message)
+    {
+        send_all( socket, "HTTP/1.1 " + status + "\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: " + std::to_string(message.size() + 1) + "\r\n"
+                          "Connection: close\r\n\r\n" + message + "\n" );
+    }
+
+    // Reads the request line, the headers and a body of Content-Length
+    // bytes. Returns an empty string or the status to answer with.
+    std::string receive_request(sf::TcpSocket& socket, Request& request)
+    {
+        std::string data;
+        char        buffer[4096];
+        size_t      received = 0;
+        size_t      header_end;
+
+        while ( (header_end = data.find("\r\n\r\n")) == std::string::npos )
+        {
+            if ( data.size() > MAX_HEADER_SIZE )
+                return "431 Request Header Fields Too Large";
+
+            if ( socket.receive(buffer, sizeof(buffer), received) != sf::Socket::Done )
+                return "400 Bad Request";
+
+            data.append(buffer, received);
+        }
+
+        std::istringstream headers(data.substr(0, header_end));
+        std::string line;
+
+        std::getline(headers, line);
+        std::istringstream(line) >> request.method >> request.path;
+
+        size_t content_length = 0;
+
+        while ( std::getline(headers, line) )
+        {
+            size_t colon = line.find(':');
+            if ( colon == std::string::npos )
+                continue;
+
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+            if ( name == "content-length" )
+                content_length = std::strtoul(line.c_str() + colon + 1, nullptr, 10);
+        }
+
+        if ( content_length > MAX_BODY_SIZE )
+            return "413 Payload Too Large";
+
+        request.body = data.substr(header_end + 4);
+
+        while ( request.body.size() < content_length )
+        {
+            if ( socket.receive(buffer, sizeof(buffer), received) != sf::Socket::Done )
+                return "400 Bad Request";
+
+            request.body.append(buffer, received);
+        }
+
+        request.body.resize(content_length);
+
+        return "";
+    }
+
+    std::string encode_ppm(const Raytracer& rt)
+    {
+        int width  = rt.get_width();
+        int height = rt.get_height();
+
+        std::string ppm = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+        size_t header = ppm.size();
+        ppm.resize(header + (size_t) width * height * 3);
+
+        for ( size_t i = 0 ; i < (size_t) width * height ; i++ )
+        {
+            ppm[header + i * 3 + 0] = (char) rt.frame[i * 4 + 0];
+            ppm[header + i * 3 + 1] = (char) rt.frame[i * 4 + 1];
+            ppm[header + i * 3 + 2] = (char) rt.frame[i * 4 + 2];
+        }
+
+        return ppm;
+    }
+
+    void serve( sf::TcpSocket& socket,
+                Render_Scheduler& scheduler,
+                Mesh_Cache& meshes,
+                Asset_Loader& assets )
+    {
+        Request request;
+
+        std::string status = receive_request(socket, request);
+        if ( !status.empty() )
+        {
+            send_error(socket, status, "Malformed request.");
+            return;
+        }
+
+        if ( request.path != "/render" )
+        {
+            send_error(socket, "404 Not Found", "Jobs are posted to /render.");
+            return;
+        }
+        if ( request.method != "POST" )
+        {
+            send_error(socket, "405 Method Not Allowed", "Jobs are posted to /render.");
+            return;
+        }
+
+        Render_Job  job;
+        std::string error;
+
+        std::istringstream body(request.body);
+        {
+            Trace_Scope trace_load("load job");
+
+            if ( !load_job(body, meshes, job, error, &assets) )
+            {
+                send_error(socket, "400 Bad Request", error);
+                return;
+            }
+        }
+
+        std::shared_ptr<const Raytracer> rt(std::move(job.rt));
+        std::shared_ptr<Job_State>       state = std::make_shared<Job_State>();
+
+        state->total = rt->get_tile_count();
+
+        bool connected = send_all( socket, "HTTP/1.1 200 OK\r\n"
+                                           "Content-Type: application/octet-stream\r\n"
+                                           "Transfer-Encoding: chunked\r\n"
+                                           "Connection: close\r\n\r\n" ) &&
+                         send_chunk( socket, "queued " + std::to_string(state->total) + "\n" );
+
+        if ( !connected )
+            return;
+
+        // Render threads only note the progress, sending is left to this
+        // thread so a slow client never holds up tracing
+        scheduler.submit( rt, job.priority, [state](int done, int total)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+
+                state->done     = std::max(state->done, done);
+                state->complete = state->complete || (done == total);
+            }
+            state->changed.notify_one();
+
+            return !state->cancelled;
+        });
+
+        int sent = -1;
+
+        while ( true )
+        {
+            int  done;
+            bool complete;
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                state->changed.wait(lock, [&]() { return state->complete || (state->done != sent); });
+
+                done     = state->done;
+                complete = state->complete;
+            }
+
+            if ( !send_chunk(socket, "progress " + std::to_string(done) + " " +
+                                     std::to_string(state->total) + "\n") )
+            {
+                // Stops handing out the tiles of the job
+                state->cancelled = true;
+                return;
+            }
+
+            sent = done;
+
+            if ( complete )
+                break;
+        }
+
+        std::ostringstream summary;
+        summary << "done " << rt->stats.get_frame_seconds() << " "
+                << rt->stats.mrays_per_second() << "\n";
+
+        if ( send_chunk(socket, summary.str()) &&
+             send_chunk(socket, encode_ppm(*rt)) )
+            send_all(socket, "0\r\n\r\n");
+    }
+
+}
+
+
+//  --  class Render_Server  --  //
+
+// Constructors
+Render_Server::Render_Server(unsigned short _port, int threads, int connections)
+    : port(_port), scheduler(threads), assets(0, &meshes)
+{
+    for ( int i = 0 ; i < std::max(connections, 1) ; i++ )
+    {
+        workers.emplace_back( [this, i]()
+        {
+            Trace::set_thread_name("connection " + std::to_string(i));
+            work_loop();
+        });
+    }
+}
+// Destructor
+Render_Server::~Render_Server()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for ( std::thread& thread : workers )
+        thread.join();
+}
+
+// Member functions
+bool Render_Server::run()
+{
+    sf::TcpListener listener;
+    if ( listener.listen(port, sf::IpAddress::LocalHost) != sf::Socket::Done )
+    {
+        std::cout << "Unable to listen on port " << port << "." << std::endl;
+        return false;
+    }
+
+    std::cout << "Serving render jobs on localhost:" << port << " with "
+              << scheduler.get_threads() << " threads." << std::endl;
+
+    while ( true )
+    {
+        std::unique_ptr<sf::TcpSocket> socket(new sf::TcpSocket);
+
+        if ( listener.accept(*socket) != sf::Socket::Done )
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if ( (int) pending.size() < MAX_PENDING_CONNECTIONS )
+            {
+                pending.push_back(std::move(socket));
+                socket = nullptr;
+            }
+        }
+
+        if ( socket )
+        {
+            send_error(*socket, "503 Service Unavailable", "Too many connections.");
+            socket->disconnect();
+            continue;
+        }
+
+        condition.notify_one();
+    }
+}
+
+// Private member functions
+void Render_Server::work_loop()
+{
+    while ( true )
+    {
+        std::unique_ptr<sf::TcpSocket> socket;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !pending.empty(); });
+
+            if ( stopping )
+                return;
+
+            socket = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        serve(*socket, scheduler, meshes, assets);
+        socket->disconnect();
+    }
+}
@@ -4,9 +4,127 @@
 #include <vector>
 #include <fstream>
 #include <limits>
+#include <algorithm>
+#include <array>
+#include <unordered_map>
 
 #include "vmath.h"
-#include "timer.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace
+{
+    // Rays accept more error the less they contribute, down to this
+    const float LOD_MIN_INFLUENCE = 0.01f;
+
+    // Cells along each axis of a mesh, three coordinates pack into a key
+    const uint64_t LOD_GRID_CELLS = 1 << 21;
+
+    std::vector<Aabb> get_triangle_bounds(const std::vector<Triangle>& triangles)
+    {
+        std::vector<Aabb> bounds;
+        bounds.reserve(triangles.size());
+
+        for ( auto& triangle : triangles )
+        {
+            Vec3 min, max;
+            triangle.get_bounds(min, max);
+            bounds.emplace_back(min, max);
+        }
+
+        return bounds;
+    }
+
+    // Merges the vertices within each cell of a grid into their mean and
+    // keeps the triangles left with three distinct cells, once. Cells have
+    // to be large enough for LOD_GRID_CELLS to span the mesh.
+    std::vector<Triangle> cluster_vertices( const std::vector<Triangle>& triangles,
+                                            const Vec3& min,
+                                            float cell )
+    {
+        std::unordered_map<uint64_t, int> cell_index;
+        std::vector<Vec3>                 sums;
+        std::vector<int>                  counts;
+
+        // Cell of every vertex, three per triangle
+        std::vector<int> vertex_cells;
+        vertex_cells.reserve(triangles.size() * 3);
+
+        for ( const Triangle& triangle : triangles )
+        {
+            for ( const Vec3* vertex : { &triangle.vertex_a, &triangle.vertex_b, &triangle.vertex_c } )
+            {
+                // Clamped only against rounding at the far side
+                uint64_t x = std::min((uint64_t) ((vertex->x - min.x) / cell), LOD_GRID_CELLS - 1);
+                uint64_t y = std::min((uint64_t) ((vertex->y - min.y) / cell), LOD_GRID_CELLS - 1);
+                uint64_t z = std::min((uint64_t) ((vertex->z - min.z) / cell), LOD_GRID_CELLS - 1);
+
+                auto inserted = cell_index.emplace((x << 42) | (y << 21) | z, (int) sums.size());
+
+                if ( inserted.second )
+                {
+                    sums.push_back(Vec3(0.0f, 0.0f, 0.0f));
+                    counts.push_back(0);
+                }
+
+                int index = inserted.first->second;
+                sums[index] += *vertex;
+                counts[index]++;
+
+                vertex_cells.push_back(index);
+            }
+        }
+
+        // Collapsed triangles dropped, duplicates found by sorted cells
+        std::vector<std::array<int, 4>> kept;
+
+        for ( int t = 0 ; t < (int) triangles.size() ; t++ )
+        {
+            int a = vertex_cells[3 * t];
+            int b = vertex_cells[3 * t + 1];
+            int c = vertex_cells[3 * t + 2];
+
+            if ( (a == b) || (b == c) || (a == c) )
+                continue;
+
+            std::array<int, 4> key = { a, b, c, t };
+            std::sort(key.begin(), key.begin() + 3);
+            kept.push_back(key);
+        }
+
+        std::sort(kept.begin(), kept.end());
+        kept.erase( std::unique( kept.begin(), kept.end(),
+                                 [](const std::array<int, 4>& l, const std::array<int, 4>& r)
+                                 {
+                                     return (l[0] == r[0]) && (l[1] == r[1]) && (l[2] == r[2]);
+                                 } ),
+                    kept.end() );
+
+        // In the order of the mesh, with its winding
+        std::sort( kept.begin(), kept.end(), [](const std::array<int, 4>& l, const std::array<int, 4>& r)
+        {
+            return l[3] < r[3];
+        });
+
+        std::vector<Triangle> simplified;
+        simplified.reserve(kept.size());
+
+        for ( const std::array<int, 4>& key : kept )
+        {
+            int t = key[3];
+
+            int a = vertex_cells[3 * t];
+            int b = vertex_cells[3 * t + 1];
+            int c = vertex_cells[3 * t + 2];
+
+            simplified.push_back( Triangle( sums[a] * (1.0f / counts[a]),
+                                            sums[b] * (1.0f / counts[b]),
+                                            sums[c] * (1.0f / counts[c]) ) );
+        }
+
+        return simplified;
+    }
+}
 
 //  --  class Ray  --  //
 
@@ -14,6 +132,33 @@
 Ray::Ray(const Vec3& _dir, const Vec3& _ori)
     : dir{_dir} , ori{_ori} {}
 
+// Member functions
+Ray Ray::secondary(const Vec3& _dir, const Vec3& _ori, float distance, float weight) const
+{
+    Ray ray(_dir, _ori);
+
+    ray.depth     = depth + 1;
+    ray.influence = influence * weight;
+    ray.footprint = footprint + spread * distance;
+    ray.spread    = spread;
+
+    return ray;
+}
+
+
+//  --  class Shape  --  //
+
+// Virtual functions
+float Shape::intersect(const Ray& ray, const Shape*& surface) const
+{
+    surface = this;
+    return intersect(ray);
+}
+bool Shape::get_bounds(Vec3& /*min*/, Vec3& /*max*/) const
+{
+    return false;
+}
+
 
 //  --  class Sphere  --  //
 
@@ -50,6 +195,19 @@ Vec3 Sphere::get_normal(const Vec3& point) const
 
     return normal;
 }
+bool Sphere::get_bounds(Vec3& min, Vec3& max) const
+{
+    Vec3 extent(radius, radius, radius);
+
+    min = center - extent;
+    max = center + extent;
+
+    return true;
+}
+void Sphere::translate(const Vec3& offset)
+{
+    center += offset;
+}
 
 //  --  class Plane  --  //
 
@@ -79,6 +237,10 @@ Vec3  Plane::get_normal(const Vec3& /*point*/) const
 {
     return normal;
 }
+void  Plane::translate(const Vec3& offset)
+{
+    position += offset;
+}
 
 
 //  --  class Triangle  --  //
@@ -123,76 +285,325 @@ Vec3  Triangle::get_normal(const Vec3& /*point*/) const
 {
     return normal;
 }
+bool  Triangle::get_bounds(Vec3& min, Vec3& max) const
+{
+    min = max = vertex_a;
+
+    for ( const Vec3* vertex : { &vertex_b, &vertex_c } )
+    {
+        min = Vec3( std::min(min.x, vertex->x),
+                    std::min(min.y, vertex->y),
+                    std::min(min.z, vertex->z) );
+        max = Vec3( std::max(max.x, vertex->x),
+                    std::max(max.y, vertex->y),
+                    std::max(max.z, vertex->z) );
+    }
+
+    return true;
+}
+Vec3  Triangle::get_position() const
+{
+    return (vertex_a + vertex_b + vertex_c) * (1.0f / 3.0f);
+}
+void  Triangle::translate(const Vec3& offset)
+{
+    // Edges and normal do not change
+    vertex_a += offset;
+    vertex_b += offset;
+    vertex_c += offset;
+}
 
 //  --  class Mesh  --  //
 
 // Constructors
 Mesh::Mesh(const char* filename, const Vec3& position)
+    : source{filename}, source_offset{position}
 {
     std::ifstream ifs{filename};
 
     if ( !ifs.is_open() )
         std::cout << "Unable to open \"" << filename << "\"." << std::endl;
 
-    Timer load_time( std::string("Load time - ") + filename);
+    Stage_Timer load_time(Stage::Load, true);
+    Trace_Scope trace_load("scene load");
 
-    triangles.reserve(1000);
+    std::vector<Triangle> triangles;
+    read_obj(ifs, position, triangles);
 
-    char  chr;
-    float x,y,z;
-    int   a,b,c;
+    geometry = build(std::move(triangles));
+}
 
-    std::vector<Vec3> vertices;
-    vertices.reserve(1000);
+Mesh::Mesh(const std::vector<Triangle>& _triangles)
+    : geometry{ build(std::vector<Triangle>(_triangles)) }
+{
 
-    while ( ifs )
-    {
-        if ( ifs.peek() == 'v' )
-        {
-            ifs >> chr >> x >> y >> z;
-            vertices.push_back(Vec3(x,y,z) + position);
-        }
+}
+Mesh::Mesh(std::vector<Triangle>&& _triangles, const std::string& _source)
+    : geometry{ build(std::move(_triangles)) }, source{_source}
+{
 
-        if ( ifs.peek() == 'f' )
-        {
-            ifs >> chr >> a >> b >> c;
-            triangles.push_back( Triangle( vertices[a - 1],
-                                           vertices[c - 1],
-                                           vertices[b - 1]) );
-        }
+}
 
-        ifs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    }
+// Member functions
+void Mesh::copy_geometry(const Mesh& mesh)
+{
+    geometry      = mesh.geometry;
+    offset        = mesh.offset;
+    source        = mesh.source;
+    source_offset = mesh.source_offset;
+}
 
-    triangles.shrink_to_fit();
+std::vector<int> Mesh::get_level_sizes() const
+{
+    std::vector<int> sizes;
+    for ( const Detail_Level& level : geometry->levels )
+        sizes.push_back((int) level.triangles.size());
+
+    return sizes;
 }
 
+size_t Mesh::get_memory() const
+{
+    size_t bytes = geometry->triangles.capacity() * sizeof(Triangle) +
+                   geometry->bvh.get_memory() + geometry->packs.get_memory();
+
+    for ( const Detail_Level& level : geometry->levels )
+        bytes += level.triangles.capacity() * sizeof(Triangle) + level.bvh.get_memory() +
+                 level.packs.get_memory();
+
+    return bytes;
+}
 
 // Override functions
-float Mesh::intersect (const Ray& ray)        const
+float Mesh::intersect (const Ray& ray) const
+{
+    const Shape* surface;
+    return intersect(ray, surface);
+}
+
+float Mesh::intersect (const Ray& ray, const Shape*& surface) const
 {
     float closest_depth = std::numeric_limits<float>::max();
+    int   closest_index = -1;
+
+    Render_Counters& counters = Render_Stats::local();
+
+    surface = this;
+
+    // The geometry keeps the coordinates it was built in
+    Ray local = ray;
+    local.ori = ray.ori - offset;
+
+    const Detail_Level*          level     = select_level(local);
+    const std::vector<Triangle>& triangles = level ? level->triangles : geometry->triangles;
+    const Wide_Bvh&              bvh       = level ? level->bvh       : geometry->bvh;
+    const Triangle_Packs&        packs     = level ? level->packs     : geometry->packs;
+
+    Watertight_Ray watertight(local.ori, local.dir);
 
-    for( auto& triangle : triangles )
+    // Equal depths go to the lowest index, as if testing in order
+    counters.traversal_steps += bvh.traverse_leaves( local.ori, local.dir, closest_depth, [&](int first, int count)
     {
-        float depth = triangle.intersect(ray);
+        counters.triangle_tests += count;
+        packs.intersect(watertight, first, count, closest_depth, closest_index);
+    });
 
-        if ( ( depth > 0.0001f ) && ( depth < closest_depth) )
+    if ( closest_index >= 0 )
+    {
+        surface = &triangles[closest_index];
+        return closest_depth;
+    }
+
+    return -1.0f;
+}
+
+Vec3  Mesh::get_normal(const Vec3& point) const
+{
+    // Without the surface from intersect(), use the triangle whose plane 
+    // lies closest to the point
+    const Triangle* closest = nullptr;
+    float closest_distance  = std::numeric_limits<float>::max();
+
+    Vec3 local = point - offset;
+
+    for( auto& triangle : geometry->triangles )
+    {
+        float distance = std::abs( (local - triangle.vertex_a) * triangle.normal );
+
+        if ( distance < closest_distance )
         {
-            closest_depth = depth;
-            tri = &triangle;
+            closest_distance = distance;
+            closest          = &triangle;
         }
     }
 
-    if ( closest_depth < std::numeric_limits<float>::max() )
-        return closest_depth;
+    if ( closest == nullptr )
+        return Vec3(0.0f, 1.0f, 0.0f);
 
-    return -1.0f;
+    return closest->get_normal(local);
 }
+bool  Mesh::get_bounds(Vec3& min, Vec3& max) const
+{
+    if ( geometry->bvh.empty() )
+        return false;
 
-Vec3  Mesh::get_normal(const Vec3& point) const
+    min = geometry->bvh.get_bounds().get_min() + offset;
+    max = geometry->bvh.get_bounds().get_max() + offset;
+
+    return true;
+}
+Vec3  Mesh::get_position() const
+{
+    Vec3 min, max;
+
+    if ( !get_bounds(min, max) )
+        return Vec3(0.0f, 0.0f, 0.0f);
+
+    return (min + max) * 0.5f;
+}
+void  Mesh::translate(const Vec3& _offset)
+{
+    // The geometry may be shared, only the instance moves
+    offset        += _offset;
+    source_offset += _offset;
+}
+
+// Private member functions
+std::shared_ptr<const Mesh::Geometry> Mesh::build(std::vector<Triangle>&& triangles)
+{
+    std::shared_ptr<Geometry> geometry = std::make_shared<Geometry>();
+
+    geometry->triangles = std::move(triangles);
+    geometry->bvh.build(get_triangle_bounds(geometry->triangles));
+    geometry->packs.build(geometry->triangles, geometry->bvh.get_indices());
+    build_levels(*geometry);
+
+    return geometry;
+}
+
+void Mesh::build_levels(Geometry& geometry)
+{
+    std::vector<Triangle>&     triangles = geometry.triangles;
+    std::vector<Detail_Level>& levels    = geometry.levels;
+
+    levels.clear();
+
+    if ( (int) triangles.size() < MESH_LOD_MIN_TRIANGLES )
+        return;
+
+    Trace_Scope trace_lod("mesh levels of detail", (int) triangles.size());
+
+    // Cells start at twice the average edge and double per level, at
+    // least so large that the grid spans the mesh without folding distant
+    // vertices into one cell
+    double edge_sum = 0.0;
+    for ( const Triangle& triangle : triangles )
+        edge_sum += triangle.edge_ab.length() + triangle.edge_ac.length();
+
+    Vec3 min    = geometry.bvh.get_bounds().get_min();
+    Vec3 extent = geometry.bvh.get_bounds().get_max() - min;
+
+    float cell = std::max( (float) (edge_sum / triangles.size()),
+                           std::max(std::max(extent.x, extent.y), extent.z) / (float) (LOD_GRID_CELLS - 1) );
+
+    size_t previous = triangles.size();
+
+    for ( int attempt = 0 ; (attempt < 2 * MESH_LOD_MAX_LEVELS) &&
+                            ((int) levels.size() < MESH_LOD_MAX_LEVELS) ; attempt++, cell *= 2.0f )
+    {
+        std::vector<Triangle> simplified = cluster_vertices(triangles, min, cell);
+
+        if ( simplified.empty() )
+            break;
+
+        // Levels that save little are not worth their memory
+        if ( simplified.size() * 4 > previous * 3 )
+            continue;
+
+        previous = simplified.size();
+
+        levels.emplace_back();
+        Detail_Level& level = levels.back();
+
+        level.triangles = std::move(simplified);
+        level.error     = cell * std::sqrt(3.0f);
+        level.bvh.build(get_triangle_bounds(level.triangles));
+        level.packs.build(level.triangles, level.bvh.get_indices());
+
+        if ( (int) previous < MESH_LOD_MIN_TRIANGLES / 4 )
+            break;
+    }
+}
+
+const Mesh::Detail_Level* Mesh::select_level(const Ray& ray) const
 {
-    return tri->get_normal(point);
+    const std::vector<Detail_Level>& levels = geometry->levels;
+
+    if ( levels.empty() || (ray.depth == 0) || (ray.footprint + ray.spread <= 0.0f) )
+        return nullptr;
+
+    const Aabb& bounds = geometry->bvh.get_bounds();
+
+    const float origin[3]            = { ray.ori.x, ray.ori.y, ray.ori.z };
+    const float inverse_direction[3] = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+
+    float entry;
+    if ( !bounds.intersect(origin, inverse_direction, std::numeric_limits<float>::max(), entry) ||
+         (entry <= 0.0f) )
+    {
+        return nullptr;
+    }
+
+    float tolerance = MESH_LOD_TOLERANCE * (ray.footprint + ray.spread * entry) /
+                      std::max(ray.influence, LOD_MIN_INFLUENCE);
+
+    for ( int i = (int) levels.size() - 1 ; i >= 0 ; i-- )
+    {
+        if ( levels[i].error <= tolerance )
+            return &levels[i];
+    }
+
+    return nullptr;
 }
 
 
+//  --  Helper functions  --  //
+
+void read_obj(std::istream& is, const Vec3& position, std::vector<Triangle>& triangles)
+{
+    triangles.reserve(1000);
+
+    char  chr;
+    float x,y,z;
+    int   a,b,c;
+
+    std::vector<Vec3> vertices;
+    vertices.reserve(1000);
+
+    while ( is )
+    {
+        if ( is.peek() == 'v' )
+        {
+            is >> chr >> x >> y >> z;
+            vertices.push_back(Vec3(x,y,z) + position);
+        }
+
+        if ( is.peek() == 'f' )
+        {
+            is >> chr >> a >> b >> c;
+
+            int count = (int) vertices.size();
+
+            if ( (a >= 1) && (a <= count) && (b >= 1) && (b <= count) && (c >= 1) && (c <= count) )
+            {
+                triangles.push_back( Triangle( vertices[a - 1],
+                                               vertices[c - 1],
+                                               vertices[b - 1]) );
+            }
+        }
+
+        is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    triangles.shrink_to_fit();
+}
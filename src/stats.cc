@@ -0,0 +1,188 @@
+#include "stats.h"
+
+#include <iomanip>
+
+namespace
+{
+    std::mutex scene_mutex;
+    double     scene_stage_seconds[(int) Stage::COUNT] = {};
+}
+
+//  --  Helper functions  --  //
+
+const char* stage_name(Stage stage)
+{
+    switch ( stage )
+    {
+        case Stage::Load      : return "load";
+        case Stage::Build     : return "build";
+        case Stage::Reproject : return "reproject";
+        case Stage::Trace     : return "trace";
+        case Stage::Denoise   : return "denoise";
+        default               : return "unknown";
+    }
+}
+
+
+//  --  struct Render_Counters  --  //
+
+// Assignment operators
+Render_Counters& Render_Counters::operator += (const Render_Counters& rhs)
+{
+    primary_rays    += rhs.primary_rays;
+    shadow_rays     += rhs.shadow_rays;
+    reflection_rays += rhs.reflection_rays;
+
+    shape_tests    += rhs.shape_tests;
+    triangle_tests += rhs.triangle_tests;
+    hits           += rhs.hits;
+
+    traversal_steps += rhs.traversal_steps;
+
+    depth_cutoffs     += rhs.depth_cutoffs;
+    influence_cutoffs += rhs.influence_cutoffs;
+
+    reprojected_pixels += rhs.reprojected_pixels;
+    traced_tiles       += rhs.traced_tiles;
+    cached_tiles       += rhs.cached_tiles;
+    deferred_tiles     += rhs.deferred_tiles;
+
+    bvh_refits   += rhs.bvh_refits;
+    bvh_rebuilds += rhs.bvh_rebuilds;
+
+    for ( int i = 0 ; i < (int) Stage::COUNT ; i++ )
+        stage_seconds[i] += rhs.stage_seconds[i];
+
+    return *this;
+}
+
+// Member functions
+uint64_t Render_Counters::total_rays() const
+{
+    return primary_rays + shadow_rays + reflection_rays;
+}
+void Render_Counters::reset()
+{
+    *this = Render_Counters();
+}
+
+
+//  --  class Render_Stats  --  //
+
+// Constructors
+Render_Stats::Render_Stats(const Render_Stats& _stats)
+    : totals{_stats.totals} , threads{_stats.threads} ,
+      frame_seconds{_stats.frame_seconds} {}
+
+// Assignment operators
+Render_Stats& Render_Stats::operator = (const Render_Stats& rhs)
+{
+    totals        = rhs.totals;
+    threads       = rhs.threads;
+    frame_seconds = rhs.frame_seconds;
+
+    return *this;
+}
+
+Render_Counters& Render_Stats::local()
+{
+    static thread_local Render_Counters counters;
+    return counters;
+}
+
+void Render_Stats::record_scene_stage(Stage stage, double seconds)
+{
+    std::lock_guard<std::mutex> lock(scene_mutex);
+    scene_stage_seconds[(int) stage] += seconds;
+}
+
+// Member functions
+void Render_Stats::begin_frame()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    totals.reset();
+    threads       = 0;
+    frame_seconds = 0.0;
+
+    // Drop anything the calling thread counted outside of a frame
+    local().reset();
+}
+void Render_Stats::end_frame(double seconds, int _threads)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    frame_seconds = seconds;
+    threads       = _threads;
+}
+
+void Render_Stats::merge_local()
+{
+    Render_Counters& counters = local();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    totals += counters;
+
+    counters.reset();
+}
+
+double Render_Stats::mrays_per_second() const
+{
+    if ( frame_seconds <= 0.0 )
+        return 0.0;
+
+    return (totals.total_rays() / frame_seconds) / 1.0e6;
+}
+
+void Render_Stats::write_json(std::ostream& os) const
+{
+    double scene_seconds[(int) Stage::COUNT];
+    {
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        for ( int i = 0 ; i < (int) Stage::COUNT ; i++ )
+            scene_seconds[i] = scene_stage_seconds[i];
+    }
+
+    os << std::setprecision(9);
+
+    os << "{\n"
+       << "  \"frame_seconds\": "     << frame_seconds      << ",\n"
+       << "  \"threads\": "           << threads            << ",\n"
+       << "  \"mrays_per_second\": "  << mrays_per_second() << ",\n"
+       << "  \"rays\": {\n"
+       << "    \"primary\": "    << totals.primary_rays    << ",\n"
+       << "    \"shadow\": "     << totals.shadow_rays     << ",\n"
+       << "    \"reflection\": " << totals.reflection_rays << ",\n"
+       << "    \"total\": "      << totals.total_rays()    << "\n"
+       << "  },\n"
+       << "  \"intersections\": {\n"
+       << "    \"shape_tests\": "    << totals.shape_tests    << ",\n"
+       << "    \"triangle_tests\": " << totals.triangle_tests << ",\n"
+       << "    \"hits\": "           << totals.hits           << ",\n"
+       << "    \"traversal_steps\": " << totals.traversal_steps << "\n"
+       << "  },\n"
+       << "  \"cutoffs\": {\n"
+       << "    \"recursion_depth\": " << totals.depth_cutoffs     << ",\n"
+       << "    \"min_influence\": "   << totals.influence_cutoffs << "\n"
+       << "  },\n"
+       << "  \"reprojected_pixels\": " << totals.reprojected_pixels << ",\n"
+       << "  \"traced_tiles\": "       << totals.traced_tiles       << ",\n"
+       << "  \"cached_tiles\": "       << totals.cached_tiles       << ",\n"
+       << "  \"deferred_tiles\": "     << totals.deferred_tiles     << ",\n"
+       << "  \"bvh\": {\n"
+       << "    \"refits\": "   << totals.bvh_refits   << ",\n"
+       << "    \"rebuilds\": " << totals.bvh_rebuilds << "\n"
+       << "  },\n";
+
+    // Frame stages are summed over all render threads
+    os << "  \"stage_seconds\": {\n";
+    for ( int i = 0 ; i < (int) Stage::COUNT ; i++ )
+    {
+        os << "    \"" << stage_name((Stage) i) << "\": "
+           << totals.stage_seconds[i] + scene_seconds[i]
+           << ( (i + 1 < (int) Stage::COUNT) ? ",\n" : "\n" );
+    }
+    os << "  }\n"
+       << "}\n";
+}
@@ -0,0 +1,348 @@
+#include "temporal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "stats.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace
+{
+    enum Pixel_State : uint8_t
+    {
+        STATE_HOLE     = 0,     // Nothing landed here
+        STATE_SPLATTED = 1,
+        STATE_FILLED   = 2      // Interpolated from two neighbours
+    };
+
+    // Splat distance of background pixels, behind every surface
+    const float BACKGROUND_DISTANCE = std::numeric_limits<float>::max() * 0.5f;
+
+    const uint64_t NO_SPLAT = ~(uint64_t) 0;
+
+    // Positive floats order like their bit patterns
+    uint64_t pack_splat(float distance, uint32_t source)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &distance, sizeof(bits));
+
+        return ((uint64_t) bits << 32) | source;
+    }
+    float splat_distance(uint64_t splat)
+    {
+        uint32_t bits = (uint32_t) (splat >> 32);
+
+        float distance;
+        std::memcpy(&distance, &bits, sizeof(distance));
+
+        return distance;
+    }
+
+    bool same_surface( const Pixel_Sample& a,
+                       const Pixel_Sample& b,
+                       const Temporal_Settings& settings )
+    {
+        if ( a.shape_id != b.shape_id )
+            return false;
+
+        if ( a.shape_id < 0 )
+            return true;
+
+        if ( std::abs(a.depth - b.depth) > settings.depth_tolerance * std::min(a.depth, b.depth) )
+            return false;
+
+        return (a.normal * b.normal) >= settings.normal_tolerance;
+    }
+}
+
+
+//  --  class Temporal_Cache  --  //
+
+// Constructors
+Temporal_Cache::Temporal_Cache(const Temporal_Settings& _settings)
+    : settings{_settings} {}
+
+// Member functions
+void Temporal_Cache::reproject( const Camera& camera,
+                                const std::vector<Shape*>& shapes,
+                                Framebuffer& fb,
+                                std::vector<uint8_t>& trace_mask,
+                                Worker_Pool& workers,
+                                int threads )
+{
+    const int width  = fb.get_width();
+    const int height = fb.get_height();
+    const size_t pixels = (size_t) width * height;
+
+    trace_mask.assign(pixels, 1);
+    frame_index++;
+
+    if ( !valid || (history.get_width() != width) || (history.get_height() != height) )
+        return;
+
+    if ( !fb.has(AOV_DEPTH) || !fb.has(AOV_NORMAL) || !fb.has(AOV_SHAPE_ID) )
+        return;
+
+    Trace_Scope trace_reproject("reproject");
+    Stage_Timer reproject_time(Stage::Reproject);
+
+    const Vec3 eye = camera.get_position();
+
+    if ( splat_count != pixels )
+    {
+        splats.reset(new std::atomic<uint64_t>[pixels]);
+        splat_count = pixels;
+    }
+
+    samples.resize(pixels);
+    reprojected_point.resize(pixels);
+    reprojected_view.resize(pixels);
+    state.assign(pixels, STATE_HOLE);
+    filled.assign(pixels, 0);
+
+    // Forward splat of the previous frame, nearest wins
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        for ( size_t i = (size_t) y0 * width ; i < (size_t) y1 * width ; i++ )
+            splats[i].store(NO_SPLAT, std::memory_order_relaxed);
+    });
+
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            for ( int x = 0 ; x < width ; x++ )
+            {
+                size_t source = (size_t) y * width + x;
+
+                Vec3  point;
+                float distance;
+
+                if ( history.depth[source] > 0.0f )
+                {
+                    point    = history_point[source];
+                    distance = (point - eye).length();
+                }
+                else
+                {
+                    // Background only depends on the direction
+                    point    = eye + history_point[source];
+                    distance = BACKGROUND_DISTANCE;
+                }
+
+                float fx, fy;
+                if ( !camera.project(point, fx, fy) )
+                    continue;
+
+                int tx = (int) std::floor(fx + 0.5f);
+                int ty = (int) std::floor(fy + 0.5f);
+
+                if ( (tx < 0) || (tx >= width) || (ty < 0) || (ty >= height) )
+                    continue;
+
+                std::atomic<uint64_t>& target = splats[(size_t) ty * width + tx];
+
+                uint64_t splat   = pack_splat(distance, (uint32_t) source);
+                uint64_t current = target.load(std::memory_order_relaxed);
+
+                while ( (splat < current) && 
+                        !target.compare_exchange_weak(current, splat, std::memory_order_relaxed) ) {}
+            }
+        }
+    });
+
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        for ( size_t i = (size_t) y0 * width ; i < (size_t) y1 * width ; i++ )
+        {
+            uint64_t splat = splats[i].load(std::memory_order_relaxed);
+            if ( splat == NO_SPLAT )
+                continue;
+
+            uint32_t source = (uint32_t) splat;
+
+            samples[i] = history.get_sample(source % width, source / width);
+            samples[i].depth = ( samples[i].shape_id >= 0 ) ? splat_distance(splat) : 0.0f;
+
+            reprojected_point[i] = history_point[source];
+            reprojected_view[i]  = history_view[source];
+            state[i] = STATE_SPLATTED;
+        }
+    });
+
+    // Moving closer spreads the splats apart, close one pixel gaps between
+    // two neighbours on the same surface
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            for ( int x = 0 ; x < width ; x++ )
+            {
+                size_t i = (size_t) y * width + x;
+                if ( state[i] != STATE_HOLE )
+                    continue;
+
+                const int pairs[2][2] = { { -1, 1 }, { -width, width } };
+
+                for ( int p = 0 ; p < 2 ; p++ )
+                {
+                    if ( (p == 0) && ((x == 0) || (x == width  - 1)) ) continue;
+                    if ( (p == 1) && ((y == 0) || (y == height - 1)) ) continue;
+
+                    size_t a = i + pairs[p][0];
+                    size_t b = i + pairs[p][1];
+
+                    if ( (state[a] != STATE_SPLATTED) || (state[b] != STATE_SPLATTED) )
+                        continue;
+
+                    if ( !same_surface(samples[a], samples[b], settings) )
+                        continue;
+
+                    Pixel_Sample sample = samples[a];
+                    sample.color     = (samples[a].color     + samples[b].color)     * 0.5f;
+                    sample.direct    = (samples[a].direct    + samples[b].direct)    * 0.5f;
+                    sample.reflected = (samples[a].reflected + samples[b].reflected) * 0.5f;
+                    sample.depth     = (samples[a].depth     + samples[b].depth)     * 0.5f;
+
+                    samples[i] = sample;
+                    filled[i]  = 1;
+                    reprojected_point[i] = (reprojected_point[a] + reprojected_point[b]) * 0.5f;
+                    reprojected_view[i]  = reprojected_view[a];
+                    break;
+                }
+            }
+        }
+    });
+
+    for ( size_t i = 0 ; i < pixels ; i++ )
+        if ( filled[i] )
+            state[i] = STATE_FILLED;
+
+    // Every refresh_period frames each pixel is traced once regardless
+    uint32_t refresh_period = ( settings.refresh_fraction > 0.0f ) ?
+                              (uint32_t) std::max(1.0f, std::round(1.0f / settings.refresh_fraction)) :
+                              0;
+
+    std::atomic<uint64_t> reprojected{0};
+
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        uint64_t count = 0;
+
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            for ( int x = 0 ; x < width ; x++ )
+            {
+                size_t i = (size_t) y * width + x;
+
+                if ( state[i] == STATE_HOLE )
+                    continue;
+
+                const Pixel_Sample& sample = samples[i];
+
+                if ( refresh_period > 0 )
+                {
+                    uint32_t hash = ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u);
+                    if ( (hash % refresh_period) == (frame_index % refresh_period) )
+                        continue;
+                }
+
+                // Disocclusions and silhouettes, next to holes or other surfaces
+                bool edge = false;
+
+                const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+                for ( int n = 0 ; (n < 4) && !edge ; n++ )
+                {
+                    int nx = x + offsets[n][0];
+                    int ny = y + offsets[n][1];
+
+                    if ( (nx < 0) || (nx >= width) || (ny < 0) || (ny >= height) )
+                        continue;
+
+                    size_t j = (size_t) ny * width + nx;
+
+                    edge = (state[j] == STATE_HOLE) || !same_surface(sample, samples[j], settings);
+                }
+
+                if ( edge )
+                    continue;
+
+                if ( sample.shape_id >= 0 )
+                {
+                    if ( sample.shape_id >= (int) shapes.size() )
+                        continue;
+
+                    const Material& material = shapes[sample.shape_id]->material;
+                    Vec3 view = camera.get_primary_ray(x, y).dir;
+
+                    // Surfaces seen edge on or from behind were resampled badly
+                    if ( (sample.normal * view) >= 0.0f )
+                        continue;
+
+                    // Reflections depend on the view direction, highlights too
+                    if ( material.reflection > 0.0f )
+                        continue;
+
+                    if ( (material.specular > 0.0f) && 
+                         ((reprojected_view[i] * view) < settings.view_tolerance) )
+                        continue;
+                }
+
+                fb.store(x, y, sample);
+                trace_mask[i] = 0;
+                count++;
+            }
+        }
+
+        reprojected += count;
+    });
+
+    Render_Stats::local().reprojected_pixels += reprojected;
+}
+
+void Temporal_Cache::store( const Camera& camera,
+                            const Framebuffer& fb,
+                            const std::vector<uint8_t>& trace_mask,
+                            Worker_Pool& workers,
+                            int threads )
+{
+    const int width  = fb.get_width();
+    const int height = fb.get_height();
+    const size_t pixels = (size_t) width * height;
+
+    bool reused = valid && 
+                  (reprojected_point.size() == pixels) &&
+                  (trace_mask.size()        == pixels);
+
+    history_point.resize(pixels);
+    history_view.resize(pixels);
+
+    workers.run_rows(height, threads, [&](int y0, int y1)
+    {
+        for ( int y = y0 ; y < y1 ; y++ )
+        {
+            for ( int x = 0 ; x < width ; x++ )
+            {
+                size_t i = (size_t) y * width + x;
+
+                if ( reused && !trace_mask[i] )
+                {
+                    history_point[i] = reprojected_point[i];
+                    history_view[i]  = reprojected_view[i];
+                    continue;
+                }
+
+                Ray ray = camera.get_primary_ray(x, y);
+
+                history_point[i] = ( fb.depth[i] > 0.0f ) ? ray.ori + ray.dir * fb.depth[i] : ray.dir;
+                history_view[i]  = ray.dir;
+            }
+        }
+    });
+
+    history = fb;
+    valid   = true;
+}
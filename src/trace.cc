@@ -0,0 +1,238 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct Trace_Buffer
+    {
+        std::vector<Trace_Event> events;
+        size_t count = 0;
+
+        int         thread_id;
+        std::string thread_name;
+
+        // Owned by a running thread, free ones are handed to new threads
+        bool in_use = true;
+
+        Trace_Buffer(int _thread_id)
+            : events(Trace::BUFFER_SIZE) , thread_id{_thread_id} {}
+    };
+
+    std::atomic<bool> trace_enabled{false};
+
+    // Buffers kept before exited threads' events are given up for new threads
+    const size_t RETAINED_BUFFERS = 64;
+
+    // Buffers outlive their threads so they can be exported after a render,
+    // and are reused by later threads so their number stays bounded by the
+    // threads recording at once
+    std::mutex                                 registry_mutex;
+    std::vector<std::unique_ptr<Trace_Buffer>> registry;
+
+    // Name and buffer of the calling thread, the buffer is only taken once
+    // the thread records an event
+    struct Thread_Trace
+    {
+        std::string   name;
+        Trace_Buffer* buffer = nullptr;
+
+        ~Thread_Trace()
+        {
+            if ( buffer == nullptr )
+                return;
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            buffer->in_use = false;
+        }
+    };
+
+    Thread_Trace& local_trace()
+    {
+        static thread_local Thread_Trace trace;
+        return trace;
+    }
+
+    Trace_Buffer& local_buffer()
+    {
+        Thread_Trace& trace = local_trace();
+
+        if ( trace.buffer == nullptr )
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+
+            // A free buffer of a thread of the same name keeps its events,
+            // e.g. a worker started again. Past RETAINED_BUFFERS the free
+            // buffer of another thread is emptied and reused instead.
+            Trace_Buffer* reused = nullptr;
+            Trace_Buffer* named  = nullptr;
+
+            for ( const std::unique_ptr<Trace_Buffer>& buffer : registry )
+            {
+                if ( buffer->in_use )
+                    continue;
+
+                if ( buffer->thread_name == trace.name )
+                {
+                    named = buffer.get();
+                    break;
+                }
+
+                if ( reused == nullptr )
+                    reused = buffer.get();
+            }
+
+            if ( (named != nullptr) || (registry.size() < RETAINED_BUFFERS) )
+                reused = named;
+
+            if ( reused == nullptr )
+            {
+                registry.emplace_back(new Trace_Buffer((int) registry.size()));
+                reused = registry.back().get();
+            }
+            else if ( reused->thread_name != trace.name )
+            {
+                reused->count = 0;
+            }
+
+            reused->in_use      = true;
+            reused->thread_name = trace.name;
+
+            trace.buffer = reused;
+        }
+
+        return *trace.buffer;
+    }
+
+    void write_escaped(std::ostream& os, const std::string& text)
+    {
+        for ( char chr : text )
+        {
+            if ( (chr == '"') || (chr == '\\') )
+                os << '\\';
+            os << chr;
+        }
+    }
+}
+
+//  --  class Trace  --  //
+
+void Trace::enable(bool enable)
+{
+    now_ns();
+    trace_enabled.store(enable, std::memory_order_relaxed);
+}
+bool Trace::enabled()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Trace::now_ns()
+{
+    static const std::chrono::steady_clock::time_point start_point =
+        std::chrono::steady_clock::now();
+
+    std::chrono::nanoseconds delta_time = std::chrono::steady_clock::now() - start_point;
+
+    return delta_time.count();
+}
+
+void Trace::record( const char* name,
+                    uint64_t begin_ns,
+                    uint64_t end_ns,
+                    int32_t arg_x,
+                    int32_t arg_y )
+{
+    Trace_Buffer& buffer = local_buffer();
+
+    Trace_Event& event = buffer.events[buffer.count % BUFFER_SIZE];
+    event.name     = name;
+    event.begin_ns = begin_ns;
+    event.end_ns   = end_ns;
+    event.arg_x    = arg_x;
+    event.arg_y    = arg_y;
+
+    buffer.count++;
+}
+
+void Trace::set_thread_name(const std::string& name)
+{
+    Thread_Trace& trace = local_trace();
+
+    trace.name = name;
+
+    if ( trace.buffer != nullptr )
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        trace.buffer->thread_name = name;
+    }
+}
+
+bool Trace::write_json(const std::string& filename)
+{
+    std::ofstream ofs(filename);
+
+    if ( !ofs.is_open() )
+        return false;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    ofs << std::fixed << std::setprecision(3);
+    ofs << "{\"traceEvents\":[\n";
+
+    bool first = true;
+
+    for ( const std::unique_ptr<Trace_Buffer>& buffer : registry )
+    {
+        if ( !buffer->thread_name.empty() )
+        {
+            ofs << ( first ? "" : ",\n" )
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << buffer->thread_id << ",\"args\":{\"name\":\"";
+            write_escaped(ofs, buffer->thread_name);
+            ofs << "\"}}";
+
+            first = false;
+        }
+
+        size_t count = ( buffer->count < BUFFER_SIZE ) ? buffer->count : BUFFER_SIZE;
+        size_t start = buffer->count - count;
+
+        for ( size_t i = start ; i < buffer->count ; i++ )
+        {
+            const Trace_Event& event = buffer->events[i % BUFFER_SIZE];
+
+            // Complete events, timestamps in microseconds
+            ofs << ( first ? "" : ",\n" )
+                << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << buffer->thread_id
+                << ",\"ts\":"  << event.begin_ns / 1000.0
+                << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0;
+
+            if ( (event.arg_x >= 0) || (event.arg_y >= 0) )
+                ofs << ",\"args\":{\"x\":" << event.arg_x << ",\"y\":" << event.arg_y << "}";
+
+            ofs << "}";
+
+            first = false;
+        }
+    }
+
+    ofs << "\n]}\n";
+
+    return (bool) ofs;
+}
+
+void Trace::clear()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    for ( const std::unique_ptr<Trace_Buffer>& buffer : registry )
+        buffer->count = 0;
+}
@@ -0,0 +1,35 @@
+#include "triangle_packs.h"
+
+#include "shapes.h"
+
+//  --  class Triangle_Packs  --  //
+
+// Member functions
+void Triangle_Packs::build(const std::vector<Triangle>& _triangles, const std::vector<int>& order)
+{
+    packs.assign((order.size() + 3) / 4, Triangle_Pack());
+    triangles = order;
+
+    for ( int position = 0 ; position < (int) order.size() ; position++ )
+    {
+        const Triangle& triangle = _triangles[order[position]];
+
+        Triangle_Pack& pack = packs[position / 4];
+        int lane = position % 4;
+
+        const Vec3* vertices[3] = { &triangle.vertex_a, &triangle.vertex_b, &triangle.vertex_c };
+        float (*components[3])[4] = { pack.a, pack.b, pack.c };
+
+        for ( int vertex = 0 ; vertex < 3 ; vertex++ )
+        {
+            components[vertex][0][lane] = vertices[vertex]->x;
+            components[vertex][1][lane] = vertices[vertex]->y;
+            components[vertex][2][lane] = vertices[vertex]->z;
+        }
+    }
+}
+
+size_t Triangle_Packs::get_memory() const
+{
+    return packs.capacity() * sizeof(Triangle_Pack) + triangles.capacity() * sizeof(int);
+}
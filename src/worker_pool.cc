@@ -0,0 +1,117 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "trace.h"
+
+//  --  class Worker_Pool  --  //
+
+// Constructors
+Worker_Pool::Worker_Pool(const std::string& _name)
+    : name{_name}
+{
+
+}
+// Destructor
+Worker_Pool::~Worker_Pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for ( std::thread& thread : workers )
+        thread.join();
+}
+
+// Member functions
+void Worker_Pool::run(int threads, const std::function<void()>& _task)
+{
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+
+    int helpers = threads - 1;
+
+    if ( helpers > 0 )
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            while ( (int) workers.size() < helpers )
+            {
+                int index = (int) workers.size() + 1;
+                workers.emplace_back( [this, index]() { work_loop(index); } );
+            }
+
+            task    = &_task;
+            wanted  = helpers;
+            generation++;
+        }
+        condition.notify_all();
+    }
+
+    _task();
+
+    if ( helpers > 0 )
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return (wanted == 0) && (running == 0); });
+
+        task = nullptr;
+    }
+}
+
+void Worker_Pool::run_rows(int rows, int threads, const std::function<void(int, int)>& function)
+{
+    threads = std::max(1, std::min(threads, rows));
+
+    std::atomic<int> next_band{0};
+
+    run(threads, [&]()
+    {
+        for ( int band = next_band++ ; band < threads ; band = next_band++ )
+            function((rows * band) / threads, (rows * (band + 1)) / threads);
+    });
+}
+
+int Worker_Pool::get_threads()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) workers.size() + 1;
+}
+
+void Worker_Pool::work_loop(int index)
+{
+    Trace::set_thread_name(name + " " + std::to_string(index));
+
+    uint64_t joined = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while ( true )
+    {
+        condition.wait(lock, [&]()
+        {
+            return stopping || ( (wanted > 0) && (generation != joined) );
+        });
+
+        if ( stopping )
+            return;
+
+        joined = generation;
+        wanted--;
+        running++;
+
+        const std::function<void()>& current = *task;
+
+        lock.unlock();
+        current();
+        lock.lock();
+
+        running--;
+
+        if ( (wanted == 0) && (running == 0) )
+            finished.notify_all();
+    }
+}